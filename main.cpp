@@ -1,4 +1,22 @@
 #include <bits/stdc++.h>
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+#else
+#include <direct.h>
+#include <io.h>
+#endif
 using namespace std;
 
 // Utility types and helper functions
@@ -24,19 +42,48 @@ string trim(const string &s)
     return s.substr(start, end - start + 1);
 }
 
+// Worker threads to use when the caller does not say
+int hardware_threads()
+{
+    unsigned n = thread::hardware_concurrency();
+    return n == 0 ? 1 : (int)n;
+}
+
+// Split [0, n) into one contiguous chunk per thread and run fn(begin, end, threadIndex).
+// chunk = 0 divides evenly; a single thread runs inline.
+void parallel_for(size_t n, int threads, const function<void(size_t, size_t, int)> &fn, size_t chunk = 0)
+{
+    if (threads <= 1 || n < 2)
+    {
+        fn(0, n, 0);
+        return;
+    }
+    if (chunk == 0)
+        chunk = (n + threads - 1) / threads;
+    vector<thread> pool;
+    for (int t = 1; t < threads && (size_t)t * chunk < n; ++t)
+        pool.push_back(thread(fn, (size_t)t * chunk, min(n, (size_t)(t + 1) * chunk), t));
+    fn(0, min(n, chunk), 0);
+    for (size_t i = 0; i < pool.size(); ++i)
+        pool[i].join();
+}
+
 // Simple logging
 struct Logger
 {
     deque<string> q;
     size_t maxlen = 1000;
+    mutex mu; // background reloads log from their own thread
     void log(const string &s)
     {
+        lock_guard<mutex> lock(mu);
         q.push_back(s);
         if (q.size() > maxlen)
             q.pop_front();
     }
     void print_recent(size_t n = 20)
     {
+        lock_guard<mutex> lock(mu);
         cout << "Recent logs (last " << n << ":" << endl;
         size_t start = 0;
         if (q.size() > n)
@@ -46,6 +93,338 @@ struct Logger
     }
 } logger;
 
+// Metrics: per-thread counters and log-linear (HDR-style) latency histograms,
+// exported as Prometheus text. Build with -DSCR_NO_METRICS to compile every probe out.
+enum MetricCounter
+{
+    MC_DIJKSTRA_SETTLED,
+    MC_DIJKSTRA_PUSHES,
+    MC_DIJKSTRA_STALE,
+    MC_ASTAR_SETTLED,
+    MC_ASTAR_PUSHES,
+    MC_ASTAR_STALE,
+    MC_PINGS,
+    MC_COUNT
+};
+enum MetricHistogram
+{
+    MH_SHORTEST_PATH,
+    MH_ASTAR,
+    MH_ETA_FOR_BUS,
+    MH_MST,
+    MH_ISOCHRONE,
+    MH_ALTERNATIVES,
+    MH_ADD_BUS,
+    MH_MOVE_BUS,
+    MH_TICK,
+    MH_PING_BATCH,
+    MH_COUNT
+};
+const char *const METRIC_COUNTER_NAMES[MC_COUNT] = {"dijkstra_settled", "dijkstra_heap_pushes", "dijkstra_stale_pops", "astar_settled",
+                                                     "astar_heap_pushes", "astar_stale_pops", "gps_pings"};
+const char *const METRIC_HISTOGRAM_NAMES[MH_COUNT] = {"shortest_path", "astar", "eta_for_bus", "mst", "isochrone",
+                                                       "alternatives", "add_bus", "move_bus", "tick", "ping_batch"};
+
+// 8 linear sub-buckets per power of two: relative error below 12.5%
+const int HIST_BUCKETS = 8 + 61 * 8;
+
+int hist_bucket(uint64_t ns)
+{
+    if (ns < 8)
+        return (int)ns;
+    int e = 63 - __builtin_clzll(ns);
+    return 8 + (e - 3) * 8 + (int)((ns >> (e - 3)) & 7);
+}
+
+// Exclusive upper bound of a bucket in nanoseconds
+double hist_upper(int idx)
+{
+    if (idx < 8)
+        return idx + 1;
+    int e = (idx - 8) / 8 + 3, sub = (idx - 8) % 8;
+    return ldexp(9.0 + sub, e - 3);
+}
+
+// Written only by the owning thread (relaxed load+store, no locked instructions);
+// readers may sum them at any time.
+struct ThreadMetrics
+{
+    atomic<uint64_t> counters[MC_COUNT];
+    atomic<uint64_t> hist[MH_COUNT][HIST_BUCKETS];
+    atomic<uint64_t> histSumNs[MH_COUNT];
+
+    ThreadMetrics()
+    {
+        for (int i = 0; i < MC_COUNT; ++i)
+            counters[i].store(0, memory_order_relaxed);
+        for (int h = 0; h < MH_COUNT; ++h)
+        {
+            histSumNs[h].store(0, memory_order_relaxed);
+            for (int b = 0; b < HIST_BUCKETS; ++b)
+                hist[h][b].store(0, memory_order_relaxed);
+        }
+    }
+    static void bump(atomic<uint64_t> &a, uint64_t n) { a.store(a.load(memory_order_relaxed) + n, memory_order_relaxed); }
+    void add(MetricCounter c, uint64_t n) { bump(counters[c], n); }
+    void record(MetricHistogram h, uint64_t ns)
+    {
+        bump(hist[h][hist_bucket(ns)], 1);
+        bump(histSumNs[h], ns);
+    }
+};
+
+// Live per-thread blocks plus the totals of threads that already exited
+struct MetricsRegistry
+{
+    mutex mu;
+    vector<ThreadMetrics *> live;
+    ThreadMetrics retired;
+    bool enabled; // runtime switch (used by the overhead benchmark)
+
+    MetricsRegistry() : enabled(true) {}
+
+    void fold(const ThreadMetrics &from, ThreadMetrics &into)
+    {
+        for (int i = 0; i < MC_COUNT; ++i)
+            ThreadMetrics::bump(into.counters[i], from.counters[i].load(memory_order_relaxed));
+        for (int h = 0; h < MH_COUNT; ++h)
+        {
+            ThreadMetrics::bump(into.histSumNs[h], from.histSumNs[h].load(memory_order_relaxed));
+            for (int b = 0; b < HIST_BUCKETS; ++b)
+                ThreadMetrics::bump(into.hist[h][b], from.hist[h][b].load(memory_order_relaxed));
+        }
+    }
+
+    // Sum of all threads (snapshot)
+    void collect(ThreadMetrics &total)
+    {
+        lock_guard<mutex> lock(mu);
+        fold(retired, total);
+        for (size_t i = 0; i < live.size(); ++i)
+            fold(*live[i], total);
+    }
+
+    static void clear(ThreadMetrics &t)
+    {
+        for (int c = 0; c < MC_COUNT; ++c)
+            t.counters[c].store(0, memory_order_relaxed);
+        for (int h = 0; h < MH_COUNT; ++h)
+        {
+            t.histSumNs[h].store(0, memory_order_relaxed);
+            for (int b = 0; b < HIST_BUCKETS; ++b)
+                t.hist[h][b].store(0, memory_order_relaxed);
+        }
+    }
+
+    // Start a fresh measurement window (racing probes may still land in it)
+    void reset()
+    {
+        lock_guard<mutex> lock(mu);
+        clear(retired);
+        for (size_t i = 0; i < live.size(); ++i)
+            clear(*live[i]);
+    }
+} metricsRegistry;
+
+// Registers on first use in a thread, folds into the retired totals when the thread exits
+struct ThreadMetricsHandle
+{
+    ThreadMetrics *m;
+    ThreadMetricsHandle() : m(new ThreadMetrics())
+    {
+        lock_guard<mutex> lock(metricsRegistry.mu);
+        metricsRegistry.live.push_back(m);
+    }
+    ~ThreadMetricsHandle()
+    {
+        lock_guard<mutex> lock(metricsRegistry.mu);
+        metricsRegistry.fold(*m, metricsRegistry.retired);
+        metricsRegistry.live.erase(find(metricsRegistry.live.begin(), metricsRegistry.live.end(), m));
+        delete m;
+    }
+};
+
+ThreadMetrics &thread_metrics()
+{
+    static thread_local ThreadMetricsHandle handle;
+    return *handle.m;
+}
+
+// Times the enclosing scope into a histogram
+struct ScopedLatency
+{
+    MetricHistogram h;
+    bool on;
+    chrono::steady_clock::time_point t0;
+    ScopedLatency(MetricHistogram h_) : h(h_), on(metricsRegistry.enabled)
+    {
+        if (on)
+            t0 = chrono::steady_clock::now();
+    }
+    ~ScopedLatency()
+    {
+        if (on)
+            thread_metrics().record(h, (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - t0).count());
+    }
+};
+
+#ifndef SCR_NO_METRICS
+#define METRIC_ADD(c, n)                    \
+    do                                      \
+    {                                       \
+        if (metricsRegistry.enabled)        \
+            thread_metrics().add((c), (n)); \
+    } while (0)
+#define METRIC_LATENCY(h) ScopedLatency scopedLatency_(h)
+#else
+#define METRIC_ADD(c, n) ((void)0)
+#define METRIC_LATENCY(h) ((void)0)
+#endif
+
+// Approximate quantile (upper bucket bound) in seconds
+double hist_quantile(const ThreadMetrics &t, int h, double q)
+{
+    uint64_t count = 0;
+    for (int b = 0; b < HIST_BUCKETS; ++b)
+        count += t.hist[h][b].load(memory_order_relaxed);
+    if (count == 0)
+        return 0.0;
+    uint64_t want = (uint64_t)ceil(q * count), seen = 0;
+    for (int b = 0; b < HIST_BUCKETS; ++b)
+    {
+        seen += t.hist[h][b].load(memory_order_relaxed);
+        if (seen >= want)
+            return hist_upper(b) * 1e-9;
+    }
+    return hist_upper(HIST_BUCKETS - 1) * 1e-9;
+}
+
+// Prometheus text exposition of everything recorded so far
+string metrics_prometheus()
+{
+    ThreadMetrics total;
+    metricsRegistry.collect(total);
+    stringstream ss;
+    for (int c = 0; c < MC_COUNT; ++c)
+    {
+        ss << "# TYPE scr_" << METRIC_COUNTER_NAMES[c] << "_total counter\n";
+        ss << "scr_" << METRIC_COUNTER_NAMES[c] << "_total " << total.counters[c].load() << "\n";
+    }
+    ss << "# TYPE scr_op_latency_seconds histogram\n";
+    for (int h = 0; h < MH_COUNT; ++h)
+    {
+        uint64_t cum = 0;
+        for (int b = 0; b < HIST_BUCKETS; ++b)
+        {
+            cum += total.hist[h][b].load(memory_order_relaxed);
+            // Export fixed power-of-two boundaries from ~1us to ~69s to keep the dump short
+            int k = (b - 8) / 8 + 4;
+            if (b >= 8 && (b - 8) % 8 == 7 && k >= 10 && k <= 36)
+                ss << "scr_op_latency_seconds_bucket{op=\"" << METRIC_HISTOGRAM_NAMES[h] << "\",le=\"" << hist_upper(b) * 1e-9 << "\"} " << cum << "\n";
+        }
+        ss << "scr_op_latency_seconds_bucket{op=\"" << METRIC_HISTOGRAM_NAMES[h] << "\",le=\"+Inf\"} " << cum << "\n";
+        ss << "scr_op_latency_seconds_sum{op=\"" << METRIC_HISTOGRAM_NAMES[h] << "\"} " << total.histSumNs[h].load() * 1e-9 << "\n";
+        ss << "scr_op_latency_seconds_count{op=\"" << METRIC_HISTOGRAM_NAMES[h] << "\"} " << cum << "\n";
+    }
+    return ss.str();
+}
+
+// Epoch-based reclamation: a reader announces the epoch it entered in its thread's slot, and
+// an object retired in epoch E is freed once no reader is still inside an epoch before E.
+// Readers only ever store to their own slot, so they never block.
+struct EpochDomain
+{
+    static const int SLOTS = 256;
+    struct alignas(64) Slot
+    {
+        atomic<uint64_t> active; // epoch the reader entered, 0 while outside
+        atomic<bool> used;
+    };
+    Slot slots[SLOTS];
+    atomic<uint64_t> epoch;
+
+    EpochDomain() : epoch(1)
+    {
+        for (int i = 0; i < SLOTS; ++i)
+        {
+            slots[i].active.store(0);
+            slots[i].used.store(false);
+        }
+    }
+
+    int acquire_slot()
+    {
+        while (true)
+        {
+            for (int i = 0; i < SLOTS; ++i)
+            {
+                bool expected = false;
+                if (!slots[i].used.load(memory_order_relaxed) && slots[i].used.compare_exchange_strong(expected, true))
+                    return i;
+            }
+            this_thread::yield(); // more than SLOTS reader threads at once
+        }
+    }
+
+    void release_slot(int i)
+    {
+        slots[i].active.store(0);
+        slots[i].used.store(false, memory_order_release);
+    }
+
+    // Oldest epoch a reader is still inside, UINT64_MAX when all are outside
+    uint64_t min_active() const
+    {
+        uint64_t lo = UINT64_MAX;
+        for (int i = 0; i < SLOTS; ++i)
+        {
+            uint64_t e = slots[i].active.load();
+            if (e != 0 && e < lo)
+                lo = e;
+        }
+        return lo;
+    }
+} epochs;
+
+// Claims a slot on first use in a thread, gives it back when the thread exits
+struct EpochReader
+{
+    int slot;
+    int depth; // nested guards share the outermost epoch
+    EpochReader() : slot(-1), depth(0) {}
+    ~EpochReader()
+    {
+        if (slot >= 0)
+            epochs.release_slot(slot);
+    }
+};
+
+EpochReader &epoch_reader()
+{
+    static thread_local EpochReader reader;
+    return reader;
+}
+
+struct EpochGuard
+{
+    EpochGuard()
+    {
+        EpochReader &r = epoch_reader();
+        if (r.depth++ > 0)
+            return;
+        if (r.slot < 0)
+            r.slot = epochs.acquire_slot();
+        // seq_cst: the announcement is visible before any pointer the reader loads next
+        epochs.slots[r.slot].active.store(epochs.epoch.load());
+    }
+    ~EpochGuard()
+    {
+        EpochReader &r = epoch_reader();
+        if (--r.depth == 0)
+            epochs.slots[r.slot].active.store(0, memory_order_release);
+    }
+};
+
 // Trie for autocomplete
 struct TrieNode
 {
@@ -57,6 +436,35 @@ struct Trie
 {
     TrieNode *root;
     Trie() { root = new TrieNode(); }
+    // Owns its nodes: copies clone the whole tree instead of sharing pointers
+    Trie(const Trie &o) : root(clone(o.root)) {}
+    Trie &operator=(const Trie &o)
+    {
+        if (this != &o)
+        {
+            TrieNode *fresh = clone(o.root);
+            destroy(root);
+            root = fresh;
+        }
+        return *this;
+    }
+    ~Trie() { destroy(root); }
+    static TrieNode *clone(const TrieNode *node)
+    {
+        TrieNode *out = new TrieNode();
+        out->end = node->end;
+        for (unordered_map<char, TrieNode *>::const_iterator it = node->nxt.begin(); it != node->nxt.end(); ++it)
+            out->nxt[it->first] = clone(it->second);
+        return out;
+    }
+    static void destroy(TrieNode *node)
+    {
+        if (node == NULL)
+            return;
+        for (unordered_map<char, TrieNode *>::iterator it = node->nxt.begin(); it != node->nxt.end(); ++it)
+            destroy(it->second);
+        delete node;
+    }
     void insert(const string &s)
     {
         TrieNode *cur = root;
@@ -94,80 +502,375 @@ struct Trie
     }
 };
 
+// Stop names: stored once in an append-only arena and handed out as non-owning views.
+// (C++11 has no std::string_view, so NameView plays that role.) Views stay valid for
+// as long as any Graph sharing the arena is alive, including across reloads.
+struct NameView
+{
+    const char *ptr;
+    size_t len;
+    NameView() : ptr(""), len(0) {}
+    NameView(const char *p, size_t n) : ptr(p), len(n) {}
+    NameView(const char *s) : ptr(s), len(strlen(s)) {}
+    NameView(const string &s) : ptr(s.data()), len(s.size()) {}
+    const char *data() const { return ptr; }
+    size_t size() const { return len; }
+    bool empty() const { return len == 0; }
+    string str() const { return string(ptr, len); }
+    operator string() const { return str(); }
+};
+bool operator==(NameView a, NameView b)
+{
+    return a.len == b.len && memcmp(a.ptr, b.ptr, a.len) == 0;
+}
+bool operator!=(NameView a, NameView b)
+{
+    return !(a == b);
+}
+bool operator<(NameView a, NameView b)
+{
+    int c = memcmp(a.ptr, b.ptr, min(a.len, b.len));
+    return c < 0 || (c == 0 && a.len < b.len);
+}
+ostream &operator<<(ostream &os, NameView v)
+{
+    return os.write(v.ptr, (streamsize)v.len);
+}
+string operator+(const string &a, NameView b)
+{
+    string out(a);
+    out.append(b.ptr, b.len);
+    return out;
+}
+// trim() without allocating
+NameView trim_view(NameView s)
+{
+    size_t b = 0, e = s.len;
+    while (b < e && (s.ptr[b] == ' ' || s.ptr[b] == '\t' || s.ptr[b] == '\r' || s.ptr[b] == '\n'))
+        b++;
+    while (e > b && (s.ptr[e - 1] == ' ' || s.ptr[e - 1] == '\t' || s.ptr[e - 1] == '\r' || s.ptr[e - 1] == '\n'))
+        e--;
+    return NameView(s.ptr + b, e - b);
+}
+uint64_t hash_name(NameView s)
+{
+    uint64_t h = 1469598103934665603ULL; // FNV-1a
+    for (size_t i = 0; i < s.len; ++i)
+        h = (h ^ (unsigned char)s.ptr[i]) * 1099511628211ULL;
+    return h;
+}
+
+// Chunked so interned bytes never move; shared between Graph copies
+struct NameArena
+{
+    static const size_t CHUNK = 1 << 16;
+    vector<char *> chunks;
+    size_t used;  // bytes taken in the last chunk
+    size_t total; // bytes handed out
+    mutex lock;
+
+    NameArena() : used(CHUNK), total(0) {}
+    ~NameArena()
+    {
+        for (size_t i = 0; i < chunks.size(); ++i)
+            delete[] chunks[i];
+    }
+
+    NameView intern(NameView s)
+    {
+        lock_guard<mutex> g(lock);
+        if (used + s.len > CHUNK)
+        {
+            // Oversized names get a chunk of their own
+            chunks.push_back(new char[max(CHUNK, s.len)]);
+            used = 0;
+        }
+        char *dst = chunks.back() + used;
+        memcpy(dst, s.ptr, s.len);
+        used += s.len;
+        total += s.len;
+        return NameView(dst, s.len);
+    }
+
+    size_t reserved_bytes() const { return chunks.size() * CHUNK; }
+};
+const size_t NameArena::CHUNK;
+
 // Stops and edges
 struct Stop
 {
     StopID id;
-    string name;
+    NameView name; // points into the graph's name arena
     Point loc;
     Stop()
     {
         id = -1;
-        name = "";
         loc.x = 0;
         loc.y = 0;
     }
-    Stop(StopID id_, const string &name_, Point loc_)
+    Stop(StopID id_, NameView name_, Point loc_)
     {
         id = id_;
         name = name_;
         loc = loc_;
     }
 };
-struct Edge
+
+// Edge weight encodings. Weights enter and leave a graph in minutes and are stored as W:
+// double and float as minutes, uint32_t as fixed point in deciseconds (600 per minute).
+template <class W>
+struct WeightTraits;
+template <>
+struct WeightTraits<double>
+{
+    static const bool integral = false;
+    static double inf() { return 1e18; }
+    static double from_minutes(double m) { return m; }
+    static double to_minutes(double w) { return w; }
+    static double add(double a, double b) { return a + b; }
+};
+template <>
+struct WeightTraits<float>
+{
+    static const bool integral = false;
+    static float inf() { return 1e18f; }
+    static float from_minutes(double m) { return (float)m; }
+    static double to_minutes(float w) { return w >= 1e17f ? 1e18 : (double)w; }
+    static float add(float a, float b) { return a + b; }
+};
+template <>
+struct WeightTraits<uint32_t>
+{
+    static const bool integral = true;
+    static const uint32_t SCALE = 600; // deciseconds per minute
+    static uint32_t inf() { return UINT32_MAX; }
+    static uint32_t from_minutes(double m)
+    {
+        double ds = floor(m * SCALE + 0.5);
+        return ds <= 0 ? 0 : ds >= UINT32_MAX - 1.0 ? UINT32_MAX - 1 : (uint32_t)ds;
+    }
+    static double to_minutes(uint32_t w) { return w == UINT32_MAX ? 1e18 : w / (double)SCALE; }
+    // Saturates below inf() so very long paths cannot wrap around
+    static uint32_t add(uint32_t a, uint32_t b)
+    {
+        uint64_t s = (uint64_t)a + b;
+        return s >= UINT32_MAX ? UINT32_MAX - 1 : (uint32_t)s;
+    }
+};
+
+// 16 bytes with double weights, 8 with float or fixed point (no padding, weights stay aligned)
+template <class W>
+struct BasicEdge
 {
     StopID to;
-    double weight;
-    Edge()
+    W weight;
+    BasicEdge()
     {
         to = 0;
         weight = 0;
     }
-    Edge(StopID t, double w)
+    BasicEdge(StopID t, W w)
     {
         to = t;
         weight = w;
     }
 };
+typedef BasicEdge<double> Edge;
+
+// Open-addressing (linear probing) name -> id map. Slots hold only a hash tag and the id;
+// keys are read back from the stops themselves. Lookups take any NameView, so callers
+// holding a std::string, a C string or a view never build a temporary key.
+struct NameMap
+{
+    struct Slot
+    {
+        uint32_t tag; // low hash bits, checked before comparing bytes
+        StopID id;    // -1 marks an empty slot
+    };
+    vector<Slot> slots;
+    size_t count;
+
+    NameMap() : count(0) {}
+
+    void clear()
+    {
+        slots.clear();
+        count = 0;
+    }
+
+    size_t size() const { return count; }
+
+    size_t memory_bytes() const { return slots.capacity() * sizeof(Slot); }
+
+    StopID find(NameView key, const vector<Stop> &stops) const
+    {
+        if (slots.empty())
+            return -1;
+        uint64_t h = hash_name(key);
+        size_t mask = slots.size() - 1;
+        for (size_t i = (size_t)(h >> 32) & mask;; i = (i + 1) & mask)
+        {
+            const Slot &s = slots[i];
+            if (s.id == -1)
+                return -1;
+            if (s.tag == (uint32_t)h && stops[s.id].name == key)
+                return s.id;
+        }
+    }
+
+    // stops[id] must already carry its name; an existing name is remapped to id
+    void insert(StopID id, const vector<Stop> &stops)
+    {
+        if ((count + 1) * 10 > slots.size() * 7)
+            grow(stops);
+        NameView key = stops[id].name;
+        uint64_t h = hash_name(key);
+        size_t mask = slots.size() - 1;
+        for (size_t i = (size_t)(h >> 32) & mask;; i = (i + 1) & mask)
+        {
+            Slot &s = slots[i];
+            if (s.id == -1)
+            {
+                s.tag = (uint32_t)h;
+                s.id = id;
+                count++;
+                return;
+            }
+            if (s.tag == (uint32_t)h && stops[s.id].name == key)
+            {
+                s.id = id;
+                return;
+            }
+        }
+    }
+
+    void grow(const vector<Stop> &stops)
+    {
+        vector<Slot> old;
+        old.swap(slots);
+        Slot empty;
+        empty.tag = 0;
+        empty.id = -1;
+        slots.assign(max((size_t)16, old.size() * 2), empty);
+        count = 0;
+        for (size_t i = 0; i < old.size(); ++i)
+            if (old[i].id != -1)
+                insert(old[i].id, stops);
+    }
+};
 
-struct Graph
+// Network of stops; weights are stored as W (see WeightTraits)
+template <class W>
+struct BasicGraph
 {
+    typedef WeightTraits<W> Traits;
     vector<Stop> stops;
-    unordered_map<string, StopID> nameToId;
-    vector<vector<Edge>> adj;
+    shared_ptr<NameArena> names; // copies share it; a reload starts a fresh one, older copies keep theirs
+    NameMap nameToId;
+    vector<vector<BasicEdge<W>>> adj;
+    uint64_t version; // bumped on every change; cached query results are keyed by it
+    // Stops may be renumbered for locality (see permute). Ids shown to users and written to text
+    // files stay the external ones: extOf[internal] and intOf[external], both empty = identity.
+    vector<StopID> extOf, intOf;
 
-    Graph() {}
+    BasicGraph() : names(make_shared<NameArena>()), version(0) {}
 
-    StopID add_stop(const string &name, double x = 0.0, double y = 0.0)
+    StopID add_stop(NameView name, double x = 0.0, double y = 0.0)
     {
-        string tn = trim(name);
-        if (nameToId.count(tn))
-            return nameToId[tn];
+        NameView tn = trim_view(name);
+        StopID found = nameToId.find(tn, stops);
+        if (found != -1)
+            return found;
         StopID id = (StopID)stops.size();
+        tn = names->intern(tn);
         stops.push_back(Stop(id, tn, Point{x, y}));
-        nameToId[tn] = id;
+        nameToId.insert(id, stops);
+        adj.emplace_back();
+        if (!extOf.empty())
+        {
+            extOf.push_back((StopID)intOf.size());
+            intOf.push_back(id);
+        }
+        version++;
+        logger.log(string("Added stop: ") + tn + " (id=" + to_string(external_id(id)) + ")");
+        return id;
+    }
+
+    // Add a stop even when its name is taken (get_id keeps the first); ids follow call order
+    StopID append_stop(NameView name, double x = 0.0, double y = 0.0)
+    {
+        NameView tn = trim_view(name);
+        StopID id = (StopID)stops.size();
+        bool taken = nameToId.find(tn, stops) != -1;
+        stops.push_back(Stop(id, names->intern(tn), Point{x, y}));
+        if (!taken)
+            nameToId.insert(id, stops);
         adj.emplace_back();
-        logger.log(string("Added stop: ") + tn + " (id=" + to_string(id) + ")");
+        if (!extOf.empty())
+        {
+            extOf.push_back((StopID)intOf.size());
+            intOf.push_back(id);
+        }
+        version++;
         return id;
     }
 
-    bool has_stop(const string &name) const
+    StopID external_id(StopID v) const
     {
-        return nameToId.count(trim(name)) > 0;
+        return extOf.empty() || v < 0 || v >= (StopID)extOf.size() ? v : extOf[v];
     }
 
-    StopID get_id(const string &name) const
+    // -1 for ids no stop has
+    StopID internal_id(StopID e) const
     {
-        auto t = nameToId.find(trim(name));
-        if (t == nameToId.end())
+        if (e < 0 || e >= (StopID)(intOf.empty() ? stops.size() : intOf.size()))
             return -1;
-        return t->second;
+        return intOf.empty() ? e : intOf[e];
+    }
+
+    // Move stop v to position newOf[v] (a permutation), renaming every edge to match
+    void permute(const vector<StopID> &newOf)
+    {
+        size_t n = stops.size();
+        vector<Stop> ns(n);
+        vector<vector<BasicEdge<W>>> na(n);
+        vector<StopID> ext(n);
+        for (size_t v = 0; v < n; ++v)
+        {
+            StopID to = newOf[v];
+            ns[to] = stops[v];
+            ns[to].id = to;
+            na[to].swap(adj[v]);
+            for (size_t j = 0; j < na[to].size(); ++j)
+                na[to][j].to = newOf[na[to][j].to];
+            ext[to] = external_id((StopID)v);
+        }
+        stops.swap(ns);
+        adj.swap(na);
+        extOf.swap(ext);
+        intOf.assign(n, -1);
+        for (size_t v = 0; v < n; ++v)
+            intOf[extOf[v]] = (StopID)v;
+        nameToId.clear();
+        for (size_t v = 0; v < n; ++v)
+            nameToId.insert((StopID)v, stops);
+        version++;
+    }
+
+    bool has_stop(NameView name) const
+    {
+        return nameToId.find(trim_view(name), stops) != -1;
+    }
+
+    StopID get_id(NameView name) const
+    {
+        return nameToId.find(trim_view(name), stops);
     }
 
-    string get_name(StopID id) const
+    NameView get_name(StopID id) const
     {
         if (id < 0 || id >= (StopID)stops.size())
-            return "";
+            return NameView();
         return stops[id].name;
     }
 
@@ -183,9 +886,10 @@ struct Graph
         if (id < 0 || id >= (StopID)stops.size())
             return;
         stops[id].loc = Point{x, y};
+        version++;
     }
 
-    void add_edge(const string &a, const string &b, double weight, bool bidir = true)
+    void add_edge(NameView a, NameView b, double weight, bool bidir = true)
     {
         StopID u = add_stop(a);
         StopID v = add_stop(b);
@@ -196,19 +900,44 @@ struct Graph
     {
         if (u < 0 || v < 0 || u >= (StopID)stops.size() || v >= (StopID)stops.size())
             return;
-        adj[u].push_back(Edge(v, weight));
+        adj[u].push_back(BasicEdge<W>(v, Traits::from_minutes(weight)));
         if (bidir)
-            adj[v].push_back(Edge(u, weight));
+            adj[v].push_back(BasicEdge<W>(u, Traits::from_minutes(weight)));
+        version++;
         logger.log(string("Added edge: ") + stops[u].name + " <-> " + stops[v].name + " (" + to_string(weight) + ")");
     }
 
+    // Take out every u -> v edge; returns their weights in minutes
+    vector<double> remove_edges(StopID u, StopID v)
+    {
+        vector<double> removed;
+        if (u < 0 || v < 0 || u >= (StopID)stops.size() || v >= (StopID)stops.size())
+            return removed;
+        vector<BasicEdge<W>> &row = adj[u];
+        size_t keep = 0;
+        for (size_t j = 0; j < row.size(); ++j)
+        {
+            if (row[j].to == v)
+                removed.push_back(Traits::to_minutes(row[j].weight));
+            else
+                row[keep++] = row[j];
+        }
+        row.resize(keep);
+        if (!removed.empty())
+        {
+            version++;
+            logger.log(string("Removed edge: ") + stops[u].name + " -> " + stops[v].name);
+        }
+        return removed;
+    }
+
     vector<pair<StopID, double>> neighbors(StopID u) const
     {
         vector<pair<StopID, double>> out;
         if (u < 0 || u >= (StopID)adj.size())
             return out;
         for (size_t i = 0; i < adj[u].size(); ++i)
-            out.push_back(make_pair(adj[u][i].to, adj[u][i].weight));
+            out.push_back(make_pair(adj[u][i].to, Traits::to_minutes(adj[u][i].weight)));
         return out;
     }
 
@@ -224,14 +953,14 @@ struct Graph
         for (size_t i = 0; i < stops.size(); ++i)
         {
             const Stop &s = stops[i];
-            sf << s.id << "\t" << s.name << "\t" << s.loc.x << "\t" << s.loc.y << "\n";
+            sf << external_id(s.id) << "\t" << s.name << "\t" << s.loc.x << "\t" << s.loc.y << "\n";
         }
         for (size_t u = 0; u < adj.size(); ++u)
         {
             for (size_t j = 0; j < adj[u].size(); ++j)
             {
-                const Edge &e = adj[u][j];
-                ef << u << "\t" << e.to << "\t" << e.weight << "\n";
+                const BasicEdge<W> &e = adj[u][j];
+                ef << external_id((StopID)u) << "\t" << external_id(e.to) << "\t" << Traits::to_minutes(e.weight) << "\n";
             }
         }
         sf.close();
@@ -249,6 +978,10 @@ struct Graph
         stops.clear();
         nameToId.clear();
         adj.clear();
+        extOf.clear();
+        intOf.clear();
+        names = make_shared<NameArena>();
+        version++;
 
         string line;
         while (getline(sf, line))
@@ -281,8 +1014,8 @@ struct Graph
             }
             if ((int)stops.size() <= id)
                 stops.resize(id + 1);
-            stops[id] = Stop(id, name, Point{x, y});
-            nameToId[name] = id;
+            stops[id] = Stop(id, names->intern(name), Point{x, y});
+            nameToId.insert(id, stops);
             if (adj.size() <= (size_t)id)
                 adj.resize(id + 1);
         }
@@ -299,48 +1032,511 @@ struct Graph
             {
                 if ((size_t)u >= adj.size() || (size_t)v >= adj.size())
                     continue;
-                adj[u].push_back(Edge(v, w));
+                adj[u].push_back(BasicEdge<W>(v, Traits::from_minutes(w)));
             }
         }
         logger.log(string("Loaded graph from files: ") + stopsFile + " , " + edgesFile);
         return true;
     }
-};
 
-// Dijkstra
-pair<vector<double>, vector<int>> dijkstra(const Graph &g, StopID src)
-{
-    size_t n = g.size();
-    const double INF = 1e18;
-    vector<double> dist(n, INF);
-    vector<int> prev(n, -1);
-    typedef pair<double, StopID> PDI;
-    priority_queue<PDI, vector<PDI>, greater<PDI>> pq;
-    if (src < 0 || src >= (StopID)n)
-        return make_pair(dist, prev);
-    dist[src] = 0;
-    pq.push(make_pair(0.0, src));
-    while (!pq.empty())
+    // Compact binary snapshot: magic, stop count, stops (name, x, y), then per-stop edge lists
+    bool save_binary(const string &file) const
     {
-        PDI top = pq.top();
-        pq.pop();
-        double d = top.first;
-        StopID u = top.second;
-        if (d > dist[u])
-            continue;
-        vector<pair<StopID, double>> nbrs = g.neighbors(u);
-        for (size_t i = 0; i < nbrs.size(); ++i)
+        FILE *fp = fopen(file.c_str(), "wb");
+        if (!fp)
+            return false;
+        bool ok = write_binary(fp);
+        fclose(fp);
+        logger.log(string("Saved graph to binary file: ") + file);
+        return ok;
+    }
+
+    bool write_binary(FILE *fp) const
+    {
+        const char magic[4] = {'S', 'C', 'R', 'G'};
+        uint32_t fmt = 1;
+        uint64_t n = stops.size();
+        fwrite(magic, 1, 4, fp);
+        fwrite(&fmt, sizeof(fmt), 1, fp);
+        fwrite(&n, sizeof(n), 1, fp);
+        for (size_t i = 0; i < stops.size(); ++i)
         {
-            StopID v = nbrs[i].first;
-            double w = nbrs[i].second;
-            if (dist[v] > dist[u] + w)
+            uint32_t len = (uint32_t)stops[i].name.size();
+            fwrite(&len, sizeof(len), 1, fp);
+            fwrite(stops[i].name.data(), 1, len, fp);
+            fwrite(&stops[i].loc.x, sizeof(double), 1, fp);
+            fwrite(&stops[i].loc.y, sizeof(double), 1, fp);
+        }
+        for (size_t u = 0; u < adj.size(); ++u)
+        {
+            uint32_t deg = (uint32_t)adj[u].size();
+            fwrite(&deg, sizeof(deg), 1, fp);
+            for (size_t j = 0; j < adj[u].size(); ++j)
+            {
+                int32_t to = adj[u][j].to;
+                double w = Traits::to_minutes(adj[u][j].weight);
+                fwrite(&to, sizeof(to), 1, fp);
+                fwrite(&w, sizeof(double), 1, fp);
+            }
+        }
+        return !ferror(fp);
+    }
+
+    bool load_binary(const string &file)
+    {
+        FILE *fp = fopen(file.c_str(), "rb");
+        if (!fp)
+            return false;
+        bool ok = read_binary(fp);
+        fclose(fp);
+        logger.log(string("Loaded graph from binary file: ") + file);
+        return ok;
+    }
+
+    bool read_binary(FILE *fp)
+    {
+        char magic[4];
+        uint32_t fmt = 0;
+        uint64_t n = 0;
+        if (fread(magic, 1, 4, fp) != 4 || memcmp(magic, "SCRG", 4) != 0 || fread(&fmt, sizeof(fmt), 1, fp) != 1 || fmt != 1 ||
+            fread(&n, sizeof(n), 1, fp) != 1)
+            return false;
+        stops.clear();
+        nameToId.clear();
+        adj.clear();
+        extOf.clear();
+        intOf.clear();
+        names = make_shared<NameArena>();
+        version++;
+        stops.resize(n);
+        adj.resize(n);
+        bool ok = true;
+        string name;
+        for (uint64_t i = 0; i < n && ok; ++i)
+        {
+            uint32_t len = 0;
+            double xy[2];
+            ok = fread(&len, sizeof(len), 1, fp) == 1;
+            name.resize(ok ? len : 0);
+            ok = ok && (len == 0 || fread(&name[0], 1, len, fp) == len) && fread(xy, sizeof(double), 2, fp) == 2;
+            stops[i] = Stop((StopID)i, names->intern(name), Point{xy[0], xy[1]});
+            nameToId.insert((StopID)i, stops);
+        }
+        for (uint64_t u = 0; u < n && ok; ++u)
+        {
+            uint32_t deg = 0;
+            ok = fread(&deg, sizeof(deg), 1, fp) == 1;
+            for (uint32_t j = 0; j < deg && ok; ++j)
+            {
+                int32_t to;
+                double w;
+                ok = fread(&to, sizeof(to), 1, fp) == 1 && fread(&w, sizeof(w), 1, fp) == 1 && to >= 0 && (uint64_t)to < n;
+                if (ok)
+                    adj[u].push_back(BasicEdge<W>(to, Traits::from_minutes(w)));
+            }
+        }
+        return ok;
+    }
+
+    // Same stops and names, weights re-encoded as W
+    template <class V>
+    void assign_from(const BasicGraph<V> &o)
+    {
+        stops = o.stops;
+        names = o.names;
+        nameToId = o.nameToId;
+        version = o.version;
+        extOf = o.extOf;
+        intOf = o.intOf;
+        adj.assign(o.adj.size(), vector<BasicEdge<W>>());
+        for (size_t u = 0; u < o.adj.size(); ++u)
+        {
+            adj[u].reserve(o.adj[u].size());
+            for (size_t j = 0; j < o.adj[u].size(); ++j)
+                adj[u].push_back(BasicEdge<W>(o.adj[u][j].to, Traits::from_minutes(WeightTraits<V>::to_minutes(o.adj[u][j].weight))));
+        }
+    }
+};
+typedef BasicGraph<double> Graph;
+typedef BasicGraph<float> FloatGraph;
+typedef BasicGraph<uint32_t> FixedGraph; // deciseconds
+
+// Locality-preserving stop orders. Ids follow insertion or file order, which can scatter
+// neighbouring stops across stops/adj and every per-stop search array; renumbering along a
+// Hilbert curve over the coordinates, or in BFS / reverse Cuthill-McKee order over the
+// edges, puts stops that are searched together next to each other in memory.
+enum StopOrder
+{
+    ORDER_HILBERT,
+    ORDER_BFS,
+    ORDER_RCM,
+    ORDER_COUNT
+};
+const char *const STOP_ORDER_NAMES[ORDER_COUNT] = {"hilbert", "bfs", "rcm"};
+
+bool parse_stop_order(const string &s, StopOrder &out)
+{
+    for (int i = 0; i < ORDER_COUNT; ++i)
+    {
+        if (s == STOP_ORDER_NAMES[i])
+        {
+            out = (StopOrder)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Position of (x, y) along a Hilbert curve filling a 65536 x 65536 grid
+uint64_t hilbert_index(uint32_t x, uint32_t y)
+{
+    const uint32_t n = 1u << 16;
+    uint64_t d = 0;
+    for (uint32_t s = n / 2; s > 0; s /= 2)
+    {
+        uint32_t rx = (x & s) > 0, ry = (y & s) > 0;
+        d += (uint64_t)s * s * ((3 * rx) ^ ry);
+        if (ry == 0)
+        {
+            if (rx == 1)
+            {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            swap(x, y);
+        }
+    }
+    return d;
+}
+
+// New position for every stop (a permutation for BasicGraph::permute)
+template <class W>
+vector<StopID> locality_order(const BasicGraph<W> &g, StopOrder order)
+{
+    size_t n = g.size();
+    vector<StopID> seq;
+    seq.reserve(n);
+    if (order == ORDER_HILBERT)
+    {
+        double x0 = 1e300, y0 = 1e300, x1 = -1e300, y1 = -1e300;
+        for (size_t v = 0; v < n; ++v)
+        {
+            x0 = min(x0, g.stops[v].loc.x);
+            x1 = max(x1, g.stops[v].loc.x);
+            y0 = min(y0, g.stops[v].loc.y);
+            y1 = max(y1, g.stops[v].loc.y);
+        }
+        double scale = 65535.0 / max(1e-12, max(x1 - x0, y1 - y0));
+        vector<pair<uint64_t, StopID>> keys(n);
+        for (size_t v = 0; v < n; ++v)
+            keys[v] = make_pair(hilbert_index((uint32_t)((g.stops[v].loc.x - x0) * scale), (uint32_t)((g.stops[v].loc.y - y0) * scale)), (StopID)v);
+        sort(keys.begin(), keys.end());
+        for (size_t i = 0; i < n; ++i)
+            seq.push_back(keys[i].second);
+    }
+    else
+    {
+        // One component at a time, from a pseudo-peripheral stop (the far end of two BFS sweeps)
+        vector<int> mark(n, -1);
+        vector<char> placed(n, 0);
+        vector<StopID> level;
+        int stamp = 0;
+        bool rcm = order == ORDER_RCM;
+        for (size_t root = 0; root < n; ++root)
+        {
+            if (placed[root])
+                continue;
+            StopID start = (StopID)root;
+            for (int sweep = 0; sweep < 2; ++sweep)
+            {
+                level.assign(1, start);
+                mark[start] = ++stamp;
+                for (size_t h = 0; h < level.size(); ++h)
+                    for (size_t j = 0; j < g.adj[level[h]].size(); ++j)
+                        if (!placed[g.adj[level[h]][j].to] && mark[g.adj[level[h]][j].to] != stamp)
+                        {
+                            mark[g.adj[level[h]][j].to] = stamp;
+                            level.push_back(g.adj[level[h]][j].to);
+                        }
+                start = level.back();
+            }
+            size_t head = seq.size();
+            seq.push_back(start);
+            placed[start] = 1;
+            vector<pair<size_t, StopID>> next;
+            for (; head < seq.size(); ++head)
+            {
+                StopID u = seq[head];
+                next.clear();
+                for (size_t j = 0; j < g.adj[u].size(); ++j)
+                {
+                    StopID v = g.adj[u][j].to;
+                    if (!placed[v])
+                    {
+                        placed[v] = 1;
+                        next.push_back(make_pair(rcm ? g.adj[v].size() : 0, v));
+                    }
+                }
+                // Cuthill-McKee visits lower-degree neighbours first
+                if (rcm)
+                    stable_sort(next.begin(), next.end());
+                for (size_t i = 0; i < next.size(); ++i)
+                    seq.push_back(next[i].second);
+            }
+        }
+        if (rcm)
+            reverse(seq.begin(), seq.end());
+    }
+    vector<StopID> newOf(n);
+    for (size_t i = 0; i < n; ++i)
+        newOf[seq[i]] = (StopID)i;
+    return newOf;
+}
+
+// Immutable, versioned copy of the network for concurrent readers
+struct GraphSnapshot
+{
+    Graph g;
+    uint64_t serial; // publication number, 0 for the initial empty snapshot
+    size_t edges;    // directed edge count at publication (lets readers sanity-check)
+    GraphSnapshot() : serial(0), edges(0) {}
+};
+
+template <class W>
+size_t count_edges(const BasicGraph<W> &g)
+{
+    size_t m = 0;
+    for (size_t u = 0; u < g.adj.size(); ++u)
+        m += g.adj[u].size();
+    return m;
+}
+
+// Read-copy-update publication of graph snapshots. Readers pin the current snapshot with an
+// epoch guard and one atomic load; writers build a whole new snapshot (a batch of edits, or
+// a reload) off to the side and swap the pointer. Old snapshots are freed by epoch.
+struct SnapshotStore
+{
+    atomic<const GraphSnapshot *> current;
+    mutex writer; // serialises publishers only
+    vector<pair<const GraphSnapshot *, uint64_t>> retired; // snapshot, epoch it was retired in
+    uint64_t published;
+    size_t reclaimed;
+
+    SnapshotStore() : current(new GraphSnapshot()), published(0), reclaimed(0) {}
+    // A copy starts out publishing the other store's current graph
+    SnapshotStore(const SnapshotStore &o) : current(new GraphSnapshot()), published(0), reclaimed(0)
+    {
+        Reader r(o);
+        publish(r.graph());
+    }
+    SnapshotStore &operator=(const SnapshotStore &o)
+    {
+        if (this != &o)
+        {
+            Reader r(o);
+            publish(r.graph());
+        }
+        return *this;
+    }
+    ~SnapshotStore()
+    {
+        // Owners outlive their readers, so everything can go
+        for (size_t i = 0; i < retired.size(); ++i)
+            delete retired[i].first;
+        delete current.load();
+    }
+
+    // Pins the snapshot that was current when it was constructed
+    struct Reader
+    {
+        EpochGuard guard; // must be entered before the pointer is loaded
+        const GraphSnapshot *snap;
+        explicit Reader(const SnapshotStore &s) : guard(), snap(s.current.load()) {}
+        const Graph &graph() const { return snap->g; }
+        uint64_t serial() const { return snap->serial; }
+    };
+
+    uint64_t publish(Graph g)
+    {
+        lock_guard<mutex> lock(writer);
+        return publish_locked(g);
+    }
+
+    // Apply a batch of edits to a private copy of the current graph, then publish it
+    uint64_t update(const function<void(Graph &)> &edits)
+    {
+        lock_guard<mutex> lock(writer);
+        Graph g = current.load()->g;
+        edits(g);
+        return publish_locked(g);
+    }
+
+    // Build the replacement from files on another thread and swap it in when complete;
+    // readers keep answering from the old snapshot meanwhile
+    future<bool> load_async(const string &stopsFile, const string &edgesFile)
+    {
+        return async(launch::async, [this, stopsFile, edgesFile]() {
+            Graph g;
+            if (!g.load_from(stopsFile, edgesFile))
+                return false;
+            publish(g);
+            return true;
+        });
+    }
+
+    uint64_t serial() const { return current.load()->serial; }
+
+    // Retired snapshots not yet freed
+    size_t pending()
+    {
+        lock_guard<mutex> lock(writer);
+        reclaim_locked();
+        return retired.size();
+    }
+
+    // Wait until every retired snapshot has been freed
+    void synchronize()
+    {
+        while (pending() > 0)
+            this_thread::yield();
+    }
+
+private:
+    uint64_t publish_locked(Graph &g)
+    {
+        GraphSnapshot *s = new GraphSnapshot();
+        s->g = move(g);
+        s->edges = count_edges(s->g);
+        s->serial = ++published;
+        const GraphSnapshot *old = current.exchange(s);
+        // Readers that announce the new epoch loaded their pointer after the exchange
+        retired.push_back(make_pair(old, epochs.epoch.fetch_add(1) + 1));
+        reclaim_locked();
+        return s->serial;
+    }
+
+    void reclaim_locked()
+    {
+        uint64_t lo = epochs.min_active();
+        size_t keep = 0;
+        for (size_t i = 0; i < retired.size(); ++i)
+        {
+            if (retired[i].second <= lo)
+            {
+                delete retired[i].first;
+                reclaimed++;
+            }
+            else
+                retired[keep++] = retired[i];
+        }
+        retired.resize(keep);
+    }
+};
+
+// Dijkstra's queue: a binary heap for floating-point weights; with integer weights, whose
+// popped keys never decrease, a radix heap (monotone bucket queue) instead
+template <class W, bool Integral = WeightTraits<W>::integral>
+struct DijkstraQueue
+{
+    typedef pair<W, StopID> Item;
+    priority_queue<Item, vector<Item>, greater<Item>> pq;
+    bool empty() const { return pq.empty(); }
+    void push(W key, StopID v) { pq.push(make_pair(key, v)); }
+    Item pop()
+    {
+        Item top = pq.top();
+        pq.pop();
+        return top;
+    }
+};
+
+template <class W>
+struct DijkstraQueue<W, true>
+{
+    typedef pair<W, StopID> Item;
+    vector<Item> buckets[33]; // bucket b > 0: highest bit where key and last differ is b - 1
+    vector<Item> spill;
+    W last; // most recently popped key; pushes must not go below it
+    size_t count;
+
+    DijkstraQueue() : last(0), count(0) {}
+
+    static int bucket_of(W key, W last) { return key == last ? 0 : 32 - __builtin_clz((uint32_t)(key ^ last)); }
+
+    bool empty() const { return count == 0; }
+
+    void push(W key, StopID v)
+    {
+        buckets[bucket_of(key, last)].push_back(make_pair(key, v));
+        count++;
+    }
+
+    Item pop()
+    {
+        if (buckets[0].empty())
+        {
+            int b = 1;
+            while (buckets[b].empty())
+                b++;
+            // The smallest key of the first non-empty bucket becomes last; everything in that
+            // bucket then falls into strictly lower buckets
+            spill.swap(buckets[b]);
+            last = spill[0].first;
+            for (size_t i = 1; i < spill.size(); ++i)
+                last = min(last, spill[i].first);
+            for (size_t i = 0; i < spill.size(); ++i)
+                buckets[bucket_of(spill[i].first, last)].push_back(spill[i]);
+            spill.clear();
+        }
+        Item top = buckets[0].back();
+        buckets[0].pop_back();
+        count--;
+        return top;
+    }
+};
+
+// Dijkstra
+template <class W>
+pair<vector<W>, vector<int>> dijkstra(const BasicGraph<W> &g, StopID src)
+{
+    typedef WeightTraits<W> T;
+    size_t n = g.size();
+    vector<W> dist(n, T::inf());
+    vector<int> prev(n, -1);
+    DijkstraQueue<W> pq;
+    if (src < 0 || src >= (StopID)n)
+        return make_pair(dist, prev);
+    uint64_t settled = 0, pushes = 1, stale = 0;
+    dist[src] = 0;
+    pq.push(0, src);
+    while (!pq.empty())
+    {
+        pair<W, StopID> top = pq.pop();
+        W d = top.first;
+        StopID u = top.second;
+        if (d > dist[u])
+        {
+            stale++;
+            continue;
+        }
+        settled++;
+        const vector<BasicEdge<W>> &nbrs = g.adj[u];
+        for (size_t i = 0; i < nbrs.size(); ++i)
+        {
+            StopID v = nbrs[i].to;
+            W nd = T::add(d, nbrs[i].weight);
+            if (dist[v] > nd)
             {
-                dist[v] = dist[u] + w;
+                dist[v] = nd;
                 prev[v] = (int)u;
-                pq.push(make_pair(dist[v], v));
+                pq.push(nd, v);
+                pushes++;
             }
         }
     }
+    METRIC_ADD(MC_DIJKSTRA_SETTLED, settled);
+    METRIC_ADD(MC_DIJKSTRA_PUSHES, pushes);
+    METRIC_ADD(MC_DIJKSTRA_STALE, stale);
     return make_pair(dist, prev);
 }
 
@@ -361,8 +1557,10 @@ struct AStarResult
     vector<StopID> path; // Sequence of stops in the path
     double cost;         // Total travel time estimate
 };
-// A* pathfinding algorithm using geographic heuristic (Euclidean distance)
-AStarResult astar(const Graph &g, StopID src, StopID dest, double avgSpeedKmPerHr = 40.0, double kmToMinFactor = 1.0)
+// A* pathfinding algorithm using geographic heuristic (Euclidean distance); scores are
+// kept in minutes whatever the graph's weight encoding
+template <class W>
+AStarResult astar(const BasicGraph<W> &g, StopID src, StopID dest, double avgSpeedKmPerHr = 40.0, double kmToMinFactor = 1.0)
 {
     size_t n = g.size();
     if (src < 0 || dest < 0 || src >= (StopID)n || dest >= (StopID)n)
@@ -379,6 +1577,7 @@ AStarResult astar(const Graph &g, StopID src, StopID dest, double avgSpeedKmPerH
     };
     typedef pair<double, StopID> P;
     priority_queue<P, vector<P>, greater<P>> openSet;
+    uint64_t settled = 0, pushes = 1, stale = 0;
     gscore[src] = 0;
     fscore[src] = heuristic(src, dest);
     openSet.push(make_pair(fscore[src], src));
@@ -388,16 +1587,25 @@ AStarResult astar(const Graph &g, StopID src, StopID dest, double avgSpeedKmPerH
         openSet.pop();
         double curf = top.first;
         StopID cur = top.second;
+        if (curf > fscore[cur])
+        {
+            stale++;
+            continue;
+        }
+        settled++;
         if (cur == dest)
         {
+            METRIC_ADD(MC_ASTAR_SETTLED, settled);
+            METRIC_ADD(MC_ASTAR_PUSHES, pushes);
+            METRIC_ADD(MC_ASTAR_STALE, stale);
             vector<StopID> path = reconstruct_path(cameFrom, dest);
             return AStarResult{true, path, gscore[dest]};
         }
-        vector<pair<StopID, double>> nbrs = g.neighbors(cur);
+        const vector<BasicEdge<W>> &nbrs = g.adj[cur];
         for (size_t i = 0; i < nbrs.size(); ++i)
         {
-            StopID v = nbrs[i].first;
-            double w = nbrs[i].second;
+            StopID v = nbrs[i].to;
+            double w = WeightTraits<W>::to_minutes(nbrs[i].weight);
             double tentative = gscore[cur] + w;
             if (tentative < gscore[v])
             {
@@ -405,12 +1613,254 @@ AStarResult astar(const Graph &g, StopID src, StopID dest, double avgSpeedKmPerH
                 gscore[v] = tentative;
                 fscore[v] = tentative + heuristic(v, dest);
                 openSet.push(make_pair(fscore[v], v));
+                pushes++;
             }
         }
     }
+    METRIC_ADD(MC_ASTAR_SETTLED, settled);
+    METRIC_ADD(MC_ASTAR_PUSHES, pushes);
+    METRIC_ADD(MC_ASTAR_STALE, stale);
     return AStarResult{false, vector<StopID>(), 0.0};
 }
-// Prim's MST
+
+// Reusable barrier for a fixed group of threads (C++11 has none)
+struct ThreadBarrier
+{
+    mutex mu;
+    condition_variable cv;
+    int count, waiting;
+    uint64_t generation;
+
+    explicit ThreadBarrier(int n) : count(n), waiting(0), generation(0) {}
+
+    void wait()
+    {
+        unique_lock<mutex> lock(mu);
+        uint64_t gen = generation;
+        if (++waiting == count)
+        {
+            waiting = 0;
+            generation++;
+            cv.notify_all();
+            return;
+        }
+        cv.wait(lock, [&]() { return gen != generation; });
+    }
+};
+
+// Parallel delta-stepping SSSP. Distances are grouped into buckets of width delta; a bucket
+// is settled in rounds over its light edges (w <= delta), then its heavy edges are relaxed
+// once. Each vertex belongs to one thread (v % threads): relaxations are sent as requests to
+// the owner's inbox, so dist/prev are only ever written by their owner and need no atomics.
+struct DeltaStepping
+{
+    size_t n;
+    double delta;
+    vector<int> start, lightEnd; // per stop: light edges in [start, lightEnd), heavy up to start[u + 1]
+    vector<int> to;
+    vector<double> w;
+
+    DeltaStepping() : n(0), delta(1.0) {}
+
+    // Mean weight times half the average degree: a few relaxation rounds per bucket on road-like networks
+    static double auto_delta(const Graph &g)
+    {
+        double sum = 0;
+        size_t m = 0;
+        for (size_t u = 0; u < g.size(); ++u)
+            for (size_t j = 0; j < g.adj[u].size(); ++j)
+            {
+                sum += g.adj[u][j].weight;
+                m++;
+            }
+        if (m == 0 || sum <= 0)
+            return 1.0;
+        return sum / m * max(1.0, m / (double)g.size() / 2.0);
+    }
+
+    void build(const Graph &g, double d = 0)
+    {
+        n = g.size();
+        delta = d > 0 ? d : auto_delta(g);
+        start.assign(n + 1, 0);
+        lightEnd.assign(n, 0);
+        to.clear();
+        w.clear();
+        for (size_t u = 0; u < n; ++u)
+        {
+            start[u] = (int)to.size();
+            for (int pass = 0; pass < 2; ++pass)
+            {
+                for (size_t j = 0; j < g.adj[u].size(); ++j)
+                {
+                    if ((g.adj[u][j].weight <= delta) == (pass == 0))
+                    {
+                        to.push_back(g.adj[u][j].to);
+                        w.push_back(g.adj[u][j].weight);
+                    }
+                }
+                if (pass == 0)
+                    lightEnd[u] = (int)to.size();
+            }
+        }
+        start[n] = (int)to.size();
+    }
+
+    // Time a few candidate deltas from one source and keep the fastest
+    double tune(const Graph &g, int threads, StopID probe = 0)
+    {
+        double base = auto_delta(g), best = base, bestSecs = 1e18;
+        const double factors[] = {0.25, 0.5, 1, 2, 4, 8};
+        for (size_t i = 0; i < sizeof(factors) / sizeof(factors[0]); ++i)
+        {
+            build(g, base * factors[i]);
+            chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+            run(probe, threads);
+            double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+            if (secs < bestSecs)
+            {
+                bestSecs = secs;
+                best = delta;
+            }
+        }
+        build(g, best);
+        return best;
+    }
+
+    struct Request
+    {
+        int v, from;
+        double d;
+    };
+
+    pair<vector<double>, vector<int>> run(StopID src, int threads) const
+    {
+        const double INF = 1e18;
+        vector<double> dist(n, INF);
+        vector<int> prev(n, -1);
+        if (src < 0 || src >= (StopID)n)
+            return make_pair(dist, prev);
+        int T = max(1, threads);
+        vector<vector<vector<Request>>> outbox(T, vector<vector<Request>>(T)); // [producer][owner]
+        vector<vector<vector<int>>> buckets(T);
+        vector<int> mark(n, -1);             // owner-private: last round that took v from a bucket
+        vector<size_t> localMin(T);
+        vector<char> more[2] = {vector<char>(T), vector<char>(T)};
+        ThreadBarrier barrier(T);
+        buckets[src % T].resize(1, vector<int>(1, src));
+        dist[src] = 0;
+
+        function<void(int)> worker = [&](int t) {
+            vector<vector<Request>> &out = outbox[t];
+            vector<vector<int>> &bk = buckets[t];
+            vector<int> frontier, removed;
+            size_t cur = 0;
+            int round = 0;
+            // Owner-side relaxation of every request addressed to t; returns whether bucket cur refilled
+            auto drain = [&]() {
+                bool refill = false;
+                for (int p = 0; p < T; ++p)
+                {
+                    const vector<Request> &in = outbox[p][t];
+                    for (size_t i = 0; i < in.size(); ++i)
+                    {
+                        const Request &r = in[i];
+                        if (r.d < dist[r.v])
+                        {
+                            dist[r.v] = r.d;
+                            prev[r.v] = r.from;
+                            size_t b = (size_t)(r.d / delta);
+                            if (b >= bk.size())
+                                bk.resize(b + 1);
+                            bk[b].push_back(r.v);
+                            refill = refill || b == cur;
+                        }
+                    }
+                }
+                return refill;
+            };
+            auto send = [&](int u, bool light) {
+                int b = light ? start[u] : lightEnd[u], e = light ? lightEnd[u] : start[u + 1];
+                for (int k = b; k < e; ++k)
+                {
+                    Request r = {to[k], u, dist[u] + w[k]};
+                    out[to[k] % T].push_back(r);
+                }
+            };
+            auto clear_out = [&]() {
+                for (int o = 0; o < T; ++o)
+                    out[o].clear();
+            };
+            while (true)
+            {
+                // Lowest non-empty bucket over all threads (every bucket below cur is empty)
+                size_t mine = cur;
+                while (mine < bk.size() && bk[mine].empty())
+                    mine++;
+                localMin[t] = mine < bk.size() ? mine : SIZE_MAX;
+                barrier.wait();
+                cur = *min_element(localMin.begin(), localMin.end());
+                barrier.wait(); // localMin is rewritten next iteration
+                if (cur == SIZE_MAX)
+                    break;
+                removed.clear();
+                while (true)
+                {
+                    round++;
+                    frontier.clear();
+                    if (cur < bk.size())
+                        frontier.swap(bk[cur]);
+                    for (size_t i = 0; i < frontier.size(); ++i)
+                    {
+                        int v = frontier[i];
+                        // Skip duplicates and entries left behind after v moved to a lower bucket
+                        if (mark[v] == round || (size_t)(dist[v] / delta) != cur)
+                            continue;
+                        mark[v] = round;
+                        removed.push_back(v);
+                        send(v, true);
+                    }
+                    barrier.wait();
+                    more[round & 1][t] = drain();
+                    barrier.wait();
+                    clear_out();
+                    bool any = false;
+                    for (int p = 0; p < T; ++p)
+                        any = any || more[round & 1][p];
+                    if (!any)
+                        break;
+                }
+                // Heavy edges leave the bucket for good, so one pass settles them
+                sort(removed.begin(), removed.end());
+                removed.erase(unique(removed.begin(), removed.end()), removed.end());
+                for (size_t i = 0; i < removed.size(); ++i)
+                    send(removed[i], false);
+                barrier.wait();
+                drain();
+                barrier.wait();
+                clear_out();
+                cur++;
+            }
+        };
+        vector<thread> pool;
+        for (int t = 1; t < T; ++t)
+            pool.push_back(thread(worker, t));
+        worker(0);
+        for (size_t i = 0; i < pool.size(); ++i)
+            pool[i].join();
+        return make_pair(dist, prev);
+    }
+};
+
+// One-shot convenience: automatic delta, hardware threads by default
+pair<vector<double>, vector<int>> delta_stepping(const Graph &g, StopID src, int threads = 0, double delta = 0)
+{
+    DeltaStepping ds;
+    ds.build(g, delta);
+    return ds.run(src, threads > 0 ? threads : hardware_threads());
+}
+
+// Prim's MST (single tree from stop 0; kept as the reference for --bench-mst)
 pair<double, vector<pair<StopID, StopID>>> prim_mst(const Graph &g)
 {
     size_t n = g.size();
@@ -467,661 +1917,7705 @@ pair<double, vector<pair<StopID, StopID>>> prim_mst(const Graph &g)
     return make_pair(total, edges);
 }
 
-// Bus entity with route and position tracking
-struct Bus
+// Union-find with path halving and union by size
+struct DisjointSet
 {
-    string busId;
-    vector<StopID> route; // Ordered sequence of stops
-    int currentIndex;     // Current position in route
-    double speed;         // Speed in km/h (informational)
-    bool active;          // Whether bus is currently running
-    Bus() : busId(""), currentIndex(0), speed(40.0), active(false) {}
-    Bus(const string &id, const vector<StopID> &r, double sp = 40.0) : busId(id), route(r), currentIndex(0), speed(sp), active(true) {}
-    StopID current_stop() const
+    vector<int> parent, sz;
+    DisjointSet(size_t n = 0) { reset(n); }
+    void reset(size_t n)
     {
-        if (route.empty())
-            return -1;
-        int idx = currentIndex;
-        if (idx < 0)
-            idx = 0;
-        if (idx >= (int)route.size())
-            idx = (int)route.size() - 1;
-        return route[idx];
+        parent.resize(n);
+        sz.assign(n, 1);
+        for (size_t i = 0; i < n; ++i)
+            parent[i] = (int)i;
     }
-    StopID next_stop() const
+    int find(int x)
     {
-        if (route.empty())
-            return -1;
-        if (currentIndex + 1 >= (int)route.size())
-            return route.back();
-        return route[currentIndex + 1];
+        while (parent[x] != x)
+        {
+            parent[x] = parent[parent[x]];
+            x = parent[x];
+        }
+        return x;
     }
-    bool move_next()
+    bool unite(int a, int b)
     {
-        if (!active)
-            return false;
-        if (route.empty())
+        a = find(a);
+        b = find(b);
+        if (a == b)
             return false;
-        if (currentIndex + 1 < (int)route.size())
-        {
-            currentIndex++;
-            return true;
-        }
-        else
-        {
-            active = false;
-            return false;
-        }
+        if (sz[a] < sz[b])
+            swap(a, b);
+        parent[b] = a;
+        sz[a] += sz[b];
+        return true;
     }
-    string info(const Graph &g) const
+};
+
+// Minimum spanning forest: one tree per connected component
+struct ForestEdge
+{
+    StopID u, v;
+    double weight;
+};
+struct SpanningForest
+{
+    double total;
+    vector<ForestEdge> edges;
+    vector<int> component;         // component index per stop
+    vector<double> componentTotal; // tree weight per component
+    vector<int> componentSize;     // stops per component
+};
+
+// Parallel Boruvka: every round each component picks its cheapest outgoing edge
+// (ties broken by edge index, so the picks never form a cycle) and the picks are merged.
+SpanningForest minimum_spanning_forest(const Graph &g, int threads = 0)
+{
+    size_t n = g.size();
+    if (threads <= 0)
+        threads = hardware_threads();
+    // Undirected edge list; edges loaded from file may be one-directional
+    vector<ForestEdge> all;
+    for (size_t u = 0; u < g.adj.size(); ++u)
     {
-        stringstream ss;
-        ss << "[" << busId << "] ";
-        ss << "At: ";
-        StopID cs = current_stop();
-        if (cs >= 0)
-            ss << g.get_name(cs);
-        else
-            ss << "N/A";
-        ss << " (idx " << currentIndex << "/" << (route.empty() ? 0 : route.size() - 1) << ")";
-        ss << (active ? " RUNNING" : " STOPPED");
-        return ss.str();
+        for (size_t j = 0; j < g.adj[u].size(); ++j)
+        {
+            const Edge &e = g.adj[u][j];
+            if (e.to == (StopID)u)
+                continue;
+            ForestEdge fe = {min((StopID)u, e.to), max((StopID)u, e.to), e.weight};
+            all.push_back(fe);
+        }
     }
-    string serialize() const
+    vector<int> live(all.size());
+    for (size_t i = 0; i < live.size(); ++i)
+        live[i] = (int)i;
+
+    SpanningForest res;
+    res.total = 0;
+    DisjointSet ds(n);
+    vector<int> comp(n);
+    vector<atomic<int>> best(n);
+    while (!live.empty())
     {
-        stringstream ss;
-        ss << busId << "|" << speed << "|" << currentIndex;
-        for (size_t i = 0; i < route.size(); ++i)
-            ss << "|" << route[i];
-        return ss.str();
+        parallel_for(n, threads, [&](size_t b, size_t e, int)
+        {
+            for (size_t v = b; v < e; ++v)
+            {
+                comp[v] = ds.parent[v]; // labels were flattened after the last merge
+                best[v].store(-1, memory_order_relaxed);
+            }
+        });
+        // Drop edges that became internal, then pick cheapest edge per component
+        vector<int> kept(live.size());
+        vector<size_t> keptCount(threads, 0);
+        size_t chunk = (live.size() + threads - 1) / threads;
+        parallel_for(live.size(), threads, [&](size_t b, size_t e, int tid)
+        {
+            size_t out = b;
+            for (size_t i = b; i < e; ++i)
+            {
+                int id = live[i];
+                int cu = comp[all[id].u], cv = comp[all[id].v];
+                if (cu == cv)
+                    continue;
+                kept[out++] = id;
+                int ends[2] = {cu, cv};
+                for (int k = 0; k < 2; ++k)
+                {
+                    atomic<int> &slot = best[ends[k]];
+                    int cur = slot.load(memory_order_relaxed);
+                    while (cur == -1 || all[id].weight < all[cur].weight || (all[id].weight == all[cur].weight && id < cur))
+                    {
+                        if (slot.compare_exchange_weak(cur, id))
+                            break;
+                    }
+                }
+            }
+            keptCount[tid] = out - b;
+        }, chunk);
+        size_t m = 0;
+        for (int t = 0; t < threads; ++t)
+        {
+            size_t b = (size_t)t * chunk;
+            for (size_t i = 0; i < keptCount[t]; ++i)
+                kept[m++] = kept[b + i];
+        }
+        kept.resize(m);
+        live.swap(kept);
+        if (live.empty())
+            break;
+        for (size_t c = 0; c < n; ++c)
+        {
+            int id = best[c].load(memory_order_relaxed);
+            if (id >= 0 && ds.unite(all[id].u, all[id].v))
+            {
+                res.edges.push_back(all[id]);
+                res.total += all[id].weight;
+            }
+        }
+        for (size_t v = 0; v < n; ++v)
+            ds.parent[v] = ds.find((int)v);
     }
-    static Bus deserialize(const string &line)
+
+    // Number components and attribute tree weights
+    res.component.assign(n, -1);
+    vector<int> rootToComp(n, -1);
+    for (size_t v = 0; v < n; ++v)
     {
-        vector<string> parts;
-        string cur;
-        stringstream ss(line);
-        while (getline(ss, cur, '|'))
-            parts.push_back(cur);
-        Bus bus;
-        if (parts.size() >= 3)
+        int r = ds.find((int)v);
+        if (rootToComp[r] == -1)
         {
-            bus.busId = parts[0];
-            bus.speed = atof(parts[1].c_str());
-            bus.currentIndex = atoi(parts[2].c_str());
-            for (size_t i = 3; i < parts.size(); ++i)
-                bus.route.push_back((StopID)atoi(parts[i].c_str()));
-            bus.active = true;
+            rootToComp[r] = (int)res.componentSize.size();
+            res.componentSize.push_back(0);
+            res.componentTotal.push_back(0.0);
         }
-        return bus;
+        res.component[v] = rootToComp[r];
+        res.componentSize[rootToComp[r]]++;
     }
-};
+    for (size_t i = 0; i < res.edges.size(); ++i)
+        res.componentTotal[res.component[res.edges[i].u]] += res.edges[i].weight;
+    return res;
+}
 
+// Connectivity index: weakly connected components (a union-find kept current as edges are
+// added), strongly connected components numbered in reverse topological order, and the
+// bridges / articulation points of the undirected network for the critical-links report.
+// reachable(s, t) answers "definitely not" in O(1): different components, or an SCC that
+// comes later in topological order (an edge A -> B between SCCs always has rank(A) > rank(B)).
+struct CriticalLink
+{
+    StopID u, v;
+    int cutOff; // stops on the smaller side once the link closes
+};
 
-// Bus system
-struct BusSystem
+struct Connectivity
 {
-    Graph g;
-    unordered_map<string, Bus> buses;
-    unordered_map<StopID, vector<string>> stopToBuses;
-    queue<string> history; // Event log of bus movements
-    size_t maxHistory;
-    Trie trie; // Prefix search for stop names
+    bool built;
+    uint64_t version; // graph version the index is current for
+    DisjointSet weak;
+    size_t components;
+    vector<int> scc;    // SCC id per stop
+    vector<int> rank;   // per SCC id: reverse topological position; ties only across former components
+    vector<StopID> ring; // next stop of the same weak component (circular lists)
+    int sccCount;
+    bool sccCurrent; // false once an edit may have merged SCCs; rebuilt on the next query
+    // Undirected view (computed on demand, keyed by version)
+    uint64_t cutVersion;
+    vector<CriticalLink> bridges;
+    vector<StopID> articulation;
+    size_t biconnected; // biconnected components with at least one edge
 
-    BusSystem() : maxHistory(1000) {}
+    Connectivity() : built(false), version(0), components(0), sccCount(0), sccCurrent(false), cutVersion((uint64_t)-1), biconnected(0) {}
 
-    void rebuild_stop_index()
+    bool stale(const Graph &g) const { return !built || version != g.version; }
+
+    void build(const Graph &g)
     {
-        stopToBuses.clear();
-        for (auto it = buses.begin(); it != buses.end(); ++it)
+        size_t n = g.size();
+        weak.reset(n);
+        components = n;
+        for (size_t u = 0; u < n; ++u)
+            for (size_t j = 0; j < g.adj[u].size(); ++j)
+                components -= weak.unite((int)u, g.adj[u][j].to);
+        ring.resize(n);
+        for (size_t u = 0; u < n; ++u)
+            ring[u] = (StopID)u;
+        for (size_t u = 0; u < n; ++u)
         {
-            const Bus &b = it->second;
-            if (b.route.empty())
-                continue;
-            StopID sid = b.current_stop();
-            if (sid >= 0)
-                stopToBuses[sid].push_back(it->first);
+            StopID r = weak.find((int)u);
+            if (r != (StopID)u)
+                swap(ring[u], ring[r]);
         }
+        build_scc(g);
+        built = true;
+        version = g.version;
     }
 
-    bool add_stop_with_location(const string &name, double x, double y)
+    // Iterative Tarjan; SCCs are numbered as they complete, so sinks come first
+    void build_scc(const Graph &g)
     {
-        StopID id = g.add_stop(name, x, y);
-        trie.insert(name);
-        return id >= 0;
+        size_t n = g.size();
+        vector<int> index(n, -1), low(n, 0);
+        vector<size_t> next(n, 0);
+        vector<char> onStack(n, 0);
+        vector<StopID> stack, call;
+        scc.assign(n, -1);
+        sccCount = 0;
+        int counter = 0;
+        for (size_t r = 0; r < n; ++r)
+        {
+            if (index[r] != -1)
+                continue;
+            call.push_back((StopID)r);
+            index[r] = low[r] = counter++;
+            stack.push_back((StopID)r);
+            onStack[r] = 1;
+            while (!call.empty())
+            {
+                StopID v = call.back();
+                if (next[v] < g.adj[v].size())
+                {
+                    StopID w = g.adj[v][next[v]++].to;
+                    if (index[w] == -1)
+                    {
+                        index[w] = low[w] = counter++;
+                        stack.push_back(w);
+                        onStack[w] = 1;
+                        call.push_back(w);
+                    }
+                    else if (onStack[w])
+                        low[v] = min(low[v], index[w]);
+                    continue;
+                }
+                call.pop_back();
+                if (!call.empty())
+                    low[call.back()] = min(low[call.back()], low[v]);
+                if (low[v] == index[v])
+                {
+                    StopID w;
+                    do
+                    {
+                        w = stack.back();
+                        stack.pop_back();
+                        onStack[w] = 0;
+                        scc[w] = sccCount;
+                    } while (w != v);
+                    sccCount++;
+                }
+            }
+        }
+        rank.resize(sccCount);
+        for (int c = 0; c < sccCount; ++c)
+            rank[c] = c;
+        sccCurrent = true;
     }
 
-    bool add_route_by_names(const string &a, const string &b, double minutes)
+    // The edge u -> v joins two weak components. No path linked them before, so shifting the
+    // smaller one's ranks to line up with u keeps both orders valid: v ranks just below u, and
+    // with a two-way edge their SCCs become one. O(stops in the smaller component).
+    void join(StopID u, StopID v, bool bidir)
     {
-        g.add_edge(a, b, minutes, true);
-        trie.insert(trim(a));
-        trie.insert(trim(b));
-        return true;
+        bool moveU = weak.sz[weak.find(u)] < weak.sz[weak.find(v)];
+        StopID moved = moveU ? u : v;
+        int from = scc[moved], to = scc[moveU ? v : u];
+        int delta = rank[to] - rank[from] + (bidir ? 0 : moveU ? 1 : -1);
+        vector<int> shifted;
+        StopID s = moved;
+        do
+        {
+            if (bidir && scc[s] == from)
+                scc[s] = to;
+            else
+                shifted.push_back(scc[s]);
+            s = ring[s];
+        } while (s != moved);
+        sort(shifted.begin(), shifted.end());
+        shifted.erase(unique(shifted.begin(), shifted.end()), shifted.end());
+        for (size_t i = 0; i < shifted.size(); ++i)
+            rank[shifted[i]] += delta;
+        if (bidir)
+            sccCount--;
+        swap(ring[u], ring[v]);
     }
 
-    bool add_bus(const string &busId, const vector<string> &routeNames, double speed = 40.0)
+    // Incremental upkeep after g gained stops and, when u >= 0, the edge u -> v (and v -> u
+    // when bidir). before is the graph version ahead of the change; if the index was not
+    // current then, it stays stale and the next query rebuilds it. Edges joining components
+    // are absorbed in place; inside one component, an edge the order cannot prove harmless
+    // (two-way between SCCs, or one-way not running down the order) costs an SCC rebuild on
+    // the next query.
+    bool update(const Graph &g, uint64_t before, StopID u, StopID v, bool bidir)
     {
-        vector<StopID> r;
-        for (size_t i = 0; i < routeNames.size(); ++i)
+        if (!built || version != before)
+            return false;
+        size_t n = g.size(), old = weak.parent.size();
+        if (n > old)
         {
-            const string &nm = routeNames[i];
-            StopID id = g.get_id(nm);
-            if (id == (StopID)-1)
+            weak.parent.resize(n);
+            weak.sz.resize(n, 1);
+            scc.resize(n);
+            ring.resize(n);
+            for (size_t i = old; i < n; ++i)
             {
-                id = g.add_stop(nm);
-                trie.insert(nm);
+                weak.parent[i] = (int)i;
+                ring[i] = (StopID)i;
+                scc[i] = (int)rank.size(); // no edges yet: any position in the order is valid
+                rank.push_back(0);
+                sccCount++;
             }
-            r.push_back(id);
+            components += n - old;
         }
-        Bus bus(busId, r, speed);
-        buses[busId] = bus;
-        rebuild_stop_index();
-        logger.log(string("Added bus: ") + busId + " with " + to_string(r.size()) + " stops");
+        if (u >= 0 && v >= 0 && u < (StopID)n && v < (StopID)n)
+        {
+            if (weak.find(u) != weak.find(v))
+                join(u, v, bidir);
+            else if (scc[u] != scc[v] && (bidir || rank[scc[u]] <= rank[scc[v]]))
+                sccCurrent = false;
+            components -= weak.unite(u, v);
+        }
+        version = g.version;
         return true;
     }
 
-    bool move_bus_one_step(const string &busId)
+    void ensure(const Graph &g)
     {
-        if (!buses.count(busId))
-            return false;
-        Bus &bus = buses[busId];
-        StopID prev = bus.current_stop();
-        bool moved = bus.move_next();
-        StopID curr = bus.current_stop();
-        string entry = string("[") + current_time_str() + "] " + busId + " : " + g.get_name(prev) + " -> " + g.get_name(curr);
-        push_history(entry);
-        logger.log(entry);
-        rebuild_stop_index();
-        return moved;
+        if (stale(g))
+            build(g);
+        else if (!sccCurrent)
+            build_scc(g);
     }
 
-    void move_all_buses_one_step()
+    bool connected(const Graph &g, StopID s, StopID t)
     {
-        for (auto it = buses.begin(); it != buses.end(); ++it)
-        {
-            Bus &bus = it->second;
-            StopID prev = bus.current_stop();
-            if (bus.active)
-            {
-                bool moved = bus.move_next();
-                StopID curr = bus.current_stop();
-                string entry = string("[") + current_time_str() + "] " + bus.busId + " : " + g.get_name(prev) + " -> " + g.get_name(curr);
-                push_history(entry);
-                logger.log(entry);
-            }
-        }
-        rebuild_stop_index();
+        ensure(g);
+        return weak.find(s) == weak.find(t);
     }
 
-    vector<string> buses_at_stop(const string &stopName)
+    // False means no path s -> t exists; true means one may (a search still has to find it)
+    bool reachable(const Graph &g, StopID s, StopID t)
     {
-        StopID id = g.get_id(stopName);
-        vector<string> out;
-        if (id == (StopID)-1)
-            return out;
-        if (stopToBuses.count(id))
-            out = stopToBuses[id];
-        return out;
+        ensure(g);
+        return weak.find(s) == weak.find(t) && rank[scc[s]] >= rank[scc[t]];
     }
 
-    // ETA between current bus location and some target stop: use Dijkstra from current stop
-    double estimate_eta_for_bus(const string &busId, const string &targetStopName)
+    size_t component_size(const Graph &g, StopID s)
     {
-        if (!buses.count(busId))
-            return -1.0;
-        StopID target = g.get_id(targetStopName);
-        if (target == (StopID)-1)
-            return -1.0;
-        StopID src = buses[busId].current_stop();
-        if (src == (StopID)-1)
-            return -1.0;
-        pair<vector<double>, vector<int>> res = dijkstra(g, src);
-        vector<double> dist = res.first;
-        if (dist[target] >= 1e17)
-            return -1.0;
-        return dist[target];
+        ensure(g);
+        return (size_t)weak.sz[weak.find(s)];
     }
 
-    // estimate ETA between any two stops (names)
-    double estimate_eta_between(const string &a, const string &b)
+    // Bridges, articulation points and biconnected components of the undirected network in
+    // O(V + E): one iterative DFS over a deduplicated CSR copy of the edges
+    void ensure_cuts(const Graph &g)
     {
-        StopID sa = g.get_id(a);
-        StopID sb = g.get_id(b);
-        if (sa == (StopID)-1 || sb == (StopID)-1)
-            return -1.0;
-        pair<vector<double>, vector<int>> res = dijkstra(g, sa);
-        vector<double> dist = res.first;
-        if (dist[sb] >= 1e17)
-            return -1.0;
-        return dist[sb];
+        if (cutVersion == g.version)
+            return;
+        size_t n = g.size();
+        vector<int> start(n + 1, 0);
+        for (size_t u = 0; u < n; ++u)
+            for (size_t j = 0; j < g.adj[u].size(); ++j)
+            {
+                start[u + 1]++;
+                start[g.adj[u][j].to + 1]++;
+            }
+        for (size_t i = 0; i < n; ++i)
+            start[i + 1] += start[i];
+        vector<StopID> nbr(start[n]);
+        vector<int> fill(start.begin(), start.end() - 1);
+        for (size_t u = 0; u < n; ++u)
+            for (size_t j = 0; j < g.adj[u].size(); ++j)
+            {
+                StopID v = g.adj[u][j].to;
+                nbr[fill[u]++] = v;
+                nbr[fill[v]++] = (StopID)u;
+            }
+        // Both directions of a road, and parallel roads, are one link
+        vector<int> end(n);
+        for (size_t u = 0; u < n; ++u)
+        {
+            vector<StopID>::iterator b = nbr.begin() + start[u], e = nbr.begin() + start[u + 1];
+            sort(b, e);
+            e = unique(b, e);
+            end[u] = (int)(e - nbr.begin());
+        }
+        vector<int> disc(n, -1), low(n), sub(n), next(start.begin(), start.end() - 1);
+        vector<StopID> parent(n, -1), call;
+        vector<char> cut(n, 0);
+        bridges.clear();
+        articulation.clear();
+        biconnected = 0;
+        int timer = 0;
+        for (size_t r = 0; r < n; ++r)
+        {
+            if (disc[r] != -1)
+                continue;
+            size_t firstBridge = bridges.size();
+            int rootChildren = 0;
+            disc[r] = low[r] = timer++;
+            sub[r] = 1;
+            call.push_back((StopID)r);
+            while (!call.empty())
+            {
+                StopID v = call.back();
+                if (next[v] < end[v])
+                {
+                    StopID w = nbr[next[v]++];
+                    if (w == v || w == parent[v])
+                        continue;
+                    if (disc[w] == -1)
+                    {
+                        parent[w] = v;
+                        disc[w] = low[w] = timer++;
+                        sub[w] = 1;
+                        call.push_back(w);
+                        rootChildren += v == (StopID)r;
+                    }
+                    else
+                        low[v] = min(low[v], disc[w]);
+                    continue;
+                }
+                call.pop_back();
+                StopID p = parent[v];
+                if (p < 0)
+                    continue;
+                low[p] = min(low[p], low[v]);
+                sub[p] += sub[v];
+                if (low[v] > disc[p])
+                    bridges.push_back(CriticalLink{p, v, sub[v]});
+                if (low[v] >= disc[p])
+                {
+                    biconnected++;
+                    if (p != (StopID)r)
+                        cut[p] = 1;
+                }
+            }
+            if (rootChildren > 1)
+                cut[r] = 1;
+            for (size_t i = firstBridge; i < bridges.size(); ++i)
+                bridges[i].cutOff = min(bridges[i].cutOff, sub[r] - bridges[i].cutOff);
+        }
+        for (size_t v = 0; v < n; ++v)
+            if (cut[v])
+                articulation.push_back((StopID)v);
+        sort(bridges.begin(), bridges.end(), [](const CriticalLink &a, const CriticalLink &b)
+             { return a.cutOff != b.cutOff ? a.cutOff > b.cutOff : (a.u != b.u ? a.u < b.u : a.v < b.v); });
+        cutVersion = g.version;
     }
+};
 
-    // find shortest path (Dijkstra) with names returned
-    pair<double, vector<string>> shortest_path_names(const string &a, const string &b)
+// Contraction hierarchy with PHAST one-to-all sweeps.
+// Stops are contracted by a lazy edge-difference order; shortcuts keep distances exact.
+// A one-to-all query is a small upward Dijkstra followed by one linear pass over
+// the stops in descending rank, which touches memory sequentially.
+struct ContractionHierarchy
+{
+    static const int BATCH = 8; // sources per multi-source sweep
+    bool built;
+    uint64_t version; // graph version the hierarchy was built from
+    size_t n;
+    vector<int> rank;        // contraction rank per stop
+    vector<StopID> sweepStop; // stop at sweep position (descending rank)
+    // Upward graph for the forward search (CSR by stop)
+    vector<int> upStart;
+    vector<StopID> upTo;
+    vector<double> upW;
+    // Downward edges into each sweep position (CSR by position, sources as positions)
+    vector<int> downStart;
+    vector<int> downFrom;
+    vector<double> downW;
+    size_t shortcuts;
+
+    ContractionHierarchy() : built(false), version(0), n(0), shortcuts(0) {}
+
+    bool stale(const Graph &g) const { return !built || version != g.version; }
+
+    // Bounded Dijkstra from u in the remaining graph, skipping stop 'skip'
+    struct WitnessSearch
     {
-        vector<string> emptyRes;
-        StopID sa = g.get_id(a);
-        StopID sb = g.get_id(b);
-        if (sa == (StopID)-1 || sb == (StopID)-1)
-            return make_pair(-1.0, emptyRes);
-        pair<vector<double>, vector<int>> res = dijkstra(g, sa);
-        vector<double> dist = res.first;
-        vector<int> prev = res.second;
-        if (dist[sb] > 1e17)
-            return make_pair(-1.0, emptyRes);
-        vector<StopID> path = reconstruct_path(prev, sb);
-        vector<string> names;
-        for (size_t i = 0; i < path.size(); ++i)
-            names.push_back(g.get_name(path[i]));
-        return make_pair(dist[sb], names);
-    }
+        typedef pair<double, int> P;
+        vector<double> dist;
+        vector<int> touched;
+        vector<P> heap; // reused between searches
+        void init(size_t n) { dist.assign(n, 1e18); }
+        void run(const vector<vector<pair<int, double>>> &out, const vector<char> &done, int u, int skip, double limit, int maxSettled)
+        {
+            for (size_t i = 0; i < touched.size(); ++i)
+                dist[touched[i]] = 1e18;
+            touched.clear();
+            heap.clear();
+            greater<P> cmp;
+            dist[u] = 0;
+            touched.push_back(u);
+            heap.push_back(P(0.0, u));
+            int settled = 0;
+            while (!heap.empty())
+            {
+                pop_heap(heap.begin(), heap.end(), cmp);
+                P top = heap.back();
+                heap.pop_back();
+                if (top.first > dist[top.second])
+                    continue;
+                if (top.first > limit || ++settled > maxSettled)
+                    break;
+                int x = top.second;
+                for (size_t i = 0; i < out[x].size(); ++i)
+                {
+                    int y = out[x][i].first;
+                    if (y == skip || done[y])
+                        continue;
+                    double nd = top.first + out[x][i].second;
+                    if (nd < dist[y])
+                    {
+                        if (dist[y] >= 1e18)
+                            touched.push_back(y);
+                        dist[y] = nd;
+                        heap.push_back(P(nd, y));
+                        push_heap(heap.begin(), heap.end(), cmp);
+                    }
+                }
+            }
+        }
+    };
 
-    // A* path (uses locations)
-    pair<double, vector<string>> astar_names(const string &a, const string &b)
+    static void add_arc(vector<pair<int, double>> &list, int to, double w)
     {
-        vector<string> emptyRes;
-        StopID sa = g.get_id(a), sb = g.get_id(b);
-        if (sa == (StopID)-1 || sb == (StopID)-1)
-            return make_pair(-1.0, emptyRes);
-        AStarResult res = astar(g, sa, sb);
-        if (!res.found)
-            return make_pair(-1.0, emptyRes);
-        vector<string> names;
-        for (size_t i = 0; i < res.path.size(); ++i)
-            names.push_back(g.get_name(res.path[i]));
-        return make_pair(res.cost, names);
+        for (size_t i = 0; i < list.size(); ++i)
+        {
+            if (list[i].first == to)
+            {
+                list[i].second = min(list[i].second, w);
+                return;
+            }
+        }
+        list.push_back(make_pair(to, w));
     }
 
-    // MST
-    pair<double, vector<pair<string, string>>> mst_names()
+    static void drop_arc(vector<pair<int, double>> &list, int to)
     {
-        pair<double, vector<pair<StopID, StopID>>> p = prim_mst(g);
-        double total = p.first;
-        vector<pair<StopID, StopID>> edges = p.second;
-        vector<pair<string, string>> out;
-        for (size_t i = 0; i < edges.size(); ++i)
+        for (size_t i = 0; i < list.size(); ++i)
         {
-            out.push_back(make_pair(g.get_name(edges[i].first), g.get_name(edges[i].second)));
+            if (list[i].first == to)
+            {
+                list[i] = list.back();
+                list.pop_back();
+                return;
+            }
         }
-        return make_pair(total, out);
     }
 
-    // persistence for buses
-    bool save_buses(const string &file)
+    // Shortcuts needed to contract v (apply=false only counts them)
+    int contract(vector<vector<pair<int, double>>> &out, vector<vector<pair<int, double>>> &in, const vector<char> &done,
+                 WitnessSearch &ws, int v, bool apply, int maxSettled)
     {
-        ofstream ofs(file.c_str());
-        if (!ofs)
-            return false;
-        for (auto it = buses.begin(); it != buses.end(); ++it)
+        int count = 0;
+        vector<pair<int, double>> inV = in[v], outV = out[v];
+        for (size_t i = 0; i < inV.size(); ++i)
         {
-            ofs << it->second.serialize() << "\n";
+            int u = inV[i].first;
+            double maxOut = 0;
+            for (size_t j = 0; j < outV.size(); ++j)
+                maxOut = max(maxOut, outV[j].second);
+            ws.run(out, done, u, v, inV[i].second + maxOut, maxSettled);
+            for (size_t j = 0; j < outV.size(); ++j)
+            {
+                int w = outV[j].first;
+                if (w == u)
+                    continue;
+                double via = inV[i].second + outV[j].second;
+                if (ws.dist[w] <= via)
+                    continue;
+                count++;
+                if (apply)
+                {
+                    add_arc(out[u], w, via);
+                    add_arc(in[w], u, via);
+                }
+            }
         }
-        ofs.close();
-        logger.log(string("Saved buses to ") + file);
-        return true;
+        return count;
     }
 
-    bool load_buses(const string &file)
+    void build(const Graph &g)
     {
-        ifstream ifs(file.c_str());
-        if (!ifs)
-            return false;
-        buses.clear();
-        string line;
-        while (getline(ifs, line))
+        n = g.size();
+        vector<vector<pair<int, double>>> out(n), in(n);
+        for (size_t u = 0; u < n; ++u)
         {
-            if (trim(line).empty())
+            for (size_t j = 0; j < g.adj[u].size(); ++j)
+            {
+                const Edge &e = g.adj[u][j];
+                if (e.to == (StopID)u)
+                    continue;
+                add_arc(out[u], e.to, e.weight);
+                add_arc(in[e.to], (int)u, e.weight);
+            }
+        }
+        vector<char> done(n, 0);
+        vector<int> deleted(n, 0);
+        WitnessSearch ws;
+        ws.init(n);
+        const int simSettled = 60, realSettled = 400;
+        typedef pair<int, int> P;
+        priority_queue<P, vector<P>, greater<P>> pq;
+        for (size_t v = 0; v < n; ++v)
+        {
+            int ed = contract(out, in, done, ws, (int)v, false, simSettled) - (int)(in[v].size() + out[v].size());
+            pq.push(P(2 * ed, (int)v));
+        }
+        vector<vector<pair<int, double>>> upOut(n), downIn(n);
+        rank.assign(n, -1);
+        shortcuts = 0;
+        int next = 0;
+        while (!pq.empty())
+        {
+            P top = pq.top();
+            pq.pop();
+            int v = top.second;
+            if (done[v])
                 continue;
-            Bus b = Bus::deserialize(line);
-            if (!b.busId.empty())
-                buses[b.busId] = b;
+            // Lazy update: re-evaluate and requeue if it is no longer the minimum
+            int pri = 2 * (contract(out, in, done, ws, v, false, simSettled) - (int)(in[v].size() + out[v].size())) + deleted[v];
+            if (!pq.empty() && pri > pq.top().first)
+            {
+                pq.push(P(pri, v));
+                continue;
+            }
+            shortcuts += contract(out, in, done, ws, v, true, realSettled);
+            rank[v] = next++;
+            done[v] = 1;
+            upOut[v] = out[v];
+            downIn[v] = in[v];
+            for (size_t i = 0; i < out[v].size(); ++i)
+            {
+                drop_arc(in[out[v][i].first], v);
+                deleted[out[v][i].first]++;
+            }
+            for (size_t i = 0; i < in[v].size(); ++i)
+            {
+                drop_arc(out[in[v][i].first], v);
+                deleted[in[v][i].first]++;
+            }
+            out[v].clear();
+            in[v].clear();
         }
-        ifs.close();
-        rebuild_stop_index();
-        logger.log(string("Loaded buses from ") + file);
-        return true;
+
+        upStart.assign(n + 1, 0);
+        upTo.clear();
+        upW.clear();
+        for (size_t v = 0; v < n; ++v)
+        {
+            for (size_t i = 0; i < upOut[v].size(); ++i)
+            {
+                upTo.push_back(upOut[v][i].first);
+                upW.push_back(upOut[v][i].second);
+            }
+            upStart[v + 1] = (int)upTo.size();
+        }
+        sweepStop.assign(n, 0);
+        for (size_t v = 0; v < n; ++v)
+            sweepStop[n - 1 - rank[v]] = (StopID)v;
+        downStart.assign(n + 1, 0);
+        downFrom.clear();
+        downW.clear();
+        for (size_t p = 0; p < n; ++p)
+        {
+            const vector<pair<int, double>> &lst = downIn[sweepStop[p]];
+            for (size_t i = 0; i < lst.size(); ++i)
+            {
+                downFrom.push_back((int)(n - 1 - rank[lst[i].first]));
+                downW.push_back(lst[i].second);
+            }
+            downStart[p + 1] = (int)downFrom.size();
+        }
+        version = g.version;
+        built = true;
     }
 
-    // basic history push (bounded)
-    void push_history(const string &s)
+    // Upward search from src writing into the interleaved sweep array at lane k
+    void upward(StopID src, vector<double> &d, int lanes, int k) const
     {
-        history.push(s);
-        if (history.size() > maxHistory)
-            history.pop();
+        typedef pair<double, StopID> P;
+        priority_queue<P, vector<P>, greater<P>> pq;
+        d[(size_t)(n - 1 - rank[src]) * lanes + k] = 0;
+        pq.push(P(0.0, src));
+        while (!pq.empty())
+        {
+            P top = pq.top();
+            pq.pop();
+            StopID u = top.second;
+            if (top.first > d[(size_t)(n - 1 - rank[u]) * lanes + k])
+                continue;
+            for (int i = upStart[u]; i < upStart[u + 1]; ++i)
+            {
+                double nd = top.first + upW[i];
+                double &dv = d[(size_t)(n - 1 - rank[upTo[i]]) * lanes + k];
+                if (nd < dv)
+                {
+                    dv = nd;
+                    pq.push(P(nd, upTo[i]));
+                }
+            }
+        }
     }
 
-    void print_history(size_t n = 20)
+    // One-to-all distances for up to BATCH sources at once; dist[k][stop]
+    void one_to_all_batch(const vector<StopID> &sources, vector<vector<double>> &dist) const
     {
-        vector<string> items;
-        queue<string> tmp = history;
-        while (!tmp.empty())
+        const int L = BATCH;
+        vector<double> d(n * L, 1e18);
+        for (size_t k = 0; k < sources.size() && k < (size_t)L; ++k)
+            if (sources[k] >= 0 && sources[k] < (StopID)n)
+                upward(sources[k], d, L, (int)k);
+        // Linear downward sweep; the lane loop is branch-free so it vectorises
+        for (size_t p = 0; p < n; ++p)
         {
-            items.push_back(tmp.front());
-            tmp.pop();
+            double *dp = &d[p * L];
+            for (int i = downStart[p]; i < downStart[p + 1]; ++i)
+            {
+                const double *du = &d[(size_t)downFrom[i] * L];
+                double w = downW[i];
+                for (int k = 0; k < L; ++k)
+                    dp[k] = min(dp[k], du[k] + w);
+            }
         }
-        cout << "---- Movement History (recent first) ----\n";
-        for (int i = (int)items.size() - 1, c = 0; i >= 0 && c < (int)n; --i, ++c)
+        dist.assign(min(sources.size(), (size_t)L), vector<double>());
+        for (size_t k = 0; k < dist.size(); ++k)
         {
-            cout << items[i] << "\n";
+            dist[k].assign(n, 1e18);
+            for (size_t p = 0; p < n; ++p)
+                dist[k][sweepStop[p]] = d[p * L + k];
         }
-        cout << "-----------------------------------------\n";
     }
 
-    string current_time_str() const
+    vector<double> one_to_all(StopID src) const
     {
-        time_t t = time(nullptr);
-        char buf[64];
-        strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime(&t));
-        return string(buf);
+        vector<vector<double>> dist;
+        one_to_all_batch(vector<StopID>(1, src), dist);
+        return dist.empty() ? vector<double>(n, 1e18) : dist[0];
     }
+};
 
-    // Suggest stops by prefix
-    vector<string> suggest_stops(const string &prefix)
+// Hub labels (pruned landmark labeling) for distance-only queries.
+// Every stop keeps a forward label (hub, minutes from the stop) and a backward label
+// (hub, minutes to the stop); d(s, t) is the best sum over hubs the two labels share.
+// Hubs are ranked by contraction order, so important stops cover most pairs and labels stay
+// short. Labels are sorted by hub rank in flat uint32/float arrays, each closed by an END
+// sentinel, so a query is one branch-light merge over two short contiguous runs.
+struct HubLabels
+{
+    static const uint32_t END = 0xffffffffu;
+    bool built;
+    uint64_t version;     // graph version the labels were built or loaded for
+    uint64_t fingerprint; // graph_fingerprint() of that graph
+    size_t n;
+    bool symmetric; // undirected network: one label per stop serves both directions
+    vector<StopID> hubStop; // stop per hub rank
+    vector<uint64_t> outStart, inStart;
+    vector<uint32_t> outHub, inHub;
+    vector<float> outDist, inDist;
+
+    HubLabels() : built(false), version(0), fingerprint(0), n(0), symmetric(true) {}
+
+    bool stale(const Graph &g) const { return !built || version != g.version; }
+
+    static uint64_t graph_fingerprint(const Graph &g)
     {
-        return trie.suggest(prefix);
+        uint64_t h = 1469598103934665603ULL; // FNV-1a over the edge lists
+        h = (h ^ g.size()) * 1099511628211ULL;
+        for (size_t u = 0; u < g.adj.size(); ++u)
+        {
+            for (size_t j = 0; j < g.adj[u].size(); ++j)
+            {
+                uint64_t bits;
+                double w = g.adj[u][j].weight;
+                memcpy(&bits, &w, sizeof(bits));
+                h = (h ^ ((uint64_t)u << 32 ^ (uint32_t)g.adj[u][j].to)) * 1099511628211ULL;
+                h = (h ^ bits) * 1099511628211ULL;
+            }
+        }
+        return h;
     }
 
-    // display system summary
-    void print_summary()
+    static bool is_symmetric(const Graph &g)
     {
-        cout << "===== Bus System Summary =====\n";
-        cout << "Stops : " << g.size() << "\n";
-        cout << "Buses : " << buses.size() << "\n";
-        cout << "Recent Logs (top 5):\n";
-        logger.print_recent(5);
-        cout << "==============================\n";
+        typedef pair<pair<StopID, StopID>, double> Arc;
+        vector<Arc> fwd, bwd;
+        for (size_t u = 0; u < g.adj.size(); ++u)
+        {
+            for (size_t j = 0; j < g.adj[u].size(); ++j)
+            {
+                fwd.push_back(Arc(make_pair((StopID)u, g.adj[u][j].to), g.adj[u][j].weight));
+                bwd.push_back(Arc(make_pair(g.adj[u][j].to, (StopID)u), g.adj[u][j].weight));
+            }
+        }
+        sort(fwd.begin(), fwd.end());
+        sort(bwd.begin(), bwd.end());
+        return fwd == bwd;
     }
-};//Demo dataset builder
-void build_sample_data(BusSystem &sys)
-{
-    sys.add_stop_with_location("A", 0, 0);
-    sys.add_stop_with_location("B", 2, 1);
-    sys.add_stop_with_location("C", 4, 0.5);
-    sys.add_stop_with_location("D", 3, -1.5);
-    sys.add_stop_with_location("E", 1, -2);
-    sys.add_stop_with_location("F", 5, -1);
-    sys.add_stop_with_location("G", 6, 1.5);
 
-    sys.add_route_by_names("A", "B", 6); // 6 minutes
-    sys.add_route_by_names("B", "C", 5);
-    sys.add_route_by_names("C", "F", 8);
-    sys.add_route_by_names("A", "E", 7);
-    sys.add_route_by_names("E", "D", 4);
-    sys.add_route_by_names("D", "C", 6);
-    sys.add_route_by_names("F", "G", 9);
-    sys.add_route_by_names("C", "G", 7);
+    typedef vector<vector<pair<uint32_t, double>>> LabelLists;
 
-    sys.add_bus("BUS101", vector<string>{"A", "B", "C", "F", "G"}, 40.0);
-    sys.add_bus("BUS202", vector<string>{"E", "D", "C", "B", "A"}, 35.0);
-    sys.add_bus("BUS303", vector<string>{"G", "C", "D", "E", "A"}, 45.0);
-}
-
-//CLI
-void show_menu()
-{
-    cout << "\n=== Bus Tracking System CLI ===\n";
-    cout << "1. Show summary\n";
-    cout << "2. List stops\n";
-    cout << "3. Add stop\n";
-    cout << "4. Add route (edge)\n";
-    cout << "5. List buses\n";
-    cout << "6. Add bus\n";
-    cout << "7. Move all buses one step (simulate)\n";
-    cout << "8. Move single bus one step\n";
-    cout << "9. ETA between stops (Dijkstra)\n";
-    cout << "10. ETA for bus -> stop\n";
-    cout << "11. Shortest path (Dijkstra) show route\n";
-    cout << "12. A* path (uses coordinates)\n";
-    cout << "13. MST (Prim) suggestion\n";
-    cout << "14. Suggest stops by prefix (Trie)\n";
-    cout << "15. Save graph & buses to files\n";
-    cout << "16. Load graph & buses from files\n";
-    cout << "17. Show movement history\n";
-    cout << "18. Show recent logger messages\n";
-    cout << "19. Exit\n";
-    cout << "Enter choice: " << endl;
-}
+    // Dijkstra from hub k over one direction of the graph. A stop is pruned when the labels built
+    // so far already give a path as short; otherwise hub k joins its label in dst.
+    void pruned_search(uint32_t k, const vector<uint64_t> &start, const vector<StopID> &to, const vector<double> &w,
+                       const LabelLists &src, LabelLists &dst, vector<double> &dist, vector<double> &tmp,
+                       vector<StopID> &touched) const
+    {
+        typedef pair<double, StopID> P;
+        StopID v = hubStop[k];
+        const vector<pair<uint32_t, double>> &lv = src[v];
+        for (size_t i = 0; i < lv.size(); ++i)
+            tmp[lv[i].first] = lv[i].second;
+        priority_queue<P, vector<P>, greater<P>> pq;
+        dist[v] = 0;
+        touched.push_back(v);
+        pq.push(P(0.0, v));
+        while (!pq.empty())
+        {
+            P top = pq.top();
+            pq.pop();
+            StopID u = top.second;
+            if (top.first > dist[u])
+                continue;
+            const vector<pair<uint32_t, double>> &lu = dst[u];
+            bool covered = false;
+            for (size_t i = 0; i < lu.size() && !covered; ++i)
+                covered = tmp[lu[i].first] + lu[i].second <= top.first;
+            if (covered)
+                continue;
+            dst[u].push_back(make_pair(k, top.first));
+            for (uint64_t e = start[u]; e < start[u + 1]; ++e)
+            {
+                double nd = top.first + w[e];
+                if (nd < dist[to[e]])
+                {
+                    if (dist[to[e]] >= 1e18)
+                        touched.push_back(to[e]);
+                    dist[to[e]] = nd;
+                    pq.push(P(nd, to[e]));
+                }
+            }
+        }
+        for (size_t i = 0; i < lv.size(); ++i)
+            tmp[lv[i].first] = 1e18;
+        for (size_t i = 0; i < touched.size(); ++i)
+            dist[touched[i]] = 1e18;
+        touched.clear();
+    }
 
-void cli_loop(BusSystem &sys)
-{
-    while (true)
+    static void flatten(const LabelLists &lists, vector<uint64_t> &start, vector<uint32_t> &hub, vector<float> &d)
     {
-        show_menu();
-        int ch;
-        if (!(cin >> ch))
+        size_t total = 0;
+        for (size_t v = 0; v < lists.size(); ++v)
+            total += lists[v].size() + 1;
+        start.assign(lists.size() + 1, 0);
+        hub.clear();
+        d.clear();
+        hub.reserve(total);
+        d.reserve(total);
+        for (size_t v = 0; v < lists.size(); ++v)
         {
-            cin.clear();
-            string dummy;
-            getline(cin, dummy);
-            cout << "Invalid input. Try again.\n";
-            continue;
+            for (size_t i = 0; i < lists[v].size(); ++i)
+            {
+                hub.push_back(lists[v][i].first);
+                d.push_back((float)lists[v][i].second);
+            }
+            hub.push_back(END);
+            d.push_back(numeric_limits<float>::infinity());
+            start[v + 1] = hub.size();
         }
-        if (ch == 1)
+    }
+
+    void build(const Graph &g)
+    {
+        n = g.size();
+        symmetric = is_symmetric(g);
+        ContractionHierarchy ch;
+        ch.build(g);
+        hubStop = ch.sweepStop; // most important first
+        // Forward and reverse CSR copies of the edges
+        vector<uint64_t> fs(n + 1, 0), bs(n + 1, 0);
+        for (size_t u = 0; u < n; ++u)
         {
-            sys.print_summary();
+            fs[u + 1] = fs[u] + g.adj[u].size();
+            for (size_t j = 0; j < g.adj[u].size(); ++j)
+                bs[g.adj[u][j].to + 1]++;
         }
-        else if (ch == 2)
+        for (size_t v = 0; v < n; ++v)
+            bs[v + 1] += bs[v];
+        vector<StopID> ft(fs[n]), bt(symmetric ? 0 : fs[n]);
+        vector<double> fw(fs[n]), bw(symmetric ? 0 : fs[n]);
+        vector<uint64_t> fill(bs.begin(), bs.end() - 1);
+        for (size_t u = 0; u < n; ++u)
         {
-            cout << "Stops: \n";
-            for (StopID i = 0; i < (StopID)sys.g.size(); ++i)
+            for (size_t j = 0; j < g.adj[u].size(); ++j)
             {
-                string s = sys.g.get_name(i);
-                Point loc = sys.g.get_loc(i);
-                cout << i << " : " << s << " (" << loc.x << "," << loc.y << ")\n";
+                const Edge &e = g.adj[u][j];
+                ft[fs[u] + j] = e.to;
+                fw[fs[u] + j] = e.weight;
+                if (!symmetric)
+                {
+                    uint64_t at = fill[e.to]++;
+                    bt[at] = (StopID)u;
+                    bw[at] = e.weight;
+                }
             }
         }
-        else if (ch == 3)
+        LabelLists lout(n), lin(symmetric ? 0 : n);
+        vector<double> dist(n, 1e18), tmp(n, 1e18);
+        vector<StopID> touched;
+        for (size_t k = 0; k < n; ++k)
         {
-            string name;
-            double x, y;
-            cout << "Enter stop name: ";
-            cin >> ws;
-            getline(cin, name);
-            cout << "Enter x y coords (double): ";
-            cin >> x >> y;
-            sys.add_stop_with_location(name, x, y);
-            cout << "Added.\n";
+            if (symmetric)
+            {
+                pruned_search((uint32_t)k, fs, ft, fw, lout, lout, dist, tmp, touched);
+                continue;
+            }
+            pruned_search((uint32_t)k, fs, ft, fw, lout, lin, dist, tmp, touched);
+            pruned_search((uint32_t)k, bs, bt, bw, lin, lout, dist, tmp, touched);
         }
-        else if (ch == 4)
+        flatten(lout, outStart, outHub, outDist);
+        flatten(lin, inStart, inHub, inDist);
+        fingerprint = graph_fingerprint(g);
+        version = g.version;
+        built = true;
+    }
+
+    // Minutes from s to t, 1e18 when t is unreachable
+    double distance(StopID s, StopID t) const
+    {
+        if (s < 0 || t < 0 || (size_t)s >= n || (size_t)t >= n)
+            return 1e18;
+        const uint32_t *a = &outHub[outStart[s]];
+        const float *da = &outDist[outStart[s]];
+        const uint32_t *b = symmetric ? &outHub[outStart[t]] : &inHub[inStart[t]];
+        const float *db = symmetric ? &outDist[outStart[t]] : &inDist[inStart[t]];
+        float best = numeric_limits<float>::infinity();
+        for (;;)
         {
-            string a, b;
-            double minutes;
-            cout << "Enter stopA name: ";
-            cin >> ws;
-            getline(cin, a);
-            cout << "Enter stopB name: ";
-            cin >> ws;
-            getline(cin, b);
-            cout << "Enter travel time in minutes (double): ";
-            cin >> minutes;
-            sys.add_route_by_names(a, b, minutes);
-            cout << "Edge added.\n";
+            uint32_t x = *a, y = *b;
+            if (x == y)
+            {
+                if (x == END)
+                    break;
+                best = min(best, *da + *db);
+            }
+            // Advance the smaller side (both on a match) without a data-dependent branch
+            a += x <= y;
+            da += x <= y;
+            b += y <= x;
+            db += y <= x;
         }
-        else if (ch == 5)
+        return best == numeric_limits<float>::infinity() ? 1e18 : (double)best;
+    }
+
+    // Label entries, not counting the sentinels
+    size_t entries() const { return outHub.size() - n + (symmetric ? 0 : inHub.size() - n); }
+
+    size_t memory_bytes() const
+    {
+        return (outStart.size() + inStart.size()) * sizeof(uint64_t) + (outHub.size() + inHub.size()) * sizeof(uint32_t) +
+               (outDist.size() + inDist.size()) * sizeof(float) + hubStop.size() * sizeof(StopID);
+    }
+
+    template <class T>
+    static void write_vec(FILE *fp, const vector<T> &v)
+    {
+        uint64_t len = v.size();
+        fwrite(&len, sizeof(len), 1, fp);
+        if (len)
+            fwrite(&v[0], sizeof(T), v.size(), fp);
+    }
+
+    template <class T>
+    static bool read_vec(FILE *fp, vector<T> &v)
+    {
+        uint64_t len = 0;
+        if (fread(&len, sizeof(len), 1, fp) != 1 || len > ((uint64_t)1 << 40) / sizeof(T))
+            return false;
+        v.resize(len);
+        return len == 0 || fread(&v[0], sizeof(T), len, fp) == len;
+    }
+
+    // Binary file: magic, format, stop count, symmetric flag, graph fingerprint, then the arrays
+    bool save(const string &file) const
+    {
+        FILE *fp = fopen(file.c_str(), "wb");
+        if (!fp)
+            return false;
+        const char magic[4] = {'S', 'C', 'R', 'H'};
+        uint32_t fmt = 1;
+        uint64_t cnt = n;
+        uint8_t sym = symmetric ? 1 : 0;
+        fwrite(magic, 1, 4, fp);
+        fwrite(&fmt, sizeof(fmt), 1, fp);
+        fwrite(&cnt, sizeof(cnt), 1, fp);
+        fwrite(&sym, sizeof(sym), 1, fp);
+        fwrite(&fingerprint, sizeof(fingerprint), 1, fp);
+        write_vec(fp, hubStop);
+        write_vec(fp, outStart);
+        write_vec(fp, outHub);
+        write_vec(fp, outDist);
+        write_vec(fp, inStart);
+        write_vec(fp, inHub);
+        write_vec(fp, inDist);
+        bool ok = !ferror(fp);
+        fclose(fp);
+        logger.log(string("Saved hub labels to ") + file);
+        return ok;
+    }
+
+    // Fails (leaving the labels unbuilt) if the file was built for a different network
+    bool load(const string &file, const Graph &g)
+    {
+        built = false;
+        FILE *fp = fopen(file.c_str(), "rb");
+        if (!fp)
+            return false;
+        char magic[4];
+        uint32_t fmt = 0;
+        uint64_t cnt = 0;
+        uint8_t sym = 0;
+        bool ok = fread(magic, 1, 4, fp) == 4 && memcmp(magic, "SCRH", 4) == 0 && fread(&fmt, sizeof(fmt), 1, fp) == 1 && fmt == 1 &&
+                  fread(&cnt, sizeof(cnt), 1, fp) == 1 && fread(&sym, sizeof(sym), 1, fp) == 1 &&
+                  fread(&fingerprint, sizeof(fingerprint), 1, fp) == 1 && cnt == g.size() && fingerprint == graph_fingerprint(g);
+        ok = ok && read_vec(fp, hubStop) && read_vec(fp, outStart) && read_vec(fp, outHub) && read_vec(fp, outDist) &&
+             read_vec(fp, inStart) && read_vec(fp, inHub) && read_vec(fp, inDist);
+        fclose(fp);
+        n = (size_t)cnt;
+        symmetric = sym != 0;
+        // Every label must end in the sentinel or a query could run off the arrays
+        ok = ok && outStart.size() == n + 1 && outStart[n] == outHub.size() && outHub.size() == outDist.size() &&
+             (symmetric || (inStart.size() == n + 1 && inStart[n] == inHub.size() && inHub.size() == inDist.size()));
+        for (size_t v = 0; ok && v < n; ++v)
+            ok = outStart[v + 1] > outStart[v] && outHub[outStart[v + 1] - 1] == END &&
+                 (symmetric || (inStart[v + 1] > inStart[v] && inHub[inStart[v + 1] - 1] == END));
+        if (!ok)
+            return false;
+        version = g.version;
+        built = true;
+        logger.log(string("Loaded hub labels from ") + file);
+        return true;
+    }
+};
+const uint32_t HubLabels::END;
+
+// All-pairs travel-time table for district-sized networks (up to ~20k stops), kept in a file
+// and memory-mapped. Rows come from PHAST sweeps over the contraction hierarchy, BATCH sources
+// per sweep and one band of TILE sources per thread. The n x n float matrix is stored as
+// TILE x TILE tiles, tile-major, so a band is written as one contiguous run and nearby
+// lookups share pages. Optional predecessor tiles (same layout, after each band's distances)
+// let paths be rebuilt hop by hop.
+struct DistanceTable
+{
+    static const uint32_t TILE = 64;
+    static const uint32_t NONE = 0xffffffffu;
+    static const size_t HEADER = 64; // keeps tiles cache-line aligned in the mapping
+    bool built;
+    uint64_t version;     // graph version the table was opened for
+    uint64_t fingerprint; // HubLabels::graph_fingerprint of the network it was built from
+    size_t n, tiles;      // stops, tiles per row
+    bool hasPred;
+    const char *base; // the mapped file
+    size_t mappedBytes;
+    vector<char> copy; // file contents where mmap is unavailable
+
+    DistanceTable() : built(false), version(0), fingerprint(0), n(0), tiles(0), hasPred(false), base(NULL), mappedBytes(0) {}
+    ~DistanceTable() { close(); }
+    DistanceTable(const DistanceTable &) = delete; // owns the mapping
+    DistanceTable &operator=(const DistanceTable &) = delete;
+
+    bool stale(const Graph &g) const { return !built || version != g.version; }
+
+    static size_t band_bytes(size_t tiles, bool pred)
+    {
+        return tiles * TILE * TILE * (sizeof(float) + (pred ? sizeof(uint32_t) : 0));
+    }
+
+    // Row band `band` (sources band*TILE ...) as tile-major distances, then predecessors
+    static void fill_band(const Graph &g, const ContractionHierarchy &ch, const vector<int> &inStart, const vector<StopID> &inFrom,
+                          const vector<double> &inW, size_t band, size_t tiles, bool pred, vector<float> &dist, vector<uint32_t> &prev)
+    {
+        size_t n = g.size(), first = band * TILE, last = min(n, first + TILE);
+        dist.assign(tiles * TILE * TILE, numeric_limits<float>::infinity());
+        if (pred)
+            prev.assign(tiles * TILE * TILE, NONE);
+        vector<vector<double>> rows;
+        for (size_t s0 = first; s0 < last; s0 += ContractionHierarchy::BATCH)
         {
-            cout << "Buses:\n";
-            for (auto it = sys.buses.begin(); it != sys.buses.end(); ++it)
+            vector<StopID> sources;
+            for (size_t s = s0; s < last && s < s0 + ContractionHierarchy::BATCH; ++s)
+                sources.push_back((StopID)s);
+            ch.one_to_all_batch(sources, rows);
+            for (size_t k = 0; k < rows.size(); ++k)
             {
-                cout << it->second.info(sys.g) << "\n";
+                const vector<double> &d = rows[k];
+                size_t r = (size_t)sources[k] - first;
+                for (size_t t = 0; t < n; ++t)
+                {
+                    size_t at = (t / TILE) * TILE * TILE + r * TILE + t % TILE;
+                    if (d[t] < 1e17)
+                        dist[at] = (float)d[t];
+                    if (!pred || d[t] >= 1e17 || (StopID)t == sources[k])
+                        continue;
+                    // Predecessor: the in-neighbour the shortest path arrives from
+                    double best = 1e18;
+                    for (int i = inStart[t]; i < inStart[t + 1]; ++i)
+                        if (d[inFrom[i]] + inW[i] < best)
+                        {
+                            best = d[inFrom[i]] + inW[i];
+                            prev[at] = (uint32_t)inFrom[i];
+                        }
+                }
             }
         }
-        else if (ch == 6)
+    }
+
+    // Build the table for g into file. ch must be current for g. bufferBytes reports the
+    // build's working memory (the table itself never sits in memory).
+    static bool write(const Graph &g, const ContractionHierarchy &ch, const string &file, bool pred, int threads, size_t *bufferBytes = NULL)
+    {
+        size_t n = g.size(), tiles = (n + TILE - 1) / TILE;
+        threads = max(1, min(threads, (int)max((size_t)1, tiles)));
+        vector<int> inStart(n + 1, 0);
+        vector<StopID> inFrom;
+        vector<double> inW;
+        if (pred)
         {
-            string idline;
-            cout << "Enter bus id: ";
-            cin >> ws;
-            getline(cin, idline);
-            string routeStr;
-            cout << "Enter comma-separated stops (names): ";
-            cin >> ws;
-            getline(cin, routeStr);
-            double sp;
-            cout << "Enter speed (km/h) [not used if edges are minutes, but recorded]: ";
-            cin >> sp;
-            vector<string> parts;
-            string cur;
-            stringstream ss(routeStr);
-            while (getline(ss, cur, ','))
-                parts.push_back(trim(cur));
-            sys.add_bus(idline, parts, sp);
-            cout << "Bus added.\n";
+            for (size_t u = 0; u < n; ++u)
+                for (size_t j = 0; j < g.adj[u].size(); ++j)
+                    inStart[g.adj[u][j].to + 1]++;
+            for (size_t v = 0; v < n; ++v)
+                inStart[v + 1] += inStart[v];
+            inFrom.resize(inStart[n]);
+            inW.resize(inStart[n]);
+            vector<int> fill(inStart.begin(), inStart.end() - 1);
+            for (size_t u = 0; u < n; ++u)
+                for (size_t j = 0; j < g.adj[u].size(); ++j)
+                {
+                    int at = fill[g.adj[u][j].to]++;
+                    inFrom[at] = (StopID)u;
+                    inW[at] = g.adj[u][j].weight;
+                }
         }
-        else if (ch == 7)
+        FILE *fp = fopen(file.c_str(), "wb");
+        if (!fp)
+            return false;
+        char header[HEADER];
+        memset(header, 0, sizeof(header));
+        uint32_t fmt = 1, tile = TILE, withPred = pred ? 1 : 0;
+        uint64_t cnt = n, fp64 = HubLabels::graph_fingerprint(g);
+        memcpy(header, "SCRA", 4);
+        memcpy(header + 4, &fmt, 4);
+        memcpy(header + 8, &cnt, 8);
+        memcpy(header + 16, &tile, 4);
+        memcpy(header + 20, &withPred, 4);
+        memcpy(header + 24, &fp64, 8);
+        fwrite(header, 1, HEADER, fp);
+        // Bands go out in order: each round fills one band per thread, then writes them
+        vector<vector<float>> dist(threads);
+        vector<vector<uint32_t>> prev(threads);
+        for (size_t first = 0; first < tiles; first += threads)
         {
-            cout << "Moving all buses one step...\n";
-            sys.move_all_buses_one_step();
-            cout << "Done.\n";
+            size_t count = min((size_t)threads, tiles - first);
+            parallel_for(count, threads, [&](size_t begin, size_t end, int)
+                         {
+                             for (size_t b = begin; b < end; ++b)
+                                 fill_band(g, ch, inStart, inFrom, inW, first + b, tiles, pred, dist[b], prev[b]);
+                         },
+                         1);
+            for (size_t b = 0; b < count; ++b)
+            {
+                fwrite(&dist[b][0], sizeof(float), dist[b].size(), fp);
+                if (pred)
+                    fwrite(&prev[b][0], sizeof(uint32_t), prev[b].size(), fp);
+            }
         }
-        else if (ch == 8)
+        if (bufferBytes)
+            *bufferBytes = threads * band_bytes(tiles, pred) + inFrom.size() * (sizeof(StopID) + sizeof(double));
+        bool ok = !ferror(fp);
+        fclose(fp);
+        logger.log(string("Wrote distance table ") + file + " (" + to_string(n) + " stops)");
+        return ok;
+    }
+
+    // Map file; fails (leaving the table closed) if it was built for a different network
+    bool open(const string &file, const Graph &g)
+    {
+        close();
+        FILE *fp = fopen(file.c_str(), "rb");
+        if (!fp)
+            return false;
+        char header[HEADER];
+        bool ok = fread(header, 1, HEADER, fp) == HEADER && memcmp(header, "SCRA", 4) == 0;
+        uint32_t fmt = 0, tile = 0, withPred = 0;
+        uint64_t cnt = 0;
+        memcpy(&fmt, header + 4, 4);
+        memcpy(&cnt, header + 8, 8);
+        memcpy(&tile, header + 16, 4);
+        memcpy(&withPred, header + 20, 4);
+        memcpy(&fingerprint, header + 24, 8);
+        ok = ok && fmt == 1 && tile == TILE && cnt == g.size() && fingerprint == HubLabels::graph_fingerprint(g);
+        n = (size_t)cnt;
+        tiles = (n + TILE - 1) / TILE;
+        hasPred = withPred != 0;
+        size_t bytes = HEADER + tiles * band_bytes(tiles, hasPred);
+        ok = ok && fseek(fp, 0, SEEK_END) == 0;
+#ifndef _WIN32
+        ok = ok && (size_t)ftello(fp) == bytes;
+        if (ok)
         {
-            string bid;
-            cout << "Enter bus id: ";
-            cin >> ws;
-            getline(cin, bid);
-            bool ok = sys.move_bus_one_step(bid);
-            cout << (ok ? "Bus moved." : "Bus did not move (maybe at end or id wrong).") << "\n";
+            void *p = mmap(NULL, bytes, PROT_READ, MAP_SHARED, fileno(fp), 0);
+            ok = p != MAP_FAILED;
+            if (ok)
+            {
+                base = (const char *)p;
+                mappedBytes = bytes;
+            }
         }
-        else if (ch == 9)
+#else
+        ok = ok && (size_t)_ftelli64(fp) == bytes;
+        if (ok)
         {
-            string a, b;
-            cout << "Enter source stop: ";
-            cin >> ws;
-            getline(cin, a);
-            cout << "Enter destination stop: ";
-            cin >> ws;
-            getline(cin, b);
-            double eta = sys.estimate_eta_between(a, b);
-            if (eta < 0)
-                cout << "No path or stops not present.\n";
-            else
-                cout << "ETA (minutes): " << eta << "\n";
+            copy.resize(bytes);
+            rewind(fp);
+            ok = fread(&copy[0], 1, bytes, fp) == bytes;
+            base = ok ? &copy[0] : NULL;
         }
-        else if (ch == 10)
+#endif
+        fclose(fp);
+        if (!ok)
         {
-            string bid, target;
-            cout << "Enter bus id: ";
-            cin >> ws;
-            getline(cin, bid);
-            cout << "Enter target stop name: ";
-            cin >> ws;
-            getline(cin, target);
-            double eta = sys.estimate_eta_for_bus(bid, target);
-            if (eta < 0)
-                cout << "Could not compute ETA.\n";
-            else
-                cout << "ETA from current position (minutes): " << eta << "\n";
+            close();
+            return false;
         }
-        else if (ch == 11)
+        version = g.version;
+        built = true;
+        logger.log(string("Opened distance table ") + file);
+        return true;
+    }
+
+    void close()
+    {
+#ifndef _WIN32
+        if (mappedBytes)
+            munmap((void *)base, mappedBytes);
+#endif
+        base = NULL;
+        mappedBytes = 0;
+        vector<char>().swap(copy);
+        built = false;
+    }
+
+    size_t offset(StopID s, StopID t) const
+    {
+        return HEADER + (size_t)(s / TILE) * band_bytes(tiles, hasPred) +
+               ((size_t)(t / TILE) * TILE * TILE + (size_t)(s % TILE) * TILE + t % TILE) * sizeof(float);
+    }
+
+    // Minutes from s to t, 1e18 when t is unreachable
+    double distance(StopID s, StopID t) const
+    {
+        if (s < 0 || t < 0 || (size_t)s >= n || (size_t)t >= n)
+            return 1e18;
+        float d;
+        memcpy(&d, base + offset(s, t), sizeof(d));
+        return d == numeric_limits<float>::infinity() ? 1e18 : (double)d;
+    }
+
+    // Stops from s to t, empty when unreachable or the table has no predecessor tiles
+    vector<StopID> path(StopID s, StopID t) const
+    {
+        vector<StopID> out;
+        if (!hasPred || distance(s, t) >= 1e17)
+            return out;
+        size_t predAt = tiles * TILE * TILE * sizeof(float);
+        out.push_back(t);
+        while (t != s && out.size() <= n)
         {
-            string a, b;
-            cout << "Enter source stop: ";
-            cin >> ws;
-            getline(cin, a);
-            cout << "Enter destination stop: ";
-            cin >> ws;
-            getline(cin, b);
-            pair<double, vector<string>> res = sys.shortest_path_names(a, b);
-            double cost = res.first;
-            vector<string> path = res.second;
-            if (cost < 0)
-                cout << "No path.\n";
-            else
+            uint32_t p;
+            memcpy(&p, base + offset(s, t) + predAt, sizeof(p));
+            if (p == NONE)
+                return vector<StopID>();
+            t = (StopID)p;
+            out.push_back(t);
+        }
+        if (t != s)
+            return vector<StopID>();
+        reverse(out.begin(), out.end());
+        return out;
+    }
+
+    size_t file_bytes() const { return built ? HEADER + tiles * band_bytes(tiles, hasPred) : 0; }
+};
+const uint32_t DistanceTable::TILE;
+const uint32_t DistanceTable::NONE;
+const size_t DistanceTable::HEADER;
+
+// Stops reachable within a travel-time budget, plus edges the budget runs out on
+struct Isochrone
+{
+    StopID origin;
+    double budget;
+    vector<pair<StopID, double>> reachable;  // (stop, minutes), nearest first
+    vector<pair<StopID, StopID>> boundary;   // reachable u -> unreachable v
+};
+
+Isochrone make_isochrone(const Graph &g, StopID origin, double budget, const vector<double> &dist, bool withBoundary)
+{
+    Isochrone iso;
+    iso.origin = origin;
+    iso.budget = budget;
+    for (size_t v = 0; v < dist.size(); ++v)
+        if (dist[v] <= budget)
+            iso.reachable.push_back(make_pair((StopID)v, dist[v]));
+    sort(iso.reachable.begin(), iso.reachable.end(), [](const pair<StopID, double> &a, const pair<StopID, double> &b)
+    {
+        return a.second < b.second || (a.second == b.second && a.first < b.first);
+    });
+    if (withBoundary)
+    {
+        for (size_t i = 0; i < iso.reachable.size(); ++i)
+        {
+            StopID u = iso.reachable[i].first;
+            for (size_t j = 0; j < g.adj[u].size(); ++j)
+                if (dist[g.adj[u][j].to] > budget)
+                    iso.boundary.push_back(make_pair(u, g.adj[u][j].to));
+        }
+    }
+    return iso;
+}
+
+// Compressed (CSR) copy of the graph with a reverse index, shared by the fast search engines
+struct CompactGraph
+{
+    bool built;
+    uint64_t version;
+    size_t n;
+    vector<int> start;     // out-edges of u: [start[u], start[u+1])
+    vector<StopID> from, to;
+    vector<double> w;
+    vector<int> rstart;    // in-edges of v: [rstart[v], rstart[v+1])
+    vector<StopID> rfrom;
+    vector<int> redge;     // forward edge id of each in-edge
+    vector<int> twin;      // edge id of v->u for edge u->v, or -1
+
+    CompactGraph() : built(false), version(0), n(0) {}
+
+    bool stale(const Graph &g) const { return !built || version != g.version; }
+
+    void build(const Graph &g)
+    {
+        n = g.size();
+        start.assign(n + 1, 0);
+        for (size_t u = 0; u < n; ++u)
+            start[u + 1] = start[u] + (int)g.adj[u].size();
+        size_t m = start[n];
+        from.resize(m);
+        to.resize(m);
+        w.resize(m);
+        vector<int> indeg(n + 1, 0);
+        for (size_t u = 0; u < n; ++u)
+        {
+            for (size_t j = 0; j < g.adj[u].size(); ++j)
             {
-                cout << "Cost (minutes): " << cost << "\nPath: ";
-                for (size_t i = 0; i < path.size(); ++i)
-                {
-                    cout << path[i] << (i + 1 < path.size() ? " -> " : "\n");
-                }
+                from[start[u] + j] = (StopID)u;
+                to[start[u] + j] = g.adj[u][j].to;
+                w[start[u] + j] = g.adj[u][j].weight;
+                indeg[g.adj[u][j].to + 1]++;
             }
         }
-        else if (ch == 12)
+        rstart.assign(n + 1, 0);
+        for (size_t v = 0; v < n; ++v)
+            rstart[v + 1] = rstart[v] + indeg[v + 1];
+        rfrom.resize(m);
+        redge.resize(m);
+        vector<int> fill(rstart.begin(), rstart.end() - 1);
+        for (size_t u = 0; u < n; ++u)
         {
-            string a, b;
-            cout << "Enter source stop: ";
-            cin >> ws;
-            getline(cin, a);
-            cout << "Enter destination stop: ";
-            cin >> ws;
-            getline(cin, b);
-            pair<double, vector<string>> res = sys.astar_names(a, b);
-            double cost = res.first;
-            vector<string> path = res.second;
-            if (cost < 0)
-                cout << "A* failed to find path.\n";
-            else
+            for (int e = start[u]; e < start[u + 1]; ++e)
             {
-                cout << "A* cost (minutes approximated): " << cost << "\nPath: ";
-                for (size_t i = 0; i < path.size(); ++i)
+                int slot = fill[to[e]]++;
+                rfrom[slot] = (StopID)u;
+                redge[slot] = e;
+            }
+        }
+        twin.assign(m, -1);
+        for (size_t u = 0; u < n; ++u)
+        {
+            for (int e = start[u]; e < start[u + 1]; ++e)
+            {
+                // v->u is an in-edge of u coming from v
+                for (int r = rstart[u]; r < rstart[u + 1]; ++r)
                 {
-                    cout << path[i] << (i + 1 < path.size() ? " -> " : "\n");
+                    if (rfrom[r] == to[e])
+                    {
+                        twin[e] = redge[r];
+                        break;
+                    }
                 }
             }
         }
-        else if (ch == 13)
+        version = g.version;
+        built = true;
+    }
+
+    size_t edges() const { return to.size(); }
+};
+
+// Reusable per-thread search state; arrays are reset lazily with a visit stamp
+struct SearchWorkspace
+{
+    typedef pair<double, StopID> P;
+    vector<double> dist[2];
+    vector<int> prevEdge[2]; // edge id used to reach the stop (forward ids in both directions)
+    vector<unsigned> seen[2];
+    unsigned stamp;
+    vector<P> heap[2];
+    vector<double> penalty; // per edge weight multiplier, 1.0 when untouched
+    vector<int> penalized;  // edges whose multiplier must be reset
+
+    SearchWorkspace() : stamp(0) {}
+
+    void reset_penalties(size_t m)
+    {
+        if (penalty.size() != m)
+            penalty.assign(m, 1.0);
+        for (size_t i = 0; i < penalized.size(); ++i)
+            penalty[penalized[i]] = 1.0;
+        penalized.clear();
+    }
+
+    void scale_penalty(int e, double f)
+    {
+        if (penalty[e] == 1.0)
+            penalized.push_back(e);
+        penalty[e] *= f;
+    }
+
+    void prepare(size_t n)
+    {
+        for (int s = 0; s < 2; ++s)
         {
-            pair<double, vector<pair<string, string>>> res = sys.mst_names();
-            double total = res.first;
-            vector<pair<string, string>> edges = res.second;
-            cout << "MST total weight (minutes): " << total << "\nEdges:\n";
-            for (size_t i = 0; i < edges.size(); ++i)
-                cout << edges[i].first << " - " << edges[i].second << "\n";
-            cout << "Use this to plan minimal-cost physical cable/road layout (demo purpose).\n";
+            if (seen[s].size() != n)
+            {
+                dist[s].assign(n, 1e18);
+                prevEdge[s].assign(n, -1);
+                seen[s].assign(n, 0);
+            }
+            heap[s].clear();
         }
-        else if (ch == 14)
+        if (++stamp == 0)
         {
-            string pref;
-            cout << "Enter prefix: ";
-            cin >> ws;
-            getline(cin, pref);
-            vector<string> sug = sys.suggest_stops(pref);
-            cout << "Suggestions:\n";
-            for (size_t i = 0; i < sug.size(); ++i)
-                cout << "  " << sug[i] << "\n";
+            for (int s = 0; s < 2; ++s)
+                fill(seen[s].begin(), seen[s].end(), 0);
+            stamp = 1;
         }
-        else if (ch == 15)
+    }
+
+    double get(int side, StopID v) const { return seen[side][v] == stamp ? dist[side][v] : 1e18; }
+
+    void set(int side, StopID v, double d, int e)
+    {
+        seen[side][v] = stamp;
+        dist[side][v] = d;
+        prevEdge[side][v] = e;
+    }
+};
+
+// Bidirectional Dijkstra on a CompactGraph. penalty (per edge id, may be empty) scales weights;
+// edges with a negative penalty are closed. Returns edge ids of the path, empty if unreachable.
+vector<int> bidirectional_search(const CompactGraph &cg, SearchWorkspace &ws, StopID s, StopID t, const vector<double> &penalty, double &costOut)
+{
+    vector<int> path;
+    costOut = -1.0;
+    if (s < 0 || t < 0 || s >= (StopID)cg.n || t >= (StopID)cg.n)
+        return path;
+    ws.prepare(cg.n);
+    if (s == t)
+    {
+        costOut = 0;
+        return path;
+    }
+    greater<SearchWorkspace::P> cmp;
+    ws.set(0, s, 0, -1);
+    ws.set(1, t, 0, -1);
+    ws.heap[0].push_back(SearchWorkspace::P(0, s));
+    ws.heap[1].push_back(SearchWorkspace::P(0, t));
+    double best = 1e18;
+    StopID meet = -1;
+    while (!ws.heap[0].empty() && !ws.heap[1].empty())
+    {
+        if (ws.heap[0].front().first + ws.heap[1].front().first >= best)
+            break;
+        int side = ws.heap[0].size() <= ws.heap[1].size() ? 0 : 1;
+        vector<SearchWorkspace::P> &h = ws.heap[side];
+        pop_heap(h.begin(), h.end(), cmp);
+        SearchWorkspace::P top = h.back();
+        h.pop_back();
+        StopID u = top.second;
+        if (top.first > ws.get(side, u))
+            continue;
+        int b = side == 0 ? cg.start[u] : cg.rstart[u];
+        int e_ = side == 0 ? cg.start[u + 1] : cg.rstart[u + 1];
+        for (int i = b; i < e_; ++i)
         {
-            string sf = "data/stops.txt", ef = "data/edges.txt", bf = "data/buses.txt";
-            bool ok1 = sys.g.save_to(sf, ef);
-            bool ok2 = sys.save_buses(bf);
-            cout << "Saved graph: " << ok1 << " , buses: " << ok2 << "\n";
+            int e = side == 0 ? i : cg.redge[i];
+            StopID v = side == 0 ? cg.to[i] : cg.rfrom[i];
+            double f = penalty.empty() ? 1.0 : penalty[e];
+            if (f < 0)
+                continue;
+            double nd = top.first + cg.w[e] * f;
+            if (nd < ws.get(side, v))
+            {
+                ws.set(side, v, nd, e);
+                h.push_back(SearchWorkspace::P(nd, v));
+                push_heap(h.begin(), h.end(), cmp);
+                double other = ws.get(1 - side, v);
+                if (nd + other < best)
+                {
+                    best = nd + other;
+                    meet = v;
+                }
+            }
         }
-        else if (ch == 16)
+    }
+    if (meet < 0)
+        return path;
+    // Walk back to s on the forward tree, then forward to t on the backward tree
+    StopID v = meet;
+    while (v != s)
+    {
+        int e = ws.prevEdge[0][v];
+        path.push_back(e);
+        v = cg.from[e];
+    }
+    reverse(path.begin(), path.end());
+    v = meet;
+    while (v != t)
+    {
+        int e = ws.prevEdge[1][v];
+        path.push_back(e);
+        v = cg.to[e];
+    }
+    costOut = 0;
+    for (size_t i = 0; i < path.size(); ++i)
+        costOut += cg.w[path[i]];
+    return path;
+}
+
+// One route returned by the alternatives engine
+struct AlternativeRoute
+{
+    double cost;
+    vector<StopID> path;
+    double overlap; // largest fraction of this route's cost shared with an earlier route
+};
+
+// Canonical id so both directions of a two-way road compare equal
+int undirected_edge_id(const CompactGraph &cg, int e)
+{
+    return cg.twin[e] >= 0 ? min(e, cg.twin[e]) : e;
+}
+
+// K alternative routes with the penalty method: after each search the edges just used get
+// more expensive, steering the next search elsewhere. A candidate is kept when its true cost
+// is within maxStretch of the optimum and it shares at most maxOverlap of its cost with
+// every route already kept.
+vector<AlternativeRoute> k_alternative_routes(const CompactGraph &cg, SearchWorkspace &ws, StopID s, StopID t, int k,
+                                              double maxOverlap = 0.6, double maxStretch = 1.4, double penaltyFactor = 1.5)
+{
+    vector<AlternativeRoute> out;
+    if (k <= 0)
+        return out;
+    ws.reset_penalties(cg.edges());
+    vector<vector<int>> keptEdges; // sorted canonical edge ids per kept route
+    double optimum = -1;
+    int rounds = 4 * k + 2;
+    for (int r = 0; r < rounds && (int)out.size() < k; ++r)
+    {
+        double cost;
+        vector<int> edges = bidirectional_search(cg, ws, s, t, ws.penalty, cost);
+        if (cost < 0 || (edges.empty() && r > 0))
+            break;
+        if (optimum < 0)
+            optimum = cost;
+        vector<int> canon(edges.size());
+        for (size_t i = 0; i < edges.size(); ++i)
+            canon[i] = undirected_edge_id(cg, edges[i]);
+        double worst = 0;
+        for (size_t j = 0; j < keptEdges.size(); ++j)
         {
-            string sf = "data/stops.txt", ef = "data/edges.txt", bf = "data/buses.txt";
-            bool ok1 = sys.g.load_from(sf, ef);
-            bool ok2 = sys.load_buses(bf);
-            cout << "Loaded graph: " << ok1 << " , buses: " << ok2 << "\n";
+            double shared = 0;
+            for (size_t i = 0; i < canon.size(); ++i)
+                if (binary_search(keptEdges[j].begin(), keptEdges[j].end(), canon[i]))
+                    shared += cg.w[edges[i]];
+            worst = max(worst, cost > 0 ? shared / cost : 1.0);
         }
-        else if (ch == 17)
+        if (cost <= maxStretch * optimum + 1e-9 && worst <= maxOverlap)
         {
-            sys.print_history(30);
+            AlternativeRoute ar;
+            ar.cost = cost;
+            ar.overlap = worst;
+            ar.path.push_back(s);
+            for (size_t i = 0; i < edges.size(); ++i)
+                ar.path.push_back(cg.to[edges[i]]);
+            out.push_back(ar);
+            sort(canon.begin(), canon.end());
+            keptEdges.push_back(canon);
         }
-        else if (ch == 18)
+        if (edges.empty())
+            break; // s == t
+        for (size_t i = 0; i < edges.size(); ++i)
         {
-            logger.print_recent(20);
+            ws.scale_penalty(edges[i], penaltyFactor);
+            if (cg.twin[edges[i]] >= 0)
+                ws.scale_penalty(cg.twin[edges[i]], penaltyFactor);
         }
-        else if (ch == 19)
+    }
+    return out;
+}
+
+// Multilevel k-way graph partitioner (METIS-style): heavy-edge matching coarsens the graph,
+// greedy region growing partitions the coarsest level, and boundary moves refine each level
+// on the way back up. Balance is kept within 3% of the average part weight.
+struct PartitionResult
+{
+    int k;
+    vector<int> part;  // part index per stop
+    size_t cutEdges;   // undirected edges whose ends lie in different parts
+    double imbalance;  // heaviest part / average part
+};
+
+struct PartitionGraph
+{
+    vector<int> vw;                     // vertex weights
+    vector<vector<pair<int, int>>> adj; // (neighbour, edge weight), undirected
+    long long total_weight() const
+    {
+        long long t = 0;
+        for (size_t i = 0; i < vw.size(); ++i)
+            t += vw[i];
+        return t;
+    }
+};
+
+PartitionGraph partition_graph_from(const Graph &g)
+{
+    size_t n = g.size();
+    PartitionGraph pg;
+    pg.vw.assign(n, 1);
+    pg.adj.assign(n, vector<pair<int, int>>());
+    vector<int> slot(n, -1);
+    vector<vector<StopID>> und(n);
+    for (size_t u = 0; u < n; ++u)
+    {
+        for (size_t j = 0; j < g.adj[u].size(); ++j)
         {
-            cout << "Exiting. Goodbye!\n";
-            break;
+            StopID v = g.adj[u][j].to;
+            if (v == (StopID)u)
+                continue;
+            und[u].push_back(v);
+            und[v].push_back((StopID)u);
         }
-        else
+    }
+    for (size_t u = 0; u < n; ++u)
+    {
+        for (size_t j = 0; j < und[u].size(); ++j)
         {
-            cout << "Unknown choice.\n";
+            int v = und[u][j];
+            if (slot[v] == -1)
+            {
+                slot[v] = (int)pg.adj[u].size();
+                pg.adj[u].push_back(make_pair(v, 0));
+            }
+            pg.adj[u][slot[v]].second++;
         }
+        for (size_t j = 0; j < pg.adj[u].size(); ++j)
+            slot[pg.adj[u][j].first] = -1;
     }
+    return pg;
 }
 
-// Main
-int main()
+// Heavy-edge matching; cmap receives the coarse vertex of every fine vertex
+PartitionGraph coarsen(const PartitionGraph &fine, vector<int> &cmap, mt19937 &rng)
 {
-    ios::sync_with_stdio(false);
-    cin.tie(nullptr);
+    size_t n = fine.vw.size();
+    vector<int> order(n), match(n, -1);
+    for (size_t i = 0; i < n; ++i)
+        order[i] = (int)i;
+    shuffle(order.begin(), order.end(), rng);
+    cmap.assign(n, -1);
+    int cn = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        int v = order[i];
+        if (match[v] != -1)
+            continue;
+        int best = -1, bestW = -1;
+        for (size_t j = 0; j < fine.adj[v].size(); ++j)
+        {
+            int u = fine.adj[v][j].first;
+            if (match[u] == -1 && u != v && fine.adj[v][j].second > bestW)
+            {
+                best = u;
+                bestW = fine.adj[v][j].second;
+            }
+        }
+        match[v] = best == -1 ? v : best;
+        if (best != -1)
+            match[best] = v;
+        cmap[v] = cn;
+        if (best != -1)
+            cmap[best] = cn;
+        cn++;
+    }
+    PartitionGraph coarse;
+    coarse.vw.assign(cn, 0);
+    coarse.adj.assign(cn, vector<pair<int, int>>());
+    vector<int> slot(cn, -1);
+    for (size_t v = 0; v < n; ++v)
+        coarse.vw[cmap[v]] += fine.vw[v];
+    for (size_t v = 0; v < n; ++v)
+    {
+        if (match[v] < (int)v)
+            continue; // handle each pair once, from its smaller member
+        int c = cmap[v];
+        int members[2] = {(int)v, match[v]};
+        int cnt = match[v] == (int)v ? 1 : 2;
+        for (int k = 0; k < cnt; ++k)
+        {
+            const vector<pair<int, int>> &lst = fine.adj[members[k]];
+            for (size_t j = 0; j < lst.size(); ++j)
+            {
+                int cu = cmap[lst[j].first];
+                if (cu == c)
+                    continue;
+                if (slot[cu] == -1)
+                {
+                    slot[cu] = (int)coarse.adj[c].size();
+                    coarse.adj[c].push_back(make_pair(cu, 0));
+                }
+                coarse.adj[c][slot[cu]].second += lst[j].second;
+            }
+        }
+        for (size_t j = 0; j < coarse.adj[c].size(); ++j)
+            slot[coarse.adj[c][j].first] = -1;
+    }
+    return coarse;
+}
+
+// Grow k regions breadth-first from spread-out seeds
+vector<int> grow_regions(const PartitionGraph &pg, int k, long long maxW, mt19937 &rng)
+{
+    size_t n = pg.vw.size();
+    vector<int> part(n, -1);
+    vector<long long> weight(k, 0);
+    vector<deque<int>> frontier(k);
+    // First seed at random, each next seed is the vertex farthest (in hops) from the seeds so far
+    vector<int> hops(n, INT_MAX);
+    int seed = (int)(rng() % n);
+    for (int p = 0; p < k; ++p)
+    {
+        if (part[seed] == -1)
+        {
+            part[seed] = p;
+            weight[p] += pg.vw[seed];
+            frontier[p].push_back(seed);
+        }
+        deque<int> q;
+        hops[seed] = 0;
+        q.push_back(seed);
+        while (!q.empty())
+        {
+            int v = q.front();
+            q.pop_front();
+            for (size_t j = 0; j < pg.adj[v].size(); ++j)
+            {
+                int u = pg.adj[v][j].first;
+                if (hops[u] > hops[v] + 1)
+                {
+                    hops[u] = hops[v] + 1;
+                    q.push_back(u);
+                }
+            }
+        }
+        int far = -1;
+        for (size_t v = 0; v < n; ++v)
+            if (part[v] == -1 && (far == -1 || hops[v] > hops[far]))
+                far = (int)v;
+        if (far == -1)
+            break;
+        seed = far;
+    }
+    bool grew = true;
+    while (grew)
+    {
+        grew = false;
+        for (int p = 0; p < k; ++p)
+        {
+            // Each part claims one vertex per sweep so sizes stay even
+            while (!frontier[p].empty() && weight[p] < maxW)
+            {
+                int v = frontier[p].front();
+                bool took = false;
+                for (size_t j = 0; j < pg.adj[v].size(); ++j)
+                {
+                    int u = pg.adj[v][j].first;
+                    if (part[u] == -1 && weight[p] + pg.vw[u] <= maxW)
+                    {
+                        part[u] = p;
+                        weight[p] += pg.vw[u];
+                        frontier[p].push_back(u);
+                        took = grew = true;
+                        break;
+                    }
+                }
+                if (took)
+                    break;
+                frontier[p].pop_front();
+            }
+        }
+    }
+    // Unreached vertices (other components, or squeezed out by balance) go to the lightest part
+    for (size_t v = 0; v < n; ++v)
+    {
+        if (part[v] != -1)
+            continue;
+        int lightest = (int)(min_element(weight.begin(), weight.end()) - weight.begin());
+        part[v] = lightest;
+        weight[lightest] += pg.vw[v];
+    }
+    return part;
+}
+
+// Greedy boundary refinement: move vertices to the neighbouring part they are most connected to
+void refine_partition(const PartitionGraph &pg, vector<int> &part, int k, long long maxW, mt19937 &rng, int passes = 4)
+{
+    size_t n = pg.vw.size();
+    vector<long long> weight(k, 0);
+    for (size_t v = 0; v < n; ++v)
+        weight[part[v]] += pg.vw[v];
+    vector<int> order(n), conn(k, 0);
+    for (size_t i = 0; i < n; ++i)
+        order[i] = (int)i;
+    for (int pass = 0; pass < passes; ++pass)
+    {
+        shuffle(order.begin(), order.end(), rng);
+        size_t moves = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            int v = order[i], p = part[v];
+            bool boundary = false;
+            for (size_t j = 0; j < pg.adj[v].size(); ++j)
+            {
+                conn[part[pg.adj[v][j].first]] += pg.adj[v][j].second;
+                boundary = boundary || part[pg.adj[v][j].first] != p;
+            }
+            // Positive gains always move; zero gains move towards the lighter side; an
+            // overweight part sheds vertices even at a loss
+            int best = p, bestGain = weight[p] > maxW ? INT_MIN : 0;
+            if (boundary)
+            {
+                for (size_t j = 0; j < pg.adj[v].size(); ++j)
+                {
+                    int q = part[pg.adj[v][j].first];
+                    if (q == p || weight[q] + pg.vw[v] > maxW)
+                        continue;
+                    int gain = conn[q] - conn[p];
+                    if (gain > bestGain || (gain == bestGain && (best == p ? weight[q] + pg.vw[v] < weight[p] : weight[q] < weight[best])))
+                    {
+                        best = q;
+                        bestGain = gain;
+                    }
+                }
+            }
+            for (size_t j = 0; j < pg.adj[v].size(); ++j)
+                conn[part[pg.adj[v][j].first]] = 0;
+            if (best != p)
+            {
+                part[v] = best;
+                weight[p] -= pg.vw[v];
+                weight[best] += pg.vw[v];
+                moves++;
+            }
+        }
+        if (moves == 0)
+            break;
+    }
+}
+
+PartitionResult partition_graph(const Graph &g, int k, unsigned seed = 1)
+{
+    PartitionResult res;
+    res.k = max(1, k);
+    res.cutEdges = 0;
+    res.imbalance = 1.0;
+    size_t n = g.size();
+    res.part.assign(n, 0);
+    if (n == 0 || res.k == 1)
+        return res;
+    mt19937 rng(seed);
+    vector<PartitionGraph> levels(1, partition_graph_from(g));
+    vector<vector<int>> maps;
+    size_t target = max((size_t)(30 * res.k), (size_t)100);
+    while (levels.back().vw.size() > target)
+    {
+        vector<int> cmap;
+        PartitionGraph c = coarsen(levels.back(), cmap, rng);
+        if (c.vw.size() > levels.back().vw.size() * 0.95)
+            break; // matching stalled (e.g. star-like leftovers)
+        maps.push_back(cmap);
+        levels.push_back(c);
+    }
+    long long total = levels[0].total_weight();
+    long long maxW = (long long)ceil(total / (double)res.k * 1.03);
+    // Coarse vertices can be heavy, so the coarsest level gets a looser bound
+    long long coarseMax = max(maxW, (long long)ceil(total / (double)res.k * 1.10));
+    vector<int> part = grow_regions(levels.back(), res.k, coarseMax, rng);
+    refine_partition(levels.back(), part, res.k, coarseMax, rng);
+    for (int lvl = (int)levels.size() - 2; lvl >= 0; --lvl)
+    {
+        vector<int> finer(levels[lvl].vw.size());
+        for (size_t v = 0; v < finer.size(); ++v)
+            finer[v] = part[maps[lvl][v]];
+        part.swap(finer);
+        refine_partition(levels[lvl], part, res.k, lvl == 0 ? maxW : coarseMax, rng);
+    }
+    res.part = part;
+    vector<long long> weight(res.k, 0);
+    for (size_t v = 0; v < n; ++v)
+        weight[part[v]]++;
+    const PartitionGraph &pg = levels[0];
+    for (size_t v = 0; v < n; ++v)
+        for (size_t j = 0; j < pg.adj[v].size(); ++j)
+            if ((int)v < pg.adj[v][j].first && part[v] != part[pg.adj[v][j].first])
+                res.cutEdges++;
+    res.imbalance = *max_element(weight.begin(), weight.end()) / (n / (double)res.k);
+    return res;
+}
+
+// Text form that reads back as exactly the same double
+string fmt_double(double d)
+{
+    char tmp[32];
+    snprintf(tmp, sizeof(tmp), "%.17g", d);
+    return tmp;
+}
+
+#ifndef _WIN32
+// Sharded routing: every shard process owns one partition, and the coordinator keeps an
+// overlay of boundary stops (shard-computed boundary-to-boundary distances plus the cut
+// edges). Cross-partition answers are stitched together on the overlay and expanded back
+// into full paths by the shards. Shards speak a line-based text protocol over Unix sockets.
+struct ShardChannel
+{
+    FILE *in, *out;
+    char *buf;
+    size_t cap;
+
+    ShardChannel() : in(NULL), out(NULL), buf(NULL), cap(0) {}
+
+    bool open_fd(int fd)
+    {
+        in = fdopen(fd, "r");
+        out = fdopen(dup(fd), "w");
+        return in && out;
+    }
+
+    // Next line without its newline; false once the peer hung up
+    bool read_line(string &line)
+    {
+        ssize_t len = getline(&buf, &cap, in);
+        if (len < 0)
+            return false;
+        while (len > 0 && (buf[len - 1] == '\n' || buf[len - 1] == '\r'))
+            len--;
+        line.assign(buf, (size_t)len);
+        return true;
+    }
+
+    void send(const string &s)
+    {
+        fwrite(s.data(), 1, s.size(), out);
+    }
+
+    void flush() { fflush(out); }
+
+    void close_all()
+    {
+        if (in)
+            fclose(in);
+        if (out)
+            fclose(out);
+        free(buf);
+        in = out = NULL;
+        buf = NULL;
+        cap = 0;
+    }
+};
+
+// Shard process: holds one partition (forward and reversed) and answers
+//   LOAD n m / S gid x y name / E u v w   partition stops and edges (local ids)
+//   BOUNDARY gid...                       stops with edges leaving or entering the partition
+//   CLIQUE                                D a b dist for every boundary pair, then END
+//   FROM gid / TO gid                     D b dist from gid to each boundary stop (or back), then END
+//   PATH a b                              P cost gid... (P -1 when unreachable)
+//   QUIT
+int shard_main(int fd)
+{
+    ShardChannel ch;
+    if (!ch.open_fd(fd))
+        return 1;
+    Graph local, backward;
+    vector<StopID> gid;
+    unordered_map<StopID, StopID> toLocal;
+    vector<StopID> boundary;
+    string line;
+    while (ch.read_line(line))
+    {
+        istringstream ss(line);
+        string cmd;
+        ss >> cmd;
+        if (cmd == "LOAD")
+        {
+            size_t n = 0, m = 0;
+            ss >> n >> m;
+            for (size_t i = 0; i < n && ch.read_line(line); ++i)
+            {
+                istringstream ls(line);
+                string tag, name;
+                StopID id;
+                double x, y;
+                ls >> tag >> id >> x >> y;
+                getline(ls, name);
+                // Positional: local ids must line up with the order the coordinator sent
+                StopID l = local.append_stop(name, x, y);
+                backward.append_stop(name, x, y);
+                toLocal[id] = l;
+                gid.push_back(id);
+            }
+            for (size_t i = 0; i < m && ch.read_line(line); ++i)
+            {
+                istringstream ls(line);
+                string tag;
+                StopID u, v;
+                double w;
+                ls >> tag >> u >> v >> w;
+                local.add_edge(u, v, w, false);
+                backward.add_edge(v, u, w, false);
+            }
+        }
+        else if (cmd == "BOUNDARY")
+        {
+            StopID id;
+            while (ss >> id)
+                boundary.push_back(toLocal[id]);
+        }
+        else if (cmd == "CLIQUE")
+        {
+            for (size_t i = 0; i < boundary.size(); ++i)
+            {
+                vector<double> dist = dijkstra(local, boundary[i]).first;
+                for (size_t j = 0; j < boundary.size(); ++j)
+                    if (j != i && dist[boundary[j]] <= 1e17)
+                        ch.send("D " + to_string(gid[boundary[i]]) + " " + to_string(gid[boundary[j]]) + " " + fmt_double(dist[boundary[j]]) + "\n");
+            }
+            ch.send("END\n");
+        }
+        else if (cmd == "FROM" || cmd == "TO")
+        {
+            StopID id;
+            ss >> id;
+            vector<double> dist = dijkstra(cmd == "FROM" ? local : backward, toLocal[id]).first;
+            for (size_t j = 0; j < boundary.size(); ++j)
+                if (dist[boundary[j]] <= 1e17)
+                    ch.send("D " + to_string(gid[boundary[j]]) + " " + fmt_double(dist[boundary[j]]) + "\n");
+            ch.send("END\n");
+        }
+        else if (cmd == "PATH")
+        {
+            StopID a, b;
+            ss >> a >> b;
+            pair<vector<double>, vector<int>> res = dijkstra(local, toLocal[a]);
+            StopID lb = toLocal[b];
+            if (res.first[lb] > 1e17)
+                ch.send("P -1\n");
+            else
+            {
+                string out = "P " + fmt_double(res.first[lb]);
+                vector<StopID> path = reconstruct_path(res.second, lb);
+                for (size_t i = 0; i < path.size(); ++i)
+                    out += " " + to_string(gid[path[i]]);
+                ch.send(out + "\n");
+            }
+        }
+        else if (cmd == "QUIT")
+            break;
+        ch.flush();
+    }
+    ch.close_all();
+    return 0;
+}
+
+struct ShardCoordinator
+{
+    const Graph *g;
+    PartitionResult parts;
+    vector<pid_t> pids;
+    vector<ShardChannel> shards;
+    vector<int> overlayId;  // boundary index per stop, -1 for interior stops
+    vector<StopID> overlayStop;
+    vector<vector<pair<int, double>>> overlay; // clique edges inside a part, cut edges between parts
+
+    ShardCoordinator() : g(NULL) {}
+    ~ShardCoordinator() { stop(); }
+
+    size_t boundary_count() const { return overlayStop.size(); }
+
+    size_t overlay_edges() const
+    {
+        size_t m = 0;
+        for (size_t i = 0; i < overlay.size(); ++i)
+            m += overlay[i].size();
+        return m;
+    }
+
+    // Partition the graph, fork one shard per part and assemble the overlay
+    bool start(const Graph &graph, int k, unsigned seed = 1)
+    {
+        stop();
+        g = &graph;
+        parts = partition_graph(graph, k, seed);
+        size_t n = graph.size();
+        overlayId.assign(n, -1);
+        overlayStop.clear();
+        for (size_t u = 0; u < n; ++u)
+        {
+            for (size_t j = 0; j < graph.adj[u].size(); ++j)
+            {
+                StopID v = graph.adj[u][j].to;
+                if (parts.part[u] == parts.part[v])
+                    continue;
+                if (overlayId[u] == -1)
+                {
+                    overlayId[u] = (int)overlayStop.size();
+                    overlayStop.push_back((StopID)u);
+                }
+                if (overlayId[v] == -1)
+                {
+                    overlayId[v] = (int)overlayStop.size();
+                    overlayStop.push_back(v);
+                }
+            }
+        }
+        overlay.assign(overlayStop.size(), vector<pair<int, double>>());
+        vector<vector<StopID>> members(parts.k);
+        vector<StopID> localId(n);
+        for (size_t u = 0; u < n; ++u)
+        {
+            localId[u] = (StopID)members[parts.part[u]].size();
+            members[parts.part[u]].push_back((StopID)u);
+        }
+        cout.flush();
+        fflush(stdout);
+        shards.assign(parts.k, ShardChannel());
+        for (int p = 0; p < parts.k; ++p)
+        {
+            int sv[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+                return false;
+            pid_t pid = fork();
+            if (pid < 0)
+                return false;
+            if (pid == 0)
+            {
+                // Child: drop every other shard's channel, then serve
+                close(sv[0]);
+                for (int q = 0; q < p; ++q)
+                {
+                    close(fileno(shards[q].in));
+                    close(fileno(shards[q].out));
+                }
+                _exit(shard_main(sv[1]));
+            }
+            close(sv[1]);
+            pids.push_back(pid);
+            shards[p].open_fd(sv[0]);
+        }
+        for (int p = 0; p < parts.k; ++p)
+        {
+            const vector<StopID> &mem = members[p];
+            string msg;
+            size_t m = 0;
+            for (size_t i = 0; i < mem.size(); ++i)
+                for (size_t j = 0; j < graph.adj[mem[i]].size(); ++j)
+                    m += parts.part[graph.adj[mem[i]][j].to] == p;
+            msg = "LOAD " + to_string(mem.size()) + " " + to_string(m) + "\n";
+            for (size_t i = 0; i < mem.size(); ++i)
+            {
+                const Stop &s = graph.stops[mem[i]];
+                msg += "S " + to_string(mem[i]) + " " + fmt_double(s.loc.x) + " " + fmt_double(s.loc.y) + " " + s.name + "\n";
+            }
+            for (size_t i = 0; i < mem.size(); ++i)
+            {
+                for (size_t j = 0; j < graph.adj[mem[i]].size(); ++j)
+                {
+                    const Edge &e = graph.adj[mem[i]][j];
+                    if (parts.part[e.to] == p)
+                        msg += "E " + to_string(i) + " " + to_string(localId[e.to]) + " " + fmt_double(e.weight) + "\n";
+                }
+            }
+            msg += "BOUNDARY";
+            for (size_t i = 0; i < mem.size(); ++i)
+                if (overlayId[mem[i]] != -1)
+                    msg += " " + to_string(mem[i]);
+            shards[p].send(msg + "\nCLIQUE\n");
+            shards[p].flush();
+        }
+        // Shards build their cliques concurrently; collect them in order
+        for (int p = 0; p < parts.k; ++p)
+        {
+            if (!read_distances(p, NULL))
+                return false;
+        }
+        for (size_t u = 0; u < n; ++u)
+        {
+            for (size_t j = 0; j < graph.adj[u].size(); ++j)
+            {
+                const Edge &e = graph.adj[u][j];
+                if (parts.part[u] != parts.part[e.to])
+                    overlay[overlayId[u]].push_back(make_pair(overlayId[e.to], e.weight));
+            }
+        }
+        return true;
+    }
+
+    void stop()
+    {
+        for (size_t p = 0; p < shards.size(); ++p)
+        {
+            shards[p].send("QUIT\n");
+            shards[p].flush();
+            shards[p].close_all();
+        }
+        for (size_t p = 0; p < pids.size(); ++p)
+            waitpid(pids[p], NULL, 0);
+        shards.clear();
+        pids.clear();
+    }
+
+    // Read D lines until END: with out == NULL they are clique edges "D a b dist",
+    // otherwise per-boundary distances "D b dist"
+    bool read_distances(int p, vector<pair<int, double>> *out)
+    {
+        string line;
+        while (shards[p].read_line(line))
+        {
+            if (line == "END")
+                return true;
+            const char *c = line.c_str() + 2;
+            char *end;
+            long a = strtol(c, &end, 10);
+            if (out)
+                out->push_back(make_pair(overlayId[a], strtod(end, NULL)));
+            else
+            {
+                long b = strtol(end, &end, 10);
+                overlay[overlayId[a]].push_back(make_pair(overlayId[b], strtod(end, NULL)));
+            }
+        }
+        return false;
+    }
+
+    // Read a PATH answer and append its stops (skipping the first when append is set)
+    double read_path(int p, vector<StopID> &path, bool append)
+    {
+        string line;
+        if (!shards[p].read_line(line))
+            return -1;
+        istringstream ss(line.substr(2));
+        double cost;
+        ss >> cost;
+        StopID id;
+        bool first = true;
+        while (ss >> id)
+        {
+            if (!(first && append))
+                path.push_back(id);
+            first = false;
+        }
+        return cost;
+    }
+
+    // Shortest path over the shards: direct inside one part, or source part -> overlay -> target part
+    pair<double, vector<StopID>> route(StopID s, StopID t)
+    {
+        pair<double, vector<StopID>> out(-1.0, vector<StopID>());
+        if (!g || s < 0 || t < 0 || s >= (StopID)g->size() || t >= (StopID)g->size())
+            return out;
+        int ps = parts.part[s], pt = parts.part[t];
+        shards[ps].send("FROM " + to_string(s) + "\n");
+        shards[ps].flush();
+        shards[pt].send("TO " + to_string(t) + "\n");
+        if (ps == pt)
+            shards[pt].send("PATH " + to_string(s) + " " + to_string(t) + "\n");
+        shards[pt].flush();
+        vector<pair<int, double>> fromS, toT;
+        read_distances(ps, &fromS);
+        read_distances(pt, &toT);
+        vector<StopID> direct;
+        double directCost = ps == pt ? read_path(pt, direct, false) : -1;
+        // Dijkstra on the overlay with a virtual target node B
+        size_t B = overlayStop.size();
+        const double INF = 1e18;
+        vector<double> dist(B + 1, INF), exitCost(B, INF);
+        vector<int> prev(B + 1, -1);
+        typedef pair<double, int> PDI;
+        priority_queue<PDI, vector<PDI>, greater<PDI>> pq;
+        for (size_t i = 0; i < fromS.size(); ++i)
+        {
+            dist[fromS[i].first] = fromS[i].second;
+            pq.push(make_pair(fromS[i].second, fromS[i].first));
+        }
+        for (size_t i = 0; i < toT.size(); ++i)
+            exitCost[toT[i].first] = toT[i].second;
+        while (!pq.empty())
+        {
+            PDI top = pq.top();
+            pq.pop();
+            int u = top.second;
+            if (top.first > dist[u])
+                continue;
+            if (u == (int)B)
+                break;
+            if (exitCost[u] < INF && dist[u] + exitCost[u] < dist[B])
+            {
+                dist[B] = dist[u] + exitCost[u];
+                prev[B] = u;
+                pq.push(make_pair(dist[B], (int)B));
+            }
+            for (size_t j = 0; j < overlay[u].size(); ++j)
+            {
+                int v = overlay[u][j].first;
+                if (dist[u] + overlay[u][j].second < dist[v])
+                {
+                    dist[v] = dist[u] + overlay[u][j].second;
+                    prev[v] = u;
+                    pq.push(make_pair(dist[v], v));
+                }
+            }
+        }
+        if (directCost >= 0 && (dist[B] >= INF || directCost <= dist[B]))
+        {
+            out.first = directCost;
+            out.second = direct;
+            return out;
+        }
+        if (dist[B] >= INF)
+            return out;
+        vector<StopID> chain; // boundary stops along the overlay path
+        for (int v = prev[B]; v != -1; v = prev[v])
+            chain.push_back(overlayStop[v]);
+        reverse(chain.begin(), chain.end());
+        // Expand every intra-part hop with a PATH request; cut edges are taken as they are
+        chain.insert(chain.begin(), s);
+        chain.push_back(t);
+        for (size_t i = 0; i + 1 < chain.size(); ++i)
+        {
+            StopID a = chain[i], b = chain[i + 1];
+            if (a == b || parts.part[a] != parts.part[b])
+                continue;
+            shards[parts.part[a]].send("PATH " + to_string(a) + " " + to_string(b) + "\n");
+            shards[parts.part[a]].flush();
+        }
+        out.first = dist[B];
+        out.second.push_back(s);
+        for (size_t i = 0; i + 1 < chain.size(); ++i)
+        {
+            StopID a = chain[i], b = chain[i + 1];
+            if (a == b)
+                continue;
+            if (parts.part[a] != parts.part[b])
+                out.second.push_back(b);
+            else
+                read_path(parts.part[a], out.second, true);
+        }
+        return out;
+    }
+
+    pair<double, vector<NameView>> shortest_path_names(NameView a, NameView b)
+    {
+        pair<double, vector<NameView>> out(-1.0, vector<NameView>());
+        pair<double, vector<StopID>> r = route(g->get_id(a), g->get_id(b));
+        out.first = r.first;
+        for (size_t i = 0; i < r.second.size(); ++i)
+            out.second.push_back(g->get_name(r.second[i]));
+        return out;
+    }
+};
+#endif
+
+// Bus entity with route and position tracking
+struct Bus
+{
+    string busId;
+    vector<StopID> route; // Ordered sequence of stops
+    int currentIndex;     // Current position in route
+    double speed;         // Speed in km/h (informational)
+    bool active;          // Whether bus is currently running
+    Bus() : busId(""), currentIndex(0), speed(40.0), active(false) {}
+    Bus(const string &id, const vector<StopID> &r, double sp = 40.0) : busId(id), route(r), currentIndex(0), speed(sp), active(true) {}
+    StopID current_stop() const
+    {
+        if (route.empty())
+            return -1;
+        int idx = currentIndex;
+        if (idx < 0)
+            idx = 0;
+        if (idx >= (int)route.size())
+            idx = (int)route.size() - 1;
+        return route[idx];
+    }
+    StopID next_stop() const
+    {
+        if (route.empty())
+            return -1;
+        if (currentIndex + 1 >= (int)route.size())
+            return route.back();
+        return route[currentIndex + 1];
+    }
+    bool move_next()
+    {
+        if (!active)
+            return false;
+        if (route.empty())
+            return false;
+        if (currentIndex + 1 < (int)route.size())
+        {
+            currentIndex++;
+            return true;
+        }
+        else
+        {
+            active = false;
+            return false;
+        }
+    }
+    string info(const Graph &g) const
+    {
+        stringstream ss;
+        ss << "[" << busId << "] ";
+        ss << "At: ";
+        StopID cs = current_stop();
+        if (cs >= 0)
+            ss << g.get_name(cs);
+        else
+            ss << "N/A";
+        ss << " (idx " << currentIndex << "/" << (route.empty() ? 0 : route.size() - 1) << ")";
+        ss << (active ? " RUNNING" : currentIndex + 1 < (int)route.size() ? " HELD" : " STOPPED");
+        return ss.str();
+    }
+    string serialize() const
+    {
+        stringstream ss;
+        ss << busId << "|" << speed << "|" << currentIndex;
+        for (size_t i = 0; i < route.size(); ++i)
+            ss << "|" << route[i];
+        return ss.str();
+    }
+    static Bus deserialize(const string &line)
+    {
+        vector<string> parts;
+        string cur;
+        stringstream ss(line);
+        while (getline(ss, cur, '|'))
+            parts.push_back(cur);
+        Bus bus;
+        if (parts.size() >= 3)
+        {
+            bus.busId = parts[0];
+            bus.speed = atof(parts[1].c_str());
+            bus.currentIndex = atoi(parts[2].c_str());
+            for (size_t i = 3; i < parts.size(); ++i)
+                bus.route.push_back((StopID)atoi(parts[i].c_str()));
+            bus.active = true;
+        }
+        return bus;
+    }
+};
+
+// One line of a stop's departure board
+struct BoardEntry
+{
+    NameView busId; // view of the bus's id, valid while the bus exists
+    double eta;     // minutes along the bus's own route
+    int stopsAway;
+};
+
+// On-route ETA tables: cumulative travel time along every distinct bus route, plus an
+// inverted stop -> (route, position) index. Buses sharing a route share one row, and bus
+// positions are read live, so ticks need no rebuild; only graph or route changes do.
+struct Timetable
+{
+    bool built;
+    uint64_t version; // graph version the rows were built from
+    vector<vector<StopID>> routes;
+    vector<vector<double>> cum;   // cum[r][i]: minutes from routes[r][0] to routes[r][i]
+    vector<int> postStart;        // per stop, into postRoute/postPos (CSR)
+    vector<int> postRoute, postPos;
+    vector<int> busStart;         // per route, into busPtr (CSR)
+    vector<const Bus *> busPtr;
+    unordered_map<string, int> routeOfBus;
+
+    Timetable() : built(false), version(0) {}
+    // Rows point at the owner's buses, so a copy must be rebuilt by its new owner
+    Timetable(const Timetable &) : built(false), version(0) {}
+    Timetable &operator=(const Timetable &)
+    {
+        built = false;
+        return *this;
+    }
+
+    bool stale(const Graph &g) const { return !built || version != g.version; }
+
+    void build(const Graph &g, const unordered_map<string, Bus> &buses)
+    {
+        routes.clear();
+        cum.clear();
+        routeOfBus.clear();
+        map<vector<StopID>, int> rowOf;
+        vector<vector<const Bus *>> members;
+        for (unordered_map<string, Bus>::const_iterator it = buses.begin(); it != buses.end(); ++it)
+        {
+            const Bus &b = it->second;
+            if (b.route.empty())
+                continue;
+            map<vector<StopID>, int>::iterator f = rowOf.find(b.route);
+            int r;
+            if (f == rowOf.end())
+            {
+                r = (int)routes.size();
+                rowOf[b.route] = r;
+                routes.push_back(b.route);
+                members.push_back(vector<const Bus *>());
+            }
+            else
+                r = f->second;
+            members[r].push_back(&b);
+            routeOfBus[it->first] = r;
+        }
+        // Consecutive route stops normally share an edge; otherwise fall back to the network
+        map<pair<StopID, StopID>, double> gap;
+        const double INF = 1e18;
+        cum.resize(routes.size());
+        for (size_t r = 0; r < routes.size(); ++r)
+        {
+            const vector<StopID> &rt = routes[r];
+            cum[r].assign(rt.size(), 0.0);
+            for (size_t i = 1; i < rt.size(); ++i)
+            {
+                StopID u = rt[i - 1], v = rt[i];
+                double w = u == v ? 0.0 : INF;
+                for (size_t j = 0; u >= 0 && u < (StopID)g.size() && j < g.adj[u].size(); ++j)
+                    if (g.adj[u][j].to == v)
+                        w = min(w, g.adj[u][j].weight);
+                if (w >= INF && u >= 0 && v >= 0 && u < (StopID)g.size() && v < (StopID)g.size())
+                {
+                    pair<StopID, StopID> key(u, v);
+                    if (!gap.count(key))
+                        gap[key] = dijkstra(g, u).first[v];
+                    w = gap[key];
+                }
+                cum[r][i] = cum[r][i - 1] >= INF || w >= INF ? INF : cum[r][i - 1] + w;
+            }
+        }
+        size_t n = g.size();
+        postStart.assign(n + 1, 0);
+        for (size_t r = 0; r < routes.size(); ++r)
+            for (size_t i = 0; i < routes[r].size(); ++i)
+                if (routes[r][i] >= 0 && routes[r][i] < (StopID)n)
+                    postStart[routes[r][i] + 1]++;
+        for (size_t s = 0; s < n; ++s)
+            postStart[s + 1] += postStart[s];
+        postRoute.assign(postStart[n], 0);
+        postPos.assign(postStart[n], 0);
+        vector<int> fill(postStart.begin(), postStart.end() - 1);
+        // Routes in order, positions ascending: a stop's postings for one route are adjacent
+        for (size_t r = 0; r < routes.size(); ++r)
+            for (size_t i = 0; i < routes[r].size(); ++i)
+                if (routes[r][i] >= 0 && routes[r][i] < (StopID)n)
+                {
+                    int k = fill[routes[r][i]]++;
+                    postRoute[k] = (int)r;
+                    postPos[k] = (int)i;
+                }
+        busStart.assign(routes.size() + 1, 0);
+        busPtr.clear();
+        for (size_t r = 0; r < routes.size(); ++r)
+        {
+            busPtr.insert(busPtr.end(), members[r].begin(), members[r].end());
+            busStart[r + 1] = (int)busPtr.size();
+        }
+        version = g.version;
+        built = true;
+    }
+
+    // Minutes until a bus at position cur on row r reaches stop s, or -1 when s is not ahead
+    double eta_on_route(int r, int cur, StopID s) const
+    {
+        if (s < 0 || s + 1 >= (StopID)postStart.size())
+            return -1.0;
+        for (int k = postStart[s]; k < postStart[s + 1]; ++k)
+            if (postRoute[k] == r && postPos[k] >= cur)
+                return cum[r][postPos[k]] >= 1e17 ? -1.0 : cum[r][postPos[k]] - cum[r][cur];
+        return -1.0;
+    }
+
+    // Every running bus that will still reach stop s, soonest first (limit 0 = all)
+    vector<BoardEntry> board(StopID s, size_t limit = 0) const
+    {
+        vector<BoardEntry> out;
+        if (s < 0 || s + 1 >= (StopID)postStart.size())
+            return out;
+        for (int k = postStart[s]; k < postStart[s + 1];)
+        {
+            int r = postRoute[k], end = k;
+            while (end < postStart[s + 1] && postRoute[end] == r)
+                end++;
+            for (int b = busStart[r]; b < busStart[r + 1]; ++b)
+            {
+                const Bus *bus = busPtr[b];
+                if (!bus->active)
+                    continue;
+                int cur = max(0, min(bus->currentIndex, (int)routes[r].size() - 1));
+                for (int j = k; j < end; ++j)
+                {
+                    if (postPos[j] < cur)
+                        continue;
+                    if (cum[r][postPos[j]] < 1e17)
+                    {
+                        BoardEntry e = {NameView(bus->busId), cum[r][postPos[j]] - cum[r][cur], postPos[j] - cur};
+                        out.push_back(e);
+                    }
+                    break; // next visit of this stop only
+                }
+            }
+            k = end;
+        }
+        sort(out.begin(), out.end(), [](const BoardEntry &a, const BoardEntry &b) { return a.eta < b.eta || (a.eta == b.eta && a.busId < b.busId); });
+        if (limit && out.size() > limit)
+            out.resize(limit);
+        return out;
+    }
+};
+
+// Sharded LRU cache for routing answers, keyed by (algorithm, src, dst, graph version).
+// Entries from an older graph version can never hit again and age out of the LRU.
+struct RouteCache
+{
+    struct Key
+    {
+        char algo; // 'D' Dijkstra, 'A' A*
+        StopID src, dst;
+        uint64_t version;
+        bool operator==(const Key &o) const { return algo == o.algo && src == o.src && dst == o.dst && version == o.version; }
+    };
+    struct KeyHash
+    {
+        size_t operator()(const Key &k) const
+        {
+            uint64_t h = (uint64_t)(uint32_t)k.src * 0x9E3779B97F4A7C15ULL ^ ((uint64_t)(uint32_t)k.dst << 1) ^ ((uint64_t)k.algo << 56);
+            h ^= k.version * 0xC2B2AE3D27D4EB4FULL;
+            h ^= h >> 29;
+            return (size_t)(h * 0xBF58476D1CE4E5B9ULL);
+        }
+    };
+    typedef pair<double, vector<NameView>> Value; // views into the graph's name arena
+    struct Shard
+    {
+        mutex mu;
+        list<pair<Key, Value>> lru; // most recent first
+        unordered_map<Key, list<pair<Key, Value>>::iterator, KeyHash> index;
+    };
+
+    vector<Shard> shards;
+    size_t capacityPerShard;
+    atomic<uint64_t> hits, misses, evictions;
+
+    RouteCache(size_t capacity = 4096, size_t nshards = 16) : shards(nshards), hits(0), misses(0), evictions(0)
+    {
+        capacityPerShard = (capacity + nshards - 1) / nshards;
+    }
+    // Copies start cold with the same capacity (mutexes and entries are not shared)
+    RouteCache(const RouteCache &o) : shards(o.shards.size()), capacityPerShard(o.capacityPerShard), hits(0), misses(0), evictions(0) {}
+    RouteCache &operator=(const RouteCache &o)
+    {
+        if (this != &o)
+        {
+            vector<Shard> fresh(o.shards.size());
+            shards.swap(fresh);
+            capacityPerShard = o.capacityPerShard;
+            hits = misses = evictions = 0;
+        }
+        return *this;
+    }
+
+    bool enabled() const { return capacityPerShard > 0; }
+
+    Shard &shard_for(const Key &k) { return shards[KeyHash()(k) % shards.size()]; }
+
+    bool lookup(const Key &k, Value &out)
+    {
+        if (!enabled())
+            return false;
+        Shard &s = shard_for(k);
+        lock_guard<mutex> lock(s.mu);
+        auto it = s.index.find(k);
+        if (it == s.index.end())
+        {
+            misses++;
+            return false;
+        }
+        s.lru.splice(s.lru.begin(), s.lru, it->second);
+        out = it->second->second;
+        hits++;
+        return true;
+    }
+
+    void insert(const Key &k, const Value &v)
+    {
+        if (!enabled())
+            return;
+        Shard &s = shard_for(k);
+        lock_guard<mutex> lock(s.mu);
+        auto it = s.index.find(k);
+        if (it != s.index.end())
+        {
+            it->second->second = v;
+            s.lru.splice(s.lru.begin(), s.lru, it->second);
+            return;
+        }
+        s.lru.push_front(make_pair(k, v));
+        s.index[k] = s.lru.begin();
+        while (s.lru.size() > capacityPerShard)
+        {
+            s.index.erase(s.lru.back().first);
+            s.lru.pop_back();
+            evictions++;
+        }
+    }
+
+    void clear()
+    {
+        for (size_t i = 0; i < shards.size(); ++i)
+        {
+            lock_guard<mutex> lock(shards[i].mu);
+            shards[i].lru.clear();
+            shards[i].index.clear();
+        }
+    }
+
+    size_t size()
+    {
+        size_t n = 0;
+        for (size_t i = 0; i < shards.size(); ++i)
+        {
+            lock_guard<mutex> lock(shards[i].mu);
+            n += shards[i].lru.size();
+        }
+        return n;
+    }
+
+    double hit_rate() const
+    {
+        uint64_t h = hits, m = misses;
+        return h + m == 0 ? 0.0 : (double)h / (double)(h + m);
+    }
+
+    string stats()
+    {
+        stringstream ss;
+        ss << "entries=" << size() << " hits=" << hits << " misses=" << misses << " evictions=" << evictions << " hit_rate=" << hit_rate();
+        return ss.str();
+    }
+};
+
+// Inverted index from route legs (consecutive stops u -> v) to the buses that drive them,
+// as one sorted array of (leg, bus) pairs. Rebuilt after routes change.
+struct RouteLegIndex
+{
+    bool built;
+    vector<pair<uint64_t, int>> legs; // (u << 32 | v, index into bus)
+    vector<Bus *> bus;
+
+    RouteLegIndex() : built(false) {}
+    // Rows point at the owner's buses, so a copy must be rebuilt by its new owner
+    RouteLegIndex(const RouteLegIndex &) : built(false) {}
+    RouteLegIndex &operator=(const RouteLegIndex &)
+    {
+        built = false;
+        return *this;
+    }
+
+    static uint64_t key(StopID u, StopID v) { return (uint64_t)(uint32_t)u << 32 | (uint32_t)v; }
+
+    void build(unordered_map<string, Bus> &buses)
+    {
+        legs.clear();
+        bus.clear();
+        for (unordered_map<string, Bus>::iterator it = buses.begin(); it != buses.end(); ++it)
+        {
+            const vector<StopID> &r = it->second.route;
+            for (size_t i = 1; i < r.size(); ++i)
+                if (r[i - 1] != r[i])
+                    legs.push_back(make_pair(key(r[i - 1], r[i]), (int)bus.size()));
+            bus.push_back(&it->second);
+        }
+        sort(legs.begin(), legs.end());
+        legs.erase(unique(legs.begin(), legs.end()), legs.end());
+        built = true;
+    }
+
+    // Buses driving u -> v, appended to out (indices into bus)
+    void lookup(StopID u, StopID v, vector<int> &out) const
+    {
+        uint64_t k = key(u, v);
+        vector<pair<uint64_t, int>>::const_iterator it = lower_bound(legs.begin(), legs.end(), make_pair(k, INT_MIN));
+        for (; it != legs.end() && it->first == k; ++it)
+            out.push_back(it->second);
+    }
+};
+
+// Outcome of rerouting the fleet around closed roads
+struct RerouteReport
+{
+    size_t closedEdges;   // directed edges blocked
+    size_t closedLegs;    // distinct route legs that used them
+    size_t affected;      // buses driving at least one closed leg
+    size_t rerouted;
+    vector<string> stranded; // no detour exists for one of their legs; left unchanged
+    double extraMinutes;  // detour cost over the closed legs, summed over rerouted buses
+    double searchSeconds, applySeconds;
+    RerouteReport() : closedEdges(0), closedLegs(0), affected(0), rerouted(0), extraMinutes(0), searchSeconds(0), applySeconds(0) {}
+};
+
+// Bus system
+void make_dir(const string &dir)
+{
+#ifdef _WIN32
+    _mkdir(dir.c_str());
+#else
+    mkdir(dir.c_str(), 0755);
+#endif
+}
+
+// Flush a stdio stream and force its data to disk
+bool sync_file(FILE *fp)
+{
+    if (fflush(fp) != 0)
+        return false;
+#ifndef _WIN32
+    return fsync(fileno(fp)) == 0;
+#else
+    return _commit(_fileno(fp)) == 0;
+#endif
+}
+
+// Make a rename inside dir durable (the directory entry itself must reach the disk)
+void sync_dir(const string &dir)
+{
+#ifndef _WIN32
+    int fd = open(dir.c_str(), O_RDONLY);
+    if (fd >= 0)
+    {
+        fsync(fd);
+        close(fd);
+    }
+#endif
+}
+
+// Append-only journal of network edits, one text record per line:
+// "<lsn>\t<fields...>\t<checksum>". Appends are buffered and fsynced as a group (every
+// syncBatch records, every syncInterval seconds, or on sync()), so a crash loses at most
+// the unsynced group. Recovery stops at the first torn or corrupt line and cuts it off.
+struct WriteAheadLog
+{
+    FILE *fp;
+    string path;
+    uint64_t nextLsn;
+    size_t bytes;   // valid bytes in the file
+    size_t pending; // records not yet fsynced
+    size_t syncBatch;
+    double syncInterval;
+    uint64_t syncs;
+    chrono::steady_clock::time_point lastSync;
+
+    WriteAheadLog() : fp(NULL), nextLsn(1), bytes(0), pending(0), syncBatch(256), syncInterval(0.05), syncs(0) {}
+    WriteAheadLog(const WriteAheadLog &) = delete;
+    WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+    ~WriteAheadLog() { close(); }
+
+    bool is_open() const { return fp != NULL; }
+
+    static string checksum(const string &body)
+    {
+        char tmp[20];
+        snprintf(tmp, sizeof(tmp), "%016llx", (unsigned long long)hash_name(body));
+        return tmp;
+    }
+
+    // Calls apply for each intact record with lsn > after, in order. lastLsn ends at the
+    // last intact record (or stays at after), validBytes where the intact prefix ends.
+    static size_t replay(const string &file, uint64_t after, const function<void(const vector<string> &)> &apply, uint64_t &lastLsn,
+                         size_t &validBytes)
+    {
+        lastLsn = after;
+        validBytes = 0;
+        ifstream in(file.c_str(), ios::binary);
+        string line;
+        size_t applied = 0;
+        uint64_t prev = 0;
+        // getline hitting EOF means the last line never got its newline: a torn write
+        while (getline(in, line) && !in.eof())
+        {
+            size_t tab = line.rfind('\t');
+            if (tab == string::npos || line.substr(tab + 1) != checksum(line.substr(0, tab)))
+                break;
+            vector<string> fields;
+            string cur;
+            stringstream ss(line.substr(0, tab));
+            while (getline(ss, cur, '\t'))
+                fields.push_back(cur);
+            if (fields.size() < 2)
+                break;
+            uint64_t lsn = strtoull(fields[0].c_str(), NULL, 10);
+            if (prev != 0 && lsn != prev + 1)
+                break;
+            prev = lsn;
+            validBytes += line.size() + 1;
+            if (lsn <= after)
+                continue;
+            fields.erase(fields.begin());
+            apply(fields);
+            lastLsn = lsn;
+            applied++;
+        }
+        return applied;
+    }
+
+    // Drop everything after the first len bytes
+    static bool cut(const string &file, size_t len)
+    {
+#ifndef _WIN32
+        return truncate(file.c_str(), (off_t)len) == 0;
+#else
+        string keep(len, '\0');
+        FILE *in = fopen(file.c_str(), "rb");
+        bool ok = in && (len == 0 || fread(&keep[0], 1, len, in) == len);
+        if (in)
+            fclose(in);
+        FILE *out = ok ? fopen(file.c_str(), "wb") : NULL;
+        ok = out && fwrite(keep.data(), 1, len, out) == len && sync_file(out);
+        if (out)
+            fclose(out);
+        return ok;
+#endif
+    }
+
+    // Append to file after its first validBytes; the next record gets lsn
+    bool open(const string &file, uint64_t lsn, size_t validBytes)
+    {
+        close();
+        struct stat st;
+        if (stat(file.c_str(), &st) == 0 && (size_t)st.st_size > validBytes && !cut(file, validBytes))
+            return false;
+        fp = fopen(file.c_str(), "ab");
+        if (!fp)
+            return false;
+        setvbuf(fp, NULL, _IOFBF, 1 << 16);
+        path = file;
+        nextLsn = lsn;
+        bytes = validBytes;
+        pending = 0;
+        lastSync = chrono::steady_clock::now();
+        return true;
+    }
+
+    uint64_t append(const string &record)
+    {
+        string body = to_string(nextLsn) + "\t" + record;
+        string line = body + "\t" + checksum(body) + "\n";
+        fwrite(line.data(), 1, line.size(), fp);
+        bytes += line.size();
+        pending++;
+        if (pending >= syncBatch || chrono::duration<double>(chrono::steady_clock::now() - lastSync).count() >= syncInterval)
+            sync();
+        return nextLsn++;
+    }
+
+    bool sync()
+    {
+        if (!fp || pending == 0)
+            return true;
+        bool ok = sync_file(fp);
+        pending = 0;
+        syncs++;
+        lastSync = chrono::steady_clock::now();
+        return ok;
+    }
+
+    // Empty the log after a snapshot took over its records; lsns keep counting up
+    bool reset()
+    {
+        if (!fp)
+            return false;
+        fclose(fp);
+        fp = fopen(path.c_str(), "wb");
+        if (!fp)
+            return false;
+        setvbuf(fp, NULL, _IOFBF, 1 << 16);
+        bytes = 0;
+        pending = 0;
+        return sync_file(fp);
+    }
+
+    void close()
+    {
+        if (!fp)
+            return;
+        sync();
+        fclose(fp);
+        fp = NULL;
+    }
+};
+
+struct BusSystem
+{
+    Graph g;
+    unordered_map<string, Bus> buses;
+    unordered_map<StopID, vector<string>> stopToBuses;
+    queue<string> history; // Event log of bus movements
+    size_t maxHistory;
+    Trie trie; // Prefix search for stop names
+    RouteCache routeCache; // Popular origin-destination answers
+    ContractionHierarchy ch; // Built lazily for isochrone sweeps
+    CompactGraph compact;    // CSR copy for the alternatives engine
+    SearchWorkspace workspace;
+    SnapshotStore network;   // published copies of g for readers on other threads
+    Timetable timetable;     // on-route ETAs and departure boards
+    HubLabels hubs;          // distance-only index, built offline (see --build-labels)
+    Connectivity conn;       // components for O(1) unreachable rejection, critical links
+    DistanceTable table;     // all-pairs minutes, memory-mapped (see --build-table)
+    RouteLegIndex legIndex;  // route leg -> buses, for closures
+    vector<SearchWorkspace> detourWorkspaces; // one per rerouting thread, kept between closures
+    vector<double> closurePenalty;            // per compact edge: scratch for the detour search (-1 skips an edge)
+    map<pair<StopID, StopID>, vector<double>> closedRoads; // u -> v: minutes of the edges taken out until reopened
+    WriteAheadLog wal;       // changes since the last snapshot (see open_store)
+    string storeDir;
+    uint64_t snapshotLsn;   // last logged change the snapshot includes
+    size_t snapshotBytes;
+    size_t compactMinBytes; // smallest log worth folding into a new snapshot
+    size_t unreadable;      // logged changes the last recovery could not parse (see the log)
+
+    BusSystem() : maxHistory(1000), snapshotLsn(0), snapshotBytes(0), compactMinBytes(1 << 20), unreadable(0) {}
+
+    // Publish g as one batch if it changed since the last publication (g itself belongs to
+    // the single writer thread; other threads read through network)
+    uint64_t publish_network()
+    {
+        {
+            SnapshotStore::Reader r(network);
+            if (r.serial() > 0 && r.graph().version == g.version && r.graph().names == g.names)
+                return r.serial();
+        }
+        return network.publish(g);
+    }
+
+    // Reload the network in the background; queries keep using the old snapshot until then
+    future<bool> load_network_async(const string &stopsFile, const string &edgesFile)
+    {
+        return network.load_async(stopsFile, edgesFile);
+    }
+
+    // Swap in a whole network (reload or recovery) together with its closed roads. Versions
+    // keep increasing so caches keyed by them never match the old graph.
+    void replace_network(const Graph &next, map<pair<StopID, StopID>, vector<double>> &closures)
+    {
+        uint64_t before = g.version;
+        g = next;
+        g.version = max(g.version, before + 1);
+        closedRoads.swap(closures);
+    }
+
+    // Make the latest published snapshot the writer's working graph; a network reloaded from
+    // files brings its own roads, so no closures carry over
+    void adopt_network()
+    {
+        map<pair<StopID, StopID>, vector<double>> none;
+        SnapshotStore::Reader r(network);
+        replace_network(r.graph(), none);
+    }
+
+    void rebuild_stop_index()
+    {
+        stopToBuses.clear();
+        for (auto it = buses.begin(); it != buses.end(); ++it)
+        {
+            const Bus &b = it->second;
+            if (b.route.empty())
+                continue;
+            StopID sid = b.current_stop();
+            if (sid >= 0)
+                stopToBuses[sid].push_back(it->first);
+        }
+    }
+
+    // Names and bus ids become tab-separated fields in the change log and the text files, so
+    // tabs and line breaks are refused up front rather than lost on the next recovery
+    static bool loggable(const string &s)
+    {
+        return s.find_first_of("\t\r\n") == string::npos;
+    }
+
+    bool add_stop_with_location(const string &name, double x, double y)
+    {
+        if (!loggable(name))
+            return false;
+        uint64_t before = g.version;
+        StopID id = g.add_stop(name, x, y);
+        conn.update(g, before, -1, -1, false);
+        trie.insert(name);
+        journal("S\t" + name + "\t" + fmt_double(x) + "\t" + fmt_double(y));
+        return id >= 0;
+    }
+
+    bool add_route_by_names(const string &a, const string &b, double minutes)
+    {
+        if (!loggable(a) || !loggable(b))
+            return false;
+        uint64_t before = g.version;
+        g.add_edge(a, b, minutes, true);
+        conn.update(g, before, g.get_id(a), g.get_id(b), true);
+        trie.insert(trim(a));
+        trie.insert(trim(b));
+        journal("E\t" + a + "\t" + b + "\t" + fmt_double(minutes));
+        return true;
+    }
+
+    bool add_bus(const string &busId, const vector<string> &routeNames, double speed = 40.0)
+    {
+        METRIC_LATENCY(MH_ADD_BUS);
+        if (!loggable(busId))
+            return false;
+        for (size_t i = 0; i < routeNames.size(); ++i)
+            if (!loggable(routeNames[i]))
+                return false;
+        uint64_t before = g.version;
+        vector<StopID> r;
+        for (size_t i = 0; i < routeNames.size(); ++i)
+        {
+            const string &nm = routeNames[i];
+            StopID id = g.get_id(nm);
+            if (id == (StopID)-1)
+            {
+                id = g.add_stop(nm);
+                trie.insert(nm);
+            }
+            r.push_back(id);
+        }
+        conn.update(g, before, -1, -1, false);
+        Bus bus(busId, r, speed);
+        buses[busId] = bus;
+        rebuild_stop_index();
+        routes_changed();
+        string rec = "B\t" + busId + "\t" + fmt_double(speed);
+        for (size_t i = 0; i < routeNames.size(); ++i)
+            rec += "\t" + routeNames[i];
+        journal(rec);
+        logger.log(string("Added bus: ") + busId + " with " + to_string(r.size()) + " stops");
+        return true;
+    }
+
+    bool move_bus_one_step(const string &busId)
+    {
+        METRIC_LATENCY(MH_MOVE_BUS);
+        if (!buses.count(busId))
+            return false;
+        Bus &bus = buses[busId];
+        StopID prev = bus.current_stop();
+        bool moved = bus.move_next();
+        journal("M\t" + busId);
+        StopID curr = bus.current_stop();
+        string entry = string("[") + current_time_str() + "] " + busId + " : " + g.get_name(prev) + " -> " + g.get_name(curr);
+        push_history(entry);
+        logger.log(entry);
+        rebuild_stop_index();
+        return moved;
+    }
+
+    void move_all_buses_one_step()
+    {
+        METRIC_LATENCY(MH_TICK);
+        journal("T");
+        for (auto it = buses.begin(); it != buses.end(); ++it)
+        {
+            Bus &bus = it->second;
+            StopID prev = bus.current_stop();
+            if (bus.active)
+            {
+                bool moved = bus.move_next();
+                StopID curr = bus.current_stop();
+                string entry = string("[") + current_time_str() + "] " + bus.busId + " : " + g.get_name(prev) + " -> " + g.get_name(curr);
+                push_history(entry);
+                logger.log(entry);
+            }
+        }
+        rebuild_stop_index();
+    }
+
+    // Buses heading for a stop with their on-route ETAs, soonest first
+    vector<BoardEntry> departure_board(NameView stopName, size_t limit = 0)
+    {
+        StopID id = g.get_id(stopName);
+        if (id == (StopID)-1)
+            return vector<BoardEntry>();
+        ensure_timetable();
+        return timetable.board(id, limit);
+    }
+
+    vector<string> buses_at_stop(const string &stopName)
+    {
+        StopID id = g.get_id(stopName);
+        vector<string> out;
+        if (id == (StopID)-1)
+            return out;
+        if (stopToBuses.count(id))
+            out = stopToBuses[id];
+        return out;
+    }
+
+    // Call after adding, removing or rerouting buses (moves along a route need nothing)
+    void routes_changed()
+    {
+        timetable.built = false;
+        legIndex.built = false;
+    }
+
+    void ensure_timetable()
+    {
+        if (timetable.stale(g))
+            timetable.build(g, buses);
+    }
+
+    // ETA between current bus location and some target stop: O(1) along the bus's own route
+    // when the stop is still ahead of it, otherwise Dijkstra from the current stop. Held buses
+    // (stranded by a closure) have no ETA.
+    double estimate_eta_for_bus(const string &busId, const string &targetStopName)
+    {
+        METRIC_LATENCY(MH_ETA_FOR_BUS);
+        unordered_map<string, Bus>::iterator it = buses.find(busId);
+        if (it == buses.end() || held(it->second))
+            return -1.0;
+        StopID target = g.get_id(targetStopName);
+        if (target == (StopID)-1)
+            return -1.0;
+        const Bus &bus = it->second;
+        StopID src = bus.current_stop();
+        if (src == (StopID)-1)
+            return -1.0;
+        ensure_timetable();
+        unordered_map<string, int>::const_iterator row = timetable.routeOfBus.find(busId);
+        if (row != timetable.routeOfBus.end())
+        {
+            double eta = timetable.eta_on_route(row->second, max(0, min(bus.currentIndex, (int)bus.route.size() - 1)), target);
+            if (eta >= 0)
+                return eta;
+        }
+        if (!conn.reachable(g, src, target))
+            return -1.0;
+        pair<vector<double>, vector<int>> res = dijkstra(g, src);
+        vector<double> dist = res.first;
+        if (dist[target] >= 1e17)
+            return -1.0;
+        return dist[target];
+    }
+
+    // estimate ETA between any two stops (names): one read from the all-pairs table or a
+    // hub-label lookup when either is loaded for the current graph, otherwise the cached
+    // Dijkstra answer (callers that need the stops along the way use shortest_path_names)
+    double estimate_eta_between(NameView a, NameView b)
+    {
+        bool useTable = !table.stale(g);
+        if (useTable || !hubs.stale(g))
+        {
+            StopID sa = g.get_id(a), sb = g.get_id(b);
+            if (sa == (StopID)-1 || sb == (StopID)-1 || !conn.reachable(g, sa, sb))
+                return -1.0;
+            double d = useTable ? table.distance(sa, sb) : hubs.distance(sa, sb);
+            return d >= 1e17 ? -1.0 : d;
+        }
+        return shortest_path_names(a, b).first;
+    }
+
+    // Write the all-pairs table for the current network to file and map it
+    bool build_distance_table(const string &file, bool withPred, int threads = 0, size_t *bufferBytes = NULL)
+    {
+        ensure_hierarchy();
+        table.close();
+        return DistanceTable::write(g, ch, file, withPred, threads > 0 ? threads : hardware_threads(), bufferBytes) && table.open(file, g);
+    }
+
+    bool load_distance_table(const string &file)
+    {
+        return table.open(file, g);
+    }
+
+    void build_hub_labels()
+    {
+        hubs.build(g);
+        logger.log(string("Built hub labels: ") + to_string(hubs.entries()) + " entries");
+    }
+
+    bool load_hub_labels(const string &file)
+    {
+        return hubs.load(file, g);
+    }
+
+    // find shortest path (Dijkstra) with names returned
+    pair<double, vector<NameView>> shortest_path_names(NameView a, NameView b)
+    {
+        METRIC_LATENCY(MH_SHORTEST_PATH);
+        vector<NameView> emptyRes;
+        StopID sa = g.get_id(a);
+        StopID sb = g.get_id(b);
+        if (sa == (StopID)-1 || sb == (StopID)-1 || !conn.reachable(g, sa, sb))
+            return make_pair(-1.0, emptyRes);
+        RouteCache::Key key = {'D', sa, sb, g.version};
+        pair<double, vector<NameView>> cached;
+        if (routeCache.lookup(key, cached))
+            return cached;
+        pair<vector<double>, vector<int>> res = dijkstra(g, sa);
+        vector<double> dist = res.first;
+        vector<int> prev = res.second;
+        pair<double, vector<NameView>> out(-1.0, emptyRes);
+        if (dist[sb] <= 1e17)
+        {
+            vector<StopID> path = reconstruct_path(prev, sb);
+            out.first = dist[sb];
+            for (size_t i = 0; i < path.size(); ++i)
+                out.second.push_back(g.get_name(path[i]));
+        }
+        routeCache.insert(key, out);
+        return out;
+    }
+
+    // A* path (uses locations)
+    pair<double, vector<NameView>> astar_names(NameView a, NameView b)
+    {
+        METRIC_LATENCY(MH_ASTAR);
+        vector<NameView> emptyRes;
+        StopID sa = g.get_id(a), sb = g.get_id(b);
+        if (sa == (StopID)-1 || sb == (StopID)-1 || !conn.reachable(g, sa, sb))
+            return make_pair(-1.0, emptyRes);
+        RouteCache::Key key = {'A', sa, sb, g.version};
+        pair<double, vector<NameView>> cached;
+        if (routeCache.lookup(key, cached))
+            return cached;
+        AStarResult res = astar(g, sa, sb);
+        pair<double, vector<NameView>> out(-1.0, emptyRes);
+        if (res.found)
+        {
+            out.first = res.cost;
+            for (size_t i = 0; i < res.path.size(); ++i)
+                out.second.push_back(g.get_name(res.path[i]));
+        }
+        routeCache.insert(key, out);
+        return out;
+    }
+
+    // MST (minimum spanning forest, covers every component)
+    pair<double, vector<pair<NameView, NameView>>> mst_names()
+    {
+        METRIC_LATENCY(MH_MST);
+        SpanningForest f = minimum_spanning_forest(g);
+        vector<pair<NameView, NameView>> out;
+        for (size_t i = 0; i < f.edges.size(); ++i)
+        {
+            out.push_back(make_pair(g.get_name(f.edges[i].u), g.get_name(f.edges[i].v)));
+        }
+        return make_pair(f.total, out);
+    }
+
+    // Component counts and the links whose closure would split the network, biggest cut first
+    void print_critical_links(ostream &os, size_t top)
+    {
+        conn.ensure(g);
+        conn.ensure_cuts(g);
+        os << g.size() << " stops: " << conn.components << " components, " << conn.sccCount << " strongly connected, " << conn.biconnected
+           << " biconnected, " << conn.articulation.size() << " articulation stops, " << conn.bridges.size() << " critical links\n";
+        for (size_t i = 0; i < conn.bridges.size() && i < top; ++i)
+            os << "  " << g.get_name(conn.bridges[i].u) << " - " << g.get_name(conn.bridges[i].v) << " (cuts off " << conn.bridges[i].cutOff
+               << " stops)\n";
+    }
+
+    void ensure_compact()
+    {
+        if (compact.stale(g))
+            compact.build(g);
+    }
+
+    // Reroute every bus whose route drives a closed road. closed lists stop pairs, closed both
+    // ways unless oneWay. Each distinct closed leg gets one detour (a bidirectional search that
+    // skips the closed edges; legs are spread across threads with a kept workspace each). Buses
+    // then splice the detours in parallel, and all new routes are applied in one step: one
+    // rebuild of the stop index and timetable, one log record. Buses stay at the stop they are
+    // at, and the stops they serve stay in order. The roads then leave the network until
+    // reopen_roads, so every later query, ETA and new bus avoids them too. Buses with no
+    // detour are held (stopped where they are) until their roads reopen.
+    RerouteReport close_roads(const vector<pair<StopID, StopID>> &closed, bool oneWay = false, int threads = 0)
+    {
+        RerouteReport rep;
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        if (threads <= 0)
+            threads = hardware_threads();
+        ensure_compact();
+        if (!legIndex.built)
+            legIndex.build(buses);
+        if (closurePenalty.size() != compact.edges())
+            closurePenalty.assign(compact.edges(), 1.0);
+        vector<int> blocked;
+        vector<uint64_t> keys;
+        for (size_t i = 0; i < closed.size(); ++i)
+        {
+            for (int dir = 0; dir < (oneWay ? 1 : 2); ++dir)
+            {
+                StopID u = dir ? closed[i].second : closed[i].first, v = dir ? closed[i].first : closed[i].second;
+                if (u < 0 || v < 0 || u >= (StopID)compact.n || v >= (StopID)compact.n)
+                    continue;
+                for (int e = compact.start[u]; e < compact.start[u + 1]; ++e)
+                {
+                    if (compact.to[e] != v)
+                        continue;
+                    if (closurePenalty[e] >= 0)
+                        blocked.push_back(e);
+                    closurePenalty[e] = -1;
+                    keys.push_back(RouteLegIndex::key(u, v));
+                }
+            }
+        }
+        sort(keys.begin(), keys.end());
+        keys.erase(unique(keys.begin(), keys.end()), keys.end());
+        rep.closedEdges = blocked.size();
+        // Closed legs some bus drives, and those buses
+        vector<uint64_t> legs;
+        vector<int> hit;
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            size_t before = hit.size();
+            legIndex.lookup((StopID)(keys[i] >> 32), (StopID)(uint32_t)keys[i], hit);
+            if (hit.size() > before)
+                legs.push_back(keys[i]);
+        }
+        sort(hit.begin(), hit.end());
+        hit.erase(unique(hit.begin(), hit.end()), hit.end());
+        rep.closedLegs = legs.size();
+        rep.affected = hit.size();
+
+        // One detour per closed leg: the stops strictly between its ends
+        vector<vector<StopID>> detour(legs.size());
+        vector<char> found(legs.size(), 0);
+        vector<double> extra(legs.size(), 0.0);
+        if (detourWorkspaces.size() < (size_t)threads)
+            detourWorkspaces.resize(threads);
+        parallel_for(legs.size(), threads, [&](size_t begin, size_t end, int tid)
+                     {
+                         for (size_t i = begin; i < end; ++i)
+                         {
+                             StopID u = (StopID)(legs[i] >> 32), v = (StopID)(uint32_t)legs[i];
+                             double cost = -1, direct = 1e18;
+                             vector<int> path = bidirectional_search(compact, detourWorkspaces[tid], u, v, closurePenalty, cost);
+                             if (path.empty())
+                                 continue;
+                             for (size_t j = 0; j + 1 < path.size(); ++j)
+                                 detour[i].push_back(compact.to[path[j]]);
+                             for (int e = compact.start[u]; e < compact.start[u + 1]; ++e)
+                                 if (compact.to[e] == v)
+                                     direct = min(direct, compact.w[e]);
+                             found[i] = 1;
+                             extra[i] = direct < 1e18 ? cost - direct : 0.0;
+                         }
+                     });
+        for (size_t i = 0; i < blocked.size(); ++i)
+            closurePenalty[blocked[i]] = 1.0;
+
+        // Splice the detours into every affected route
+        vector<vector<StopID>> route(hit.size());
+        vector<int> index(hit.size(), 0);
+        vector<double> added(hit.size(), 0.0);
+        vector<char> stranded(hit.size(), 0);
+        parallel_for(hit.size(), threads, [&](size_t begin, size_t end, int)
+                     {
+                         for (size_t i = begin; i < end; ++i)
+                         {
+                             const Bus &bus = *legIndex.bus[hit[i]];
+                             const vector<StopID> &r = bus.route;
+                             int at = max(0, min(bus.currentIndex, (int)r.size() - 1));
+                             vector<StopID> &out = route[i];
+                             out.push_back(r[0]);
+                             for (size_t j = 1; j < r.size() && !stranded[i]; ++j)
+                             {
+                                 uint64_t k = RouteLegIndex::key(r[j - 1], r[j]);
+                                 vector<uint64_t>::const_iterator li = lower_bound(legs.begin(), legs.end(), k);
+                                 if (li != legs.end() && *li == k)
+                                 {
+                                     size_t l = li - legs.begin();
+                                     stranded[i] = !found[l];
+                                     out.insert(out.end(), detour[l].begin(), detour[l].end());
+                                     added[i] += extra[l];
+                                 }
+                                 if ((int)j == at)
+                                     index[i] = (int)out.size();
+                                 out.push_back(r[j]);
+                             }
+                         }
+                     });
+        rep.searchSeconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+
+        // Apply every new route at once
+        t0 = chrono::steady_clock::now();
+        string rec, roads, held;
+        size_t named = 0;
+        for (size_t i = 0; i < closed.size(); ++i)
+        {
+            if (g.get_name(closed[i].first).empty() || g.get_name(closed[i].second).empty())
+                continue;
+            roads += "\t" + g.get_name(closed[i].first) + "\t" + g.get_name(closed[i].second);
+            named++;
+        }
+        rep.closedEdges = remove_roads(closed, oneWay);
+        for (size_t i = 0; i < hit.size(); ++i)
+        {
+            Bus &bus = *legIndex.bus[hit[i]];
+            if (stranded[i])
+            {
+                bus.active = false;
+                rep.stranded.push_back(bus.busId);
+                held += "\t" + bus.busId;
+                continue;
+            }
+            bus.route.swap(route[i]);
+            bus.currentIndex = index[i];
+            rep.rerouted++;
+            rep.extraMinutes += added[i];
+            if (wal.is_open())
+            {
+                rec += "\t" + bus.busId + "\t" + to_string(index[i]) + "\t" + to_string(bus.route.size());
+                for (size_t j = 0; j < bus.route.size(); ++j)
+                    rec += "\t" + g.get_name(bus.route[j]);
+            }
+        }
+        if (rep.rerouted > 0)
+        {
+            rebuild_stop_index();
+            routes_changed();
+        }
+        // Closure, reroutes and held buses in one record: one-way flag, roads, reroutes as in
+        // R records, then the held bus ids
+        if (rep.closedEdges > 0 || rep.rerouted > 0 || !rep.stranded.empty())
+            journal("C\t" + string(oneWay ? "1" : "0") + "\t" + to_string(named) + roads + "\t" + to_string(rep.rerouted) + rec + "\t" +
+                    to_string(rep.stranded.size()) + held);
+        sort(rep.stranded.begin(), rep.stranded.end());
+        rep.applySeconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+        logger.log(string("Closed ") + to_string(rep.closedEdges) + " edges: rerouted " + to_string(rep.rerouted) + " buses, held " +
+                   to_string(rep.stranded.size()) + " without a detour");
+        return rep;
+    }
+
+    // Take roads out of g, keeping their minutes for reopen_roads; returns the edges removed
+    size_t remove_roads(const vector<pair<StopID, StopID>> &roads, bool oneWay)
+    {
+        size_t removed = 0;
+        for (size_t i = 0; i < roads.size(); ++i)
+        {
+            for (int dir = 0; dir < (oneWay ? 1 : 2); ++dir)
+            {
+                StopID u = dir ? roads[i].second : roads[i].first, v = dir ? roads[i].first : roads[i].second;
+                vector<double> w = g.remove_edges(u, v);
+                if (w.empty())
+                    continue;
+                vector<double> &kept = closedRoads[make_pair(u, v)];
+                kept.insert(kept.end(), w.begin(), w.end());
+                removed += w.size();
+            }
+        }
+        return removed;
+    }
+
+    // Put closed roads back with their old travel times; returns the edges restored. Buses
+    // rerouted around them keep their detours; held buses with no closed road left on their
+    // route run again (counted in released).
+    size_t reopen_roads(const vector<pair<StopID, StopID>> &roads, bool oneWay = false, size_t *released = NULL)
+    {
+        size_t restored = 0, named = 0;
+        string rec;
+        for (size_t i = 0; i < roads.size(); ++i)
+        {
+            for (int dir = 0; dir < (oneWay ? 1 : 2); ++dir)
+            {
+                StopID u = dir ? roads[i].second : roads[i].first, v = dir ? roads[i].first : roads[i].second;
+                map<pair<StopID, StopID>, vector<double>>::iterator it = closedRoads.find(make_pair(u, v));
+                if (it == closedRoads.end())
+                    continue;
+                for (size_t j = 0; j < it->second.size(); ++j)
+                {
+                    uint64_t before = g.version;
+                    g.add_edge(u, v, it->second[j], false);
+                    conn.update(g, before, u, v, false);
+                }
+                restored += it->second.size();
+                closedRoads.erase(it);
+            }
+            if (!g.get_name(roads[i].first).empty() && !g.get_name(roads[i].second).empty())
+            {
+                rec += "\t" + g.get_name(roads[i].first) + "\t" + g.get_name(roads[i].second);
+                named++;
+            }
+        }
+        size_t freed = restored > 0 ? release_held_buses() : 0;
+        if (released)
+            *released = freed;
+        if (restored > 0)
+        {
+            journal("O\t" + string(oneWay ? "1" : "0") + "\t" + to_string(named) + rec);
+            logger.log(string("Reopened ") + to_string(restored) + " edges, released " + to_string(freed) + " held buses");
+        }
+        return restored;
+    }
+
+    // Buses stop mid-route only when a closure strands them (see close_roads)
+    static bool held(const Bus &b)
+    {
+        return !b.active && b.currentIndex + 1 < (int)b.route.size();
+    }
+
+    // Restart held buses whose routes no longer drive a closed road
+    size_t release_held_buses()
+    {
+        size_t freed = 0;
+        for (auto it = buses.begin(); it != buses.end(); ++it)
+        {
+            Bus &b = it->second;
+            if (!held(b))
+                continue;
+            bool clear = true;
+            for (size_t i = 1; clear && i < b.route.size(); ++i)
+                clear = !closedRoads.count(make_pair(b.route[i - 1], b.route[i]));
+            if (clear)
+            {
+                b.active = true;
+                freed++;
+            }
+        }
+        return freed;
+    }
+
+    // Up to k meaningfully different routes, best first
+    vector<pair<double, vector<NameView>>> alternative_routes_names(NameView a, NameView b, int k = 3)
+    {
+        METRIC_LATENCY(MH_ALTERNATIVES);
+        vector<pair<double, vector<NameView>>> out;
+        StopID sa = g.get_id(a), sb = g.get_id(b);
+        if (sa == (StopID)-1 || sb == (StopID)-1)
+            return out;
+        ensure_compact();
+        vector<AlternativeRoute> routes = k_alternative_routes(compact, workspace, sa, sb, k);
+        for (size_t i = 0; i < routes.size(); ++i)
+        {
+            vector<NameView> names;
+            for (size_t j = 0; j < routes[i].path.size(); ++j)
+                names.push_back(g.get_name(routes[i].path[j]));
+            out.push_back(make_pair(routes[i].cost, names));
+        }
+        return out;
+    }
+
+    // Rebuild the hierarchy after the network changed
+    void ensure_hierarchy()
+    {
+        if (ch.stale(g))
+        {
+            ch.build(g);
+            logger.log(string("Built contraction hierarchy: ") + to_string(ch.shortcuts) + " shortcuts");
+        }
+    }
+
+    // Stops reachable from origin within budget minutes (PHAST sweep)
+    Isochrone isochrone(const string &origin, double budget, bool withBoundary = false)
+    {
+        vector<Isochrone> res = isochrones(vector<string>(1, origin), budget, withBoundary);
+        return res[0];
+    }
+
+    // Isochrones for many origins, swept BATCH sources at a time
+    vector<Isochrone> isochrones(const vector<string> &origins, double budget, bool withBoundary = false)
+    {
+        METRIC_LATENCY(MH_ISOCHRONE);
+        ensure_hierarchy();
+        vector<Isochrone> out(origins.size());
+        for (size_t b = 0; b < origins.size(); b += ContractionHierarchy::BATCH)
+        {
+            vector<StopID> src;
+            for (size_t i = b; i < origins.size() && i < b + ContractionHierarchy::BATCH; ++i)
+                src.push_back(g.get_id(origins[i]));
+            vector<vector<double>> dist;
+            ch.one_to_all_batch(src, dist);
+            for (size_t k = 0; k < src.size(); ++k)
+            {
+                if (src[k] == (StopID)-1)
+                {
+                    out[b + k].origin = -1;
+                    out[b + k].budget = budget;
+                    continue;
+                }
+                out[b + k] = make_isochrone(g, src[k], budget, dist[k], withBoundary);
+            }
+        }
+        return out;
+    }
+
+    // persistence for buses
+    bool save_buses(const string &file)
+    {
+        ofstream ofs(file.c_str());
+        if (!ofs)
+            return false;
+        for (auto it = buses.begin(); it != buses.end(); ++it)
+        {
+            // Text files carry external stop ids, like save_to
+            Bus b = it->second;
+            for (size_t i = 0; i < b.route.size(); ++i)
+                b.route[i] = g.external_id(b.route[i]);
+            ofs << b.serialize() << "\n";
+        }
+        ofs.close();
+        logger.log(string("Saved buses to ") + file);
+        return true;
+    }
+
+    bool load_buses(const string &file)
+    {
+        ifstream ifs(file.c_str());
+        if (!ifs)
+            return false;
+        buses.clear();
+        string line;
+        while (getline(ifs, line))
+        {
+            if (trim(line).empty())
+                continue;
+            Bus b = Bus::deserialize(line);
+            for (size_t i = 0; i < b.route.size(); ++i)
+                if (g.internal_id(b.route[i]) >= 0)
+                    b.route[i] = g.internal_id(b.route[i]);
+            if (!b.busId.empty())
+                buses[b.busId] = b;
+        }
+        ifs.close();
+        rebuild_stop_index();
+        routes_changed();
+        logger.log(string("Loaded buses from ") + file);
+        return true;
+    }
+
+    // Durable store: a snapshot plus a write-ahead log of every change made since it
+    void journal(const string &record)
+    {
+        if (wal.is_open())
+            wal.append(record);
+    }
+
+    // Replay one logged change (the log is closed meanwhile). Network edits go through the
+    // methods that made them; bus changes skip the history, stop index and timetable, which
+    // the caller rebuilds once at the end. False for a record it cannot parse.
+    bool apply_change(const vector<string> &f)
+    {
+        if (f[0] == "S" && f.size() == 4)
+            add_stop_with_location(f[1], atof(f[2].c_str()), atof(f[3].c_str()));
+        else if (f[0] == "E" && f.size() == 4)
+            add_route_by_names(f[1], f[2], atof(f[3].c_str()));
+        else if (f[0] == "B" && f.size() >= 3)
+        {
+            vector<StopID> r;
+            for (size_t i = 3; i < f.size(); ++i)
+            {
+                StopID id = g.get_id(f[i]);
+                if (id == (StopID)-1)
+                {
+                    id = g.add_stop(f[i]);
+                    trie.insert(f[i]);
+                }
+                r.push_back(id);
+            }
+            buses[f[1]] = Bus(f[1], r, atof(f[2].c_str()));
+        }
+        else if (f[0] == "M" && f.size() == 2)
+        {
+            unordered_map<string, Bus>::iterator it = buses.find(f[1]);
+            if (it != buses.end())
+                it->second.move_next();
+        }
+        else if (f[0] == "T")
+        {
+            for (auto it = buses.begin(); it != buses.end(); ++it)
+                it->second.move_next();
+        }
+        else if (f[0] == "R" && f.size() >= 2)
+            apply_reroutes(f, 1);
+        else if ((f[0] == "C" || f[0] == "O") && f.size() >= 3)
+        {
+            // One-way flag, road count, stop name pairs; closures then carry their reroutes
+            vector<pair<StopID, StopID>> roads;
+            size_t at = 3;
+            for (int k = atoi(f[2].c_str()); k > 0 && at + 2 <= f.size(); --k, at += 2)
+                roads.push_back(make_pair(g.get_id(f[at]), g.get_id(f[at + 1])));
+            bool oneWay = f[1] == "1";
+            if (f[0] == "O")
+                reopen_roads(roads, oneWay);
+            else
+            {
+                remove_roads(roads, oneWay);
+                at = at < f.size() ? apply_reroutes(f, at) : at;
+                for (int k = at < f.size() ? atoi(f[at++].c_str()) : 0; k > 0 && at < f.size(); --k, ++at)
+                {
+                    unordered_map<string, Bus>::iterator it = buses.find(f[at]);
+                    if (it != buses.end())
+                        it->second.active = false;
+                }
+            }
+        }
+        else if (f[0] == "P" && f.size() == 3)
+        {
+            unordered_map<string, Bus>::iterator it = buses.find(f[1]);
+            int idx = atoi(f[2].c_str());
+            if (it != buses.end() && idx >= 0 && idx < (int)it->second.route.size())
+                it->second.currentIndex = idx;
+        }
+        else
+            return false;
+        return true;
+    }
+
+    // apply_change during recovery: a record it cannot parse is logged and counted, not dropped silently
+    void replay_change(const vector<string> &f)
+    {
+        if (apply_change(f))
+            return;
+        string rec;
+        for (size_t i = 0; i < f.size(); ++i)
+            rec += (i ? " | " : "") + f[i];
+        logger.log("Skipped unreadable logged change: " + rec);
+        unreadable++;
+    }
+
+    // Rerouted buses from f[at] on: count, then per bus id, stop index, stop count, stop names.
+    // Returns the index of the first field after them.
+    size_t apply_reroutes(const vector<string> &f, size_t at)
+    {
+        int count = atoi(f[at].c_str());
+        at++;
+        for (int k = count; k > 0 && at + 3 <= f.size(); --k)
+        {
+            unordered_map<string, Bus>::iterator it = buses.find(f[at]);
+            int idx = atoi(f[at + 1].c_str());
+            size_t len = (size_t)atol(f[at + 2].c_str());
+            at += 3;
+            if (at + len > f.size())
+                return f.size();
+            vector<StopID> r;
+            for (size_t i = 0; i < len; ++i)
+                r.push_back(g.get_id(f[at + i]));
+            at += len;
+            if (it != buses.end() && find(r.begin(), r.end(), (StopID)-1) == r.end() && idx >= 0 && idx < (int)r.size())
+            {
+                it->second.route = r;
+                it->second.currentIndex = idx;
+            }
+        }
+        return at;
+    }
+
+    // Graph, fleet and the lsn of the last change they include. Written to a temporary file and
+    // renamed over the old snapshot, so a crash leaves either the old or the new one intact.
+    bool write_snapshot(const string &file, uint64_t lsn)
+    {
+        string tmp = file + ".tmp";
+        FILE *fp = fopen(tmp.c_str(), "wb");
+        if (!fp)
+            return false;
+        const char magic[4] = {'S', 'C', 'R', 'S'};
+        uint32_t fmt = 3;
+        uint64_t count = buses.size();
+        fwrite(magic, 1, 4, fp);
+        fwrite(&fmt, sizeof(fmt), 1, fp);
+        fwrite(&lsn, sizeof(lsn), 1, fp);
+        bool ok = g.write_binary(fp);
+        fwrite(&count, sizeof(count), 1, fp);
+        for (auto it = buses.begin(); it != buses.end(); ++it)
+        {
+            string rec = it->second.serialize();
+            uint32_t len = (uint32_t)rec.size();
+            uint8_t active = it->second.active ? 1 : 0;
+            fwrite(&len, sizeof(len), 1, fp);
+            fwrite(rec.data(), 1, len, fp);
+            fwrite(&active, sizeof(active), 1, fp);
+        }
+        // Format 2: external id of every stop (none while ids were never renumbered)
+        uint64_t mapped = g.extOf.size();
+        fwrite(&mapped, sizeof(mapped), 1, fp);
+        if (mapped)
+            fwrite(&g.extOf[0], sizeof(StopID), mapped, fp);
+        // Format 3: closed roads (internal ids) and the minutes of the edges they took out
+        uint64_t closures = closedRoads.size();
+        fwrite(&closures, sizeof(closures), 1, fp);
+        for (map<pair<StopID, StopID>, vector<double>>::const_iterator it = closedRoads.begin(); it != closedRoads.end(); ++it)
+        {
+            uint32_t k = (uint32_t)it->second.size();
+            fwrite(&it->first.first, sizeof(StopID), 1, fp);
+            fwrite(&it->first.second, sizeof(StopID), 1, fp);
+            fwrite(&k, sizeof(k), 1, fp);
+            fwrite(&it->second[0], sizeof(double), k, fp);
+        }
+        ok = ok && !ferror(fp) && sync_file(fp);
+        long size = ftell(fp);
+        fclose(fp);
+#ifdef _WIN32
+        if (ok)
+            remove(file.c_str()); // rename does not replace on Windows
+#endif
+        if (!ok || rename(tmp.c_str(), file.c_str()) != 0)
+        {
+            remove(tmp.c_str());
+            return false;
+        }
+        size_t slash = file.rfind('/');
+        sync_dir(slash == string::npos ? string(".") : file.substr(0, slash));
+        snapshotBytes = (size_t)size;
+        logger.log(string("Wrote snapshot ") + file + " at lsn " + to_string(lsn));
+        return true;
+    }
+
+    bool read_snapshot(const string &file, uint64_t &lsn)
+    {
+        FILE *fp = fopen(file.c_str(), "rb");
+        if (!fp)
+            return false;
+        char magic[4];
+        uint32_t fmt = 0;
+        uint64_t count = 0;
+        Graph fresh;
+        bool ok = fread(magic, 1, 4, fp) == 4 && memcmp(magic, "SCRS", 4) == 0 && fread(&fmt, sizeof(fmt), 1, fp) == 1 && fmt >= 1 && fmt <= 3 &&
+                  fread(&lsn, sizeof(lsn), 1, fp) == 1 && fresh.read_binary(fp) && fread(&count, sizeof(count), 1, fp) == 1;
+        unordered_map<string, Bus> fleet;
+        string rec;
+        for (uint64_t i = 0; i < count && ok; ++i)
+        {
+            uint32_t len = 0;
+            uint8_t active = 0;
+            ok = fread(&len, sizeof(len), 1, fp) == 1;
+            rec.resize(ok ? len : 0);
+            ok = ok && (len == 0 || fread(&rec[0], 1, len, fp) == len) && fread(&active, sizeof(active), 1, fp) == 1;
+            Bus b = Bus::deserialize(rec);
+            b.active = active != 0;
+            ok = ok && !b.busId.empty();
+            fleet[b.busId] = b;
+        }
+        uint64_t mapped = 0;
+        if (ok && fmt >= 2)
+        {
+            ok = fread(&mapped, sizeof(mapped), 1, fp) == 1 && (mapped == 0 || mapped == fresh.size());
+            fresh.extOf.resize(ok ? mapped : 0);
+            ok = ok && (mapped == 0 || fread(&fresh.extOf[0], sizeof(StopID), mapped, fp) == mapped);
+            fresh.intOf.assign(ok ? mapped : 0, -1);
+            for (size_t v = 0; ok && v < mapped; ++v)
+            {
+                StopID e = fresh.extOf[v];
+                ok = e >= 0 && e < (StopID)mapped && fresh.intOf[e] == -1;
+                if (ok)
+                    fresh.intOf[e] = (StopID)v;
+            }
+        }
+        map<pair<StopID, StopID>, vector<double>> closures;
+        uint64_t closedCount = 0;
+        if (ok && fmt >= 3)
+            ok = fread(&closedCount, sizeof(closedCount), 1, fp) == 1;
+        for (uint64_t i = 0; i < closedCount && ok; ++i)
+        {
+            StopID u = -1, v = -1;
+            uint32_t k = 0;
+            ok = fread(&u, sizeof(u), 1, fp) == 1 && fread(&v, sizeof(v), 1, fp) == 1 && fread(&k, sizeof(k), 1, fp) == 1 && u >= 0 &&
+                 v >= 0 && u < (StopID)fresh.size() && v < (StopID)fresh.size() && k > 0 && k < (1u << 20);
+            vector<double> &w = closures[make_pair(u, v)];
+            w.resize(ok ? k : 0);
+            ok = ok && fread(&w[0], sizeof(double), k, fp) == k;
+        }
+        long size = ftell(fp);
+        fclose(fp);
+        if (!ok)
+            return false;
+        replace_network(fresh, closures);
+        buses.swap(fleet);
+        trie = Trie();
+        for (size_t i = 0; i < g.size(); ++i)
+            trie.insert(g.get_name((StopID)i));
+        rebuild_stop_index();
+        routes_changed();
+        snapshotBytes = (size_t)size;
+        return true;
+    }
+
+    // Recover from dir/network.snap plus dir/network.wal, then log every later change there.
+    // Without a snapshot the current state becomes the first one.
+    bool open_store(const string &dir, size_t *replayed = NULL)
+    {
+        wal.close();
+        storeDir = dir;
+        make_dir(dir);
+        string snap = dir + "/network.snap", log = dir + "/network.wal";
+        uint64_t lsn = 0, last = 0;
+        size_t valid = 0, count = 0;
+        ifstream probe(snap.c_str());
+        if (probe)
+        {
+            // An unreadable snapshot is left alone rather than overwritten
+            if (!read_snapshot(snap, lsn))
+                return false;
+            unreadable = 0;
+            count = WriteAheadLog::replay(log, lsn, [this](const vector<string> &f) { replay_change(f); }, last, valid);
+            rebuild_stop_index();
+            routes_changed();
+        }
+        else if (!write_snapshot(snap, 0))
+            return false;
+        snapshotLsn = lsn;
+        // A log without a snapshot has nothing to apply to; open() cuts it to the valid prefix
+        if (!wal.open(log, max(lsn, last) + 1, valid))
+            return false;
+        if (replayed)
+            *replayed = count;
+        logger.log(string("Opened store ") + dir + ": snapshot lsn " + to_string(lsn) + ", replayed " + to_string(count) + " changes");
+        return true;
+    }
+
+    // Make logged changes durable: O(changes since the last call). The snapshot is rewritten
+    // only once the log has grown past it.
+    bool save_changes()
+    {
+        if (!wal.is_open())
+            return false;
+        bool ok = wal.sync();
+        if (wal.bytes > max(compactMinBytes, snapshotBytes))
+            ok = compact_store() && ok;
+        return ok;
+    }
+
+    // Fold the log into a new snapshot. A crash between the rename and the log reset is
+    // harmless: replay skips records the snapshot already includes.
+    bool compact_store()
+    {
+        if (!wal.is_open() || !wal.sync())
+            return false;
+        uint64_t lsn = wal.nextLsn - 1;
+        if (!write_snapshot(storeDir + "/network.snap", lsn))
+            return false;
+        snapshotLsn = lsn;
+        return wal.reset();
+    }
+
+    // Renumber stops for memory locality; names and external ids are unchanged, so callers
+    // (CLI, text files, the change log) never see the new numbering
+    void renumber_stops(StopOrder order)
+    {
+        vector<StopID> newOf = locality_order(g, order);
+        g.permute(newOf);
+        for (auto it = buses.begin(); it != buses.end(); ++it)
+            for (size_t i = 0; i < it->second.route.size(); ++i)
+                if (it->second.route[i] >= 0 && it->second.route[i] < (StopID)newOf.size())
+                    it->second.route[i] = newOf[it->second.route[i]];
+        map<pair<StopID, StopID>, vector<double>> closures;
+        for (map<pair<StopID, StopID>, vector<double>>::iterator it = closedRoads.begin(); it != closedRoads.end(); ++it)
+            closures[make_pair(newOf[it->first.first], newOf[it->first.second])].swap(it->second);
+        closedRoads.swap(closures);
+        rebuild_stop_index();
+        routes_changed();
+        // The snapshot holds internal ids, so rewrite it in the new layout
+        if (wal.is_open())
+            compact_store();
+        logger.log(string("Renumbered stops in ") + STOP_ORDER_NAMES[order] + " order");
+    }
+
+    // basic history push (bounded)
+    void push_history(const string &s)
+    {
+        history.push(s);
+        if (history.size() > maxHistory)
+            history.pop();
+    }
+
+    void print_history(size_t n = 20)
+    {
+        vector<string> items;
+        queue<string> tmp = history;
+        while (!tmp.empty())
+        {
+            items.push_back(tmp.front());
+            tmp.pop();
+        }
+        cout << "---- Movement History (recent first) ----\n";
+        for (int i = (int)items.size() - 1, c = 0; i >= 0 && c < (int)n; --i, ++c)
+        {
+            cout << items[i] << "\n";
+        }
+        cout << "-----------------------------------------\n";
+    }
+
+    string current_time_str() const
+    {
+        time_t t = time(nullptr);
+        char buf[64];
+        strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime(&t));
+        return string(buf);
+    }
+
+    // Suggest stops by prefix
+    vector<string> suggest_stops(const string &prefix)
+    {
+        return trie.suggest(prefix);
+    }
+
+    // Prometheus text: engine metrics plus route cache counters
+    string metrics_text()
+    {
+        stringstream ss;
+        ss << metrics_prometheus();
+        ss << "# TYPE scr_route_cache_hits_total counter\nscr_route_cache_hits_total " << routeCache.hits << "\n";
+        ss << "# TYPE scr_route_cache_misses_total counter\nscr_route_cache_misses_total " << routeCache.misses << "\n";
+        ss << "# TYPE scr_route_cache_evictions_total counter\nscr_route_cache_evictions_total " << routeCache.evictions << "\n";
+        ss << "# TYPE scr_stops gauge\nscr_stops " << g.size() << "\n";
+        ss << "# TYPE scr_buses gauge\nscr_buses " << buses.size() << "\n";
+        return ss.str();
+    }
+
+    // display system summary
+    void print_summary()
+    {
+        cout << "===== Bus System Summary =====\n";
+        cout << "Stops : " << g.size() << "\n";
+        cout << "Buses : " << buses.size() << "\n";
+        cout << "Route cache: " << routeCache.stats() << "\n";
+        cout << "Recent Logs (top 5):\n";
+        logger.print_recent(5);
+        cout << "==============================\n";
+    }
+};
+
+// GPS ping ingestion with HMM map matching
+// A ping is one position report: "busId timestamp x y" per line (tab or space separated)
+struct GpsPing
+{
+    string busId;
+    double t; // seconds
+    Point pos;
+};
+
+// Parse one ping line without going through stringstream (hot path)
+bool parse_ping_line(const char *line, GpsPing &out)
+{
+    const char *p = line;
+    while (*p == ' ' || *p == '\t')
+        p++;
+    if (*p == '\0' || *p == '\n' || *p == '\r' || *p == '#')
+        return false;
+    const char *idEnd = p;
+    while (*idEnd && *idEnd != ' ' && *idEnd != '\t' && *idEnd != '\n' && *idEnd != '\r')
+        idEnd++;
+    out.busId.assign(p, idEnd - p);
+    char *next = NULL;
+    out.t = strtod(idEnd, &next);
+    if (next == idEnd)
+        return false;
+    const char *q = next;
+    out.pos.x = strtod(q, &next);
+    if (next == q)
+        return false;
+    q = next;
+    out.pos.y = strtod(q, &next);
+    return next != q;
+}
+
+// Reads pings in batches from any FILE* (regular file, pipe or accepted socket)
+struct PingReader
+{
+    FILE *fp;
+    size_t badLines;
+    PingReader(FILE *f) : fp(f), badLines(0) {}
+    // Fill batch with up to maxBatch pings; returns false once the stream is drained
+    bool read_batch(vector<GpsPing> &batch, size_t maxBatch)
+    {
+        batch.clear();
+        char buf[512];
+        GpsPing ping;
+        while (batch.size() < maxBatch && fgets(buf, sizeof(buf), fp))
+        {
+            if (parse_ping_line(buf, ping))
+                batch.push_back(ping);
+            else if (trim(buf).size() > 0 && buf[0] != '#')
+                badLines++;
+        }
+        return !batch.empty();
+    }
+};
+
+// Uniform grid over edge segments for nearest-edge candidate lookup
+struct SegmentIndex
+{
+    struct Segment
+    {
+        StopID u, v; // u <= v, one segment per undirected stop pair
+        double len;
+    };
+    vector<Segment> segs;
+    vector<vector<int>> cells;
+    double minX, minY, cellSize;
+    int nx, ny;
+    uint64_t builtVersion;
+    bool built;
+
+    SegmentIndex() : minX(0), minY(0), cellSize(1), nx(0), ny(0), builtVersion(0), built(false) {}
+
+    static size_t edge_count(const Graph &g)
+    {
+        size_t m = 0;
+        for (size_t u = 0; u < g.adj.size(); ++u)
+            m += g.adj[u].size();
+        return m;
+    }
+
+    bool stale(const Graph &g) const
+    {
+        return !built || builtVersion != g.version;
+    }
+
+    void cell_range(double x0, double y0, double x1, double y1, int &cx0, int &cy0, int &cx1, int &cy1) const
+    {
+        cx0 = max(0, min(nx - 1, (int)floor((x0 - minX) / cellSize)));
+        cy0 = max(0, min(ny - 1, (int)floor((y0 - minY) / cellSize)));
+        cx1 = max(0, min(nx - 1, (int)floor((x1 - minX) / cellSize)));
+        cy1 = max(0, min(ny - 1, (int)floor((y1 - minY) / cellSize)));
+    }
+
+    void build(const Graph &g)
+    {
+        segs.clear();
+        cells.clear();
+        built = true;
+        builtVersion = g.version;
+        set<pair<StopID, StopID>> seen;
+        double maxX = -1e18, maxY = -1e18;
+        minX = 1e18;
+        minY = 1e18;
+        for (size_t u = 0; u < g.adj.size(); ++u)
+        {
+            for (size_t j = 0; j < g.adj[u].size(); ++j)
+            {
+                StopID a = (StopID)u, b = g.adj[u][j].to;
+                if (a == b)
+                    continue;
+                pair<StopID, StopID> key(min(a, b), max(a, b));
+                if (!seen.insert(key).second)
+                    continue;
+                Point pa = g.get_loc(key.first), pb = g.get_loc(key.second);
+                Segment s = {key.first, key.second, euclidean(pa, pb)};
+                segs.push_back(s);
+                minX = min(minX, min(pa.x, pb.x));
+                minY = min(minY, min(pa.y, pb.y));
+                maxX = max(maxX, max(pa.x, pb.x));
+                maxY = max(maxY, max(pa.y, pb.y));
+            }
+        }
+        if (segs.empty())
+        {
+            nx = ny = 0;
+            return;
+        }
+        // Aim for a handful of segments per cell
+        double area = max(1e-9, (maxX - minX) * (maxY - minY));
+        cellSize = max(1e-6, sqrt(area / max((size_t)1, segs.size())) * 2.0);
+        nx = min(4096, (int)((maxX - minX) / cellSize) + 1);
+        ny = min(4096, (int)((maxY - minY) / cellSize) + 1);
+        cellSize = max(cellSize, max((maxX - minX) / nx, (maxY - minY) / ny) * 1.0000001);
+        cells.assign((size_t)nx * ny, vector<int>());
+        for (size_t i = 0; i < segs.size(); ++i)
+        {
+            Point pa = g.get_loc(segs[i].u), pb = g.get_loc(segs[i].v);
+            int cx0, cy0, cx1, cy1;
+            cell_range(min(pa.x, pb.x), min(pa.y, pb.y), max(pa.x, pb.x), max(pa.y, pb.y), cx0, cy0, cx1, cy1);
+            for (int cy = cy0; cy <= cy1; ++cy)
+                for (int cx = cx0; cx <= cx1; ++cx)
+                    cells[(size_t)cy * nx + cx].push_back((int)i);
+        }
+    }
+
+    // Project p onto segment s: returns distance, sets frac in [0,1] measured from s.u
+    double project(const Graph &g, const Segment &s, const Point &p, double &frac) const
+    {
+        Point a = g.get_loc(s.u), b = g.get_loc(s.v);
+        double dx = b.x - a.x, dy = b.y - a.y;
+        double l2 = dx * dx + dy * dy;
+        frac = (l2 <= 0) ? 0.0 : ((p.x - a.x) * dx + (p.y - a.y) * dy) / l2;
+        frac = max(0.0, min(1.0, frac));
+        Point q = Point{a.x + frac * dx, a.y + frac * dy};
+        return euclidean(p, q);
+    }
+
+    // Segments within radius of p, nearest first, at most k of them
+    void query(const Graph &g, const Point &p, double radius, size_t k, vector<pair<double, int>> &out, vector<double> &fracs) const
+    {
+        out.clear();
+        fracs.clear();
+        if (nx == 0)
+            return;
+        int cx0, cy0, cx1, cy1;
+        cell_range(p.x - radius, p.y - radius, p.x + radius, p.y + radius, cx0, cy0, cx1, cy1);
+        for (int cy = cy0; cy <= cy1; ++cy)
+        {
+            for (int cx = cx0; cx <= cx1; ++cx)
+            {
+                const vector<int> &cell = cells[(size_t)cy * nx + cx];
+                for (size_t i = 0; i < cell.size(); ++i)
+                {
+                    double f;
+                    double d = project(g, segs[cell[i]], p, f);
+                    if (d <= radius)
+                        out.push_back(make_pair(d, cell[i]));
+                }
+            }
+        }
+        // A segment spanning several cells is seen once per cell
+        sort(out.begin(), out.end());
+        out.erase(unique(out.begin(), out.end()), out.end());
+        if (out.size() > k)
+            out.resize(k);
+        for (size_t i = 0; i < out.size(); ++i)
+        {
+            double f;
+            project(g, segs[out[i].second], p, f);
+            fracs.push_back(f);
+        }
+    }
+};
+
+// Online HMM (Viterbi) map matcher; one state per tracked bus
+struct MapMatcher
+{
+    // One HMM state: position on a segment, oriented as the bus travels
+    struct Candidate
+    {
+        StopID from, to;
+        double frac;     // 0 at from, 1 at to
+        double len;      // segment length
+        double gpsDist;  // distance from ping to the snapped point
+        int routePos;    // index p with route[p]=from, route[p+1]=to; -1 if off-route
+        double score;    // Viterbi log-probability
+    };
+    struct BusTrack
+    {
+        vector<StopID> route;
+        vector<double> cum; // cumulative geometric length along route
+        vector<Candidate> states;
+        Point lastPos;
+        double lastT;
+        bool hasLast;
+        BusTrack() : lastT(-1e18), hasLast(false) {}
+    };
+
+    double sigma;          // GPS noise (same unit as stop coordinates)
+    double beta;           // transition tolerance for route vs straight-line distance
+    double searchRadius;   // candidate search radius
+    double stopSnapRadius; // closer than this to a stop counts as at the stop
+    double offRoutePenalty;
+    size_t maxCandidates;
+    int lookahead; // route positions ahead of currentIndex considered per ping
+
+    SegmentIndex index;
+    unordered_map<string, BusTrack> tracks;
+    vector<pair<double, int>> near; // scratch, reused across pings
+    vector<double> fracs;
+    vector<Candidate> next;
+
+    MapMatcher() : sigma(0.02), beta(0.5), searchRadius(0.2), stopSnapRadius(0.05), offRoutePenalty(4.0), maxCandidates(8), lookahead(16) {}
+
+    void ensure_index(const Graph &g)
+    {
+        if (index.stale(g))
+        {
+            index.build(g);
+            tracks.clear();
+        }
+    }
+
+    void sync_track(const Graph &g, const Bus &bus, BusTrack &tr)
+    {
+        if (tr.route == bus.route)
+            return;
+        tr.route = bus.route;
+        tr.cum.assign(bus.route.size(), 0.0);
+        for (size_t i = 1; i < bus.route.size(); ++i)
+            tr.cum[i] = tr.cum[i - 1] + euclidean(g.get_loc(bus.route[i - 1]), g.get_loc(bus.route[i]));
+        tr.states.clear();
+        tr.hasLast = false;
+    }
+
+    // Orient a segment along the bus route (searching ahead of currentIndex)
+    void orient(const Bus &bus, Candidate &c) const
+    {
+        int start = max(0, bus.currentIndex);
+        int end = min((int)bus.route.size() - 1, start + lookahead);
+        for (int p = start; p < end; ++p)
+        {
+            if (bus.route[p] == c.from && bus.route[p + 1] == c.to)
+            {
+                c.routePos = p;
+                return;
+            }
+            if (bus.route[p] == c.to && bus.route[p + 1] == c.from)
+            {
+                swap(c.from, c.to);
+                c.frac = 1.0 - c.frac;
+                c.routePos = p;
+                return;
+            }
+        }
+        c.routePos = -1;
+    }
+
+    // Network distance travelled between two candidates (approximated along the route)
+    double travel(const BusTrack &tr, const Candidate &a, const Candidate &b, double straight) const
+    {
+        if (a.routePos >= 0 && b.routePos >= 0)
+        {
+            double da = tr.cum[a.routePos] + a.frac * a.len;
+            double db = tr.cum[b.routePos] + b.frac * b.len;
+            if (db >= da)
+                return db - da;
+            return (da - db) * 3.0 + beta * 4.0; // going backwards along the route
+        }
+        if (a.from == b.from && a.to == b.to)
+            return fabs(b.frac - a.frac) * a.len;
+        if (a.to == b.from)
+            return (1.0 - a.frac) * a.len + b.frac * b.len;
+        return straight * 2.0 + beta * 4.0;
+    }
+
+    // Match one ping for bus; returns the new route index (or -1 if unmatched)
+    int match(const Graph &g, const Bus &bus, const GpsPing &ping)
+    {
+        BusTrack &tr = tracks[ping.busId];
+        sync_track(g, bus, tr);
+        if (tr.hasLast && ping.t <= tr.lastT)
+            return -2; // stale or duplicate ping
+        index.query(g, ping.pos, searchRadius, maxCandidates, near, fracs);
+        if (near.empty())
+            return -1;
+
+        next.clear();
+        double straight = tr.hasLast ? euclidean(tr.lastPos, ping.pos) : 0.0;
+        for (size_t i = 0; i < near.size(); ++i)
+        {
+            const SegmentIndex::Segment &s = index.segs[near[i].second];
+            Candidate c;
+            c.from = s.u;
+            c.to = s.v;
+            c.frac = fracs[i];
+            c.len = s.len;
+            c.gpsDist = near[i].first;
+            orient(bus, c);
+            double emission = -0.5 * (c.gpsDist / sigma) * (c.gpsDist / sigma);
+            if (c.routePos < 0)
+                emission -= offRoutePenalty;
+            double best = tr.states.empty() ? 0.0 : -1e18;
+            for (size_t j = 0; j < tr.states.size(); ++j)
+            {
+                double d = travel(tr, tr.states[j], c, straight);
+                double trans = -fabs(d - straight) / beta;
+                best = max(best, tr.states[j].score + trans);
+            }
+            c.score = best + emission;
+            next.push_back(c);
+        }
+        // Renormalise so scores stay bounded on long streams
+        size_t bi = 0;
+        for (size_t i = 1; i < next.size(); ++i)
+            if (next[i].score > next[bi].score)
+                bi = i;
+        double top = next[bi].score;
+        for (size_t i = 0; i < next.size(); ++i)
+            next[i].score -= top;
+        tr.states.swap(next);
+        tr.lastPos = ping.pos;
+        tr.lastT = ping.t;
+        tr.hasLast = true;
+
+        const Candidate &best = tr.states[bi];
+        if (best.routePos < 0)
+            return -1;
+        int idx = best.routePos;
+        if ((1.0 - best.frac) * best.len <= stopSnapRadius)
+            idx++;
+        return idx;
+    }
+};
+
+// Streaming ingestion stage: pings -> map matcher -> bus positions
+struct PingIngestor
+{
+    BusSystem &sys;
+    MapMatcher matcher;
+    size_t pings, matched, unmatched, unknownBus, stale, advances;
+
+    PingIngestor(BusSystem &s) : sys(s), pings(0), matched(0), unmatched(0), unknownBus(0), stale(0), advances(0) {}
+
+    void ingest_batch(const vector<GpsPing> &batch)
+    {
+        METRIC_LATENCY(MH_PING_BATCH);
+        METRIC_ADD(MC_PINGS, batch.size());
+        matcher.ensure_index(sys.g);
+        bool moved = false;
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            const GpsPing &ping = batch[i];
+            pings++;
+            unordered_map<string, Bus>::iterator it = sys.buses.find(ping.busId);
+            if (it == sys.buses.end())
+            {
+                unknownBus++;
+                continue;
+            }
+            Bus &bus = it->second;
+            int idx = matcher.match(sys.g, bus, ping);
+            if (idx == -2)
+            {
+                stale++;
+                continue;
+            }
+            if (idx < 0)
+            {
+                unmatched++;
+                continue;
+            }
+            matched++;
+            if (idx > bus.currentIndex && idx < (int)bus.route.size())
+            {
+                StopID prev = bus.current_stop();
+                bus.currentIndex = idx;
+                sys.journal("P\t" + bus.busId + "\t" + to_string(idx));
+                advances++;
+                moved = true;
+                string entry = string("[") + sys.current_time_str() + "] " + bus.busId + " : " + sys.g.get_name(prev) + " -> " + sys.g.get_name(bus.current_stop()) + " (gps)";
+                sys.push_history(entry);
+                logger.log(entry);
+            }
+        }
+        if (moved)
+            sys.rebuild_stop_index();
+    }
+
+    // Drain a stream batch by batch
+    size_t ingest_stream(FILE *fp, size_t batchSize = 4096)
+    {
+        PingReader reader(fp);
+        vector<GpsPing> batch;
+        size_t before = pings;
+        while (reader.read_batch(batch, batchSize))
+            ingest_batch(batch);
+        return pings - before;
+    }
+
+    string stats() const
+    {
+        stringstream ss;
+        ss << "pings=" << pings << " matched=" << matched << " unmatched=" << unmatched
+           << " unknown_bus=" << unknownBus << " stale=" << stale << " advances=" << advances;
+        return ss.str();
+    }
+};
+
+// Record synthetic pings for every bus driving its route (for replay testing)
+size_t write_synthetic_pings(const BusSystem &sys, const string &file, size_t count, double noise = 0.01, double interval = 5.0, unsigned seed = 42)
+{
+    FILE *fp = fopen(file.c_str(), "w");
+    if (!fp)
+        return 0;
+    mt19937 rng(seed);
+    normal_distribution<double> jitter(0.0, noise);
+    vector<const Bus *> fleet;
+    for (auto it = sys.buses.begin(); it != sys.buses.end(); ++it)
+        if (it->second.route.size() >= 2)
+            fleet.push_back(&it->second);
+    size_t written = 0;
+    for (size_t step = 0; written < count && !fleet.empty(); ++step)
+    {
+        double t = step * interval;
+        for (size_t b = 0; b < fleet.size() && written < count; ++b)
+        {
+            const Bus &bus = *fleet[b];
+            // Distance covered so far, wrapping so replays can be arbitrarily long
+            double km = bus.speed / 3600.0 * t;
+            double total = 0;
+            for (size_t i = 1; i < bus.route.size(); ++i)
+                total += euclidean(sys.g.get_loc(bus.route[i - 1]), sys.g.get_loc(bus.route[i]));
+            if (total <= 0)
+                continue;
+            km = fmod(km, total);
+            Point p = sys.g.get_loc(bus.route[0]);
+            for (size_t i = 1; i < bus.route.size(); ++i)
+            {
+                Point a = sys.g.get_loc(bus.route[i - 1]), c = sys.g.get_loc(bus.route[i]);
+                double len = euclidean(a, c);
+                if (km <= len)
+                {
+                    double f = len > 0 ? km / len : 0;
+                    p = Point{a.x + f * (c.x - a.x), a.y + f * (c.y - a.y)};
+                    break;
+                }
+                km -= len;
+                p = c;
+            }
+            fprintf(fp, "%s\t%.1f\t%.6f\t%.6f\n", bus.busId.c_str(), t, p.x + jitter(rng), p.y + jitter(rng));
+            written++;
+        }
+    }
+    fclose(fp);
+    return written;
+}
+
+// Monte Carlo service scenarios. The network and every route's scheduled leg times are
+// flattened once into a ScenarioModel that all scenarios share read-only; a scenario forks
+// only the fleet (8 bytes per bus) and draws its own congestion, noise and breakdowns, so
+// thousands of what-ifs run without copying a BusSystem.
+struct ScenarioParams
+{
+    size_t scenarios;
+    uint64_t seed;
+    double congestionSigma;   // lognormal spread of a street's slowdown, shared by every bus on it
+    double noiseSigma;        // lognormal spread of each individual traversal
+    double breakdownsPerHour; // per bus, while driving
+    double slackMinutes;      // an arrival at most this late is on time
+    ScenarioParams() : scenarios(1000), seed(1), congestionSigma(0.25), noiseSigma(0.1), breakdownsPerHour(0.05), slackMinutes(3.0) {}
+};
+
+struct FleetBus
+{
+    int32_t route; // Timetable row
+    int32_t pos;   // stop index along the route; -1 once broken down
+};
+
+struct ScenarioOutcome
+{
+    float onTime;    // fraction of the remaining scheduled arrivals within the slack
+    float meanDelay; // minutes late per completed arrival
+    int32_t breakdowns;
+};
+
+struct ScenarioSummary
+{
+    double mean, stddev, p05, p50, p95; // on-time fraction
+    double meanDelay, meanBreakdowns;
+};
+
+struct ScenarioModel
+{
+    vector<int> legStart; // per route, into legMin/legStreet (CSR); leg i ends at stop i + 1
+    vector<float> legMin; // scheduled minutes, -1 where the timetable has no path
+    vector<int> legStreet; // distinct (from, to) pair, so congestion is correlated across routes
+    int streets;
+    vector<FleetBus> fleet; // starting state, in bus id order
+    vector<string> busIds;
+
+    ScenarioModel() : streets(0) {}
+
+    void build(BusSystem &sys)
+    {
+        sys.ensure_timetable();
+        const Timetable &tt = sys.timetable;
+        legStart.assign(1, 0);
+        legMin.clear();
+        legStreet.clear();
+        unordered_map<uint64_t, int> streetOf;
+        for (size_t r = 0; r < tt.routes.size(); ++r)
+        {
+            const vector<StopID> &rt = tt.routes[r];
+            for (size_t i = 1; i < rt.size(); ++i)
+            {
+                double w = tt.cum[r][i] - tt.cum[r][i - 1];
+                legMin.push_back(tt.cum[r][i] >= 1e18 ? -1.0f : (float)w);
+                uint64_t key = ((uint64_t)(uint32_t)rt[i - 1] << 32) | (uint32_t)rt[i];
+                unordered_map<uint64_t, int>::iterator f = streetOf.find(key);
+                if (f == streetOf.end())
+                    f = streetOf.insert(make_pair(key, (int)streetOf.size())).first;
+                legStreet.push_back(f->second);
+            }
+            legStart.push_back((int)legMin.size());
+        }
+        streets = (int)streetOf.size();
+        busIds.clear();
+        for (unordered_map<string, int>::const_iterator it = tt.routeOfBus.begin(); it != tt.routeOfBus.end(); ++it)
+            busIds.push_back(it->first);
+        sort(busIds.begin(), busIds.end());
+        fleet.resize(busIds.size());
+        for (size_t i = 0; i < busIds.size(); ++i)
+        {
+            const Bus &b = sys.buses[busIds[i]];
+            fleet[i].route = tt.routeOfBus.find(busIds[i])->second;
+            fleet[i].pos = max(0, min(b.currentIndex, (int)b.route.size() - 1));
+        }
+    }
+
+    size_t memory_bytes() const
+    {
+        return legStart.size() * sizeof(int) + legMin.size() * (sizeof(float) + sizeof(int)) + fleet.size() * sizeof(FleetBus);
+    }
+
+    // One scenario, fully determined by (seed, index) so the thread count cannot change it.
+    // fleet and slowdown are the caller's scratch buffers, reused across scenarios.
+    ScenarioOutcome simulate(const ScenarioParams &p, size_t index, vector<FleetBus> &state, vector<float> &slowdown) const
+    {
+        seed_seq seq{(uint32_t)p.seed, (uint32_t)(p.seed >> 32), (uint32_t)index, (uint32_t)((uint64_t)index >> 32)};
+        mt19937_64 rng(seq);
+        normal_distribution<double> z(0.0, 1.0);
+        exponential_distribution<double> untilBreakdown(max(p.breakdownsPerHour, 1e-12) / 60.0);
+        state = fleet; // the fork
+        slowdown.resize(streets);
+        double cs = p.congestionSigma, ns = p.noiseSigma;
+        for (int i = 0; i < streets; ++i)
+            slowdown[i] = (float)exp(cs * z(rng) - 0.5 * cs * cs); // mean 1
+        size_t due = 0, onTime = 0, arrived = 0;
+        double delay = 0;
+        int breakdowns = 0;
+        for (size_t b = 0; b < state.size(); ++b)
+        {
+            FleetBus &bus = state[b];
+            int first = legStart[bus.route] + bus.pos, last = legStart[bus.route + 1];
+            double late = 0;
+            double driving = p.breakdownsPerHour > 0 ? untilBreakdown(rng) : 1e18;
+            for (int l = first; l < last; ++l)
+            {
+                if (legMin[l] < 0)
+                    continue;
+                due++;
+                double t = legMin[l] * slowdown[legStreet[l]];
+                if (ns > 0)
+                    t *= exp(ns * z(rng) - 0.5 * ns * ns);
+                driving -= t;
+                if (driving < 0)
+                {
+                    // Every remaining arrival of this bus is missed
+                    breakdowns++;
+                    for (int m = l + 1; m < last; ++m)
+                        due += legMin[m] >= 0;
+                    bus.pos = -1;
+                    break;
+                }
+                late = max(0.0, late + t - legMin[l]); // early buses hold at the stop
+                arrived++;
+                delay += late;
+                onTime += late <= p.slackMinutes;
+                bus.pos = l - legStart[bus.route] + 1;
+            }
+        }
+        ScenarioOutcome out;
+        out.onTime = due ? (float)((double)onTime / due) : 1.0f;
+        out.meanDelay = arrived ? (float)(delay / arrived) : 0.0f;
+        out.breakdowns = breakdowns;
+        return out;
+    }
+
+    // All scenarios across threads; the result is identical for any thread count
+    vector<ScenarioOutcome> run(const ScenarioParams &p, int threads) const
+    {
+        vector<ScenarioOutcome> out(p.scenarios);
+        parallel_for(p.scenarios, threads, [&](size_t begin, size_t end, int)
+                     {
+                         vector<FleetBus> state;
+                         vector<float> slowdown;
+                         for (size_t k = begin; k < end; ++k)
+                             out[k] = simulate(p, k, state, slowdown);
+                     });
+        return out;
+    }
+};
+
+ScenarioSummary summarize_scenarios(const vector<ScenarioOutcome> &runs)
+{
+    ScenarioSummary s = ScenarioSummary();
+    if (runs.empty())
+        return s;
+    vector<double> f(runs.size());
+    for (size_t i = 0; i < runs.size(); ++i)
+    {
+        f[i] = runs[i].onTime;
+        s.mean += f[i];
+        s.meanDelay += runs[i].meanDelay;
+        s.meanBreakdowns += runs[i].breakdowns;
+    }
+    s.mean /= runs.size();
+    s.meanDelay /= runs.size();
+    s.meanBreakdowns /= runs.size();
+    for (size_t i = 0; i < f.size(); ++i)
+        s.stddev += (f[i] - s.mean) * (f[i] - s.mean);
+    s.stddev = sqrt(s.stddev / f.size());
+    sort(f.begin(), f.end());
+    s.p05 = f[(size_t)(0.05 * (f.size() - 1))];
+    s.p50 = f[(size_t)(0.50 * (f.size() - 1))];
+    s.p95 = f[(size_t)(0.95 * (f.size() - 1))];
+    return s;
+}
+
+void print_scenario_summary(const ScenarioSummary &s, size_t scenarios)
+{
+    cout << "on-time over " << scenarios << " scenarios: mean " << s.mean * 100 << "%, stddev " << s.stddev * 100 << "%, p5 " << s.p05 * 100
+         << "%, median " << s.p50 * 100 << "%, p95 " << s.p95 * 100 << "%\n";
+    cout << "mean delay " << s.meanDelay << " min per arrival, " << s.meanBreakdowns << " breakdowns per scenario\n";
+}
+
+//Demo dataset builder
+void build_sample_data(BusSystem &sys)
+{
+    sys.add_stop_with_location("A", 0, 0);
+    sys.add_stop_with_location("B", 2, 1);
+    sys.add_stop_with_location("C", 4, 0.5);
+    sys.add_stop_with_location("D", 3, -1.5);
+    sys.add_stop_with_location("E", 1, -2);
+    sys.add_stop_with_location("F", 5, -1);
+    sys.add_stop_with_location("G", 6, 1.5);
+
+    sys.add_route_by_names("A", "B", 6); // 6 minutes
+    sys.add_route_by_names("B", "C", 5);
+    sys.add_route_by_names("C", "F", 8);
+    sys.add_route_by_names("A", "E", 7);
+    sys.add_route_by_names("E", "D", 4);
+    sys.add_route_by_names("D", "C", 6);
+    sys.add_route_by_names("F", "G", 9);
+    sys.add_route_by_names("C", "G", 7);
+
+    sys.add_bus("BUS101", vector<string>{"A", "B", "C", "F", "G"}, 40.0);
+    sys.add_bus("BUS202", vector<string>{"E", "D", "C", "B", "A"}, 35.0);
+    sys.add_bus("BUS303", vector<string>{"G", "C", "D", "E", "A"}, 45.0);
+}
+
+// Synthetic city generator for benchmarks at realistic scale.
+// A jittered street grid (every few rows/columns an arterial with faster travel) where some
+// blocks are replaced by plazas: the interior lattice points are removed and a hub stop is
+// linked to every stop on the plaza boundary. Plaza sizes are Pareto distributed, which gives
+// a heavy-tailed degree distribution while the network stays planar. Weights are minutes.
+struct CityParams
+{
+    size_t stops;      // approximate number of stops
+    unsigned seed;
+    size_t buses;      // 0 = one bus per 100 stops (at least 3)
+    double spacing;    // km between grid intersections
+    int arterialEvery; // every k-th row and column is an arterial
+    double plazaRate;  // plazas per 1000 lattice points
+    double dropRate;   // share of non-essential street segments removed
+    CityParams(size_t n = 10000, unsigned s = 1) : stops(n), seed(s), buses(0), spacing(0.4), arterialEvery(8), plazaRate(4.0), dropRate(0.1) {}
+};
+
+void generate_city_graph(Graph &g, const CityParams &p)
+{
+    mt19937 rng(p.seed);
+    uniform_real_distribution<double> unit(0.0, 1.0);
+    // Plaza interiors remove some lattice points; the hubs add a few back
+    size_t side = max((size_t)2, (size_t)ceil(sqrt(p.stops * 1.1)));
+    size_t cells = side * side;
+    // Lattice state: 0 street corner, 1 plaza boundary, 2 removed plaza interior
+    vector<char> state(cells, 0);
+    struct Plaza
+    {
+        size_t r0, c0, b;
+    };
+    vector<Plaza> plazas;
+    size_t wantPlazas = (size_t)(cells * p.plazaRate / 1000.0);
+    for (size_t tries = 0; plazas.size() < wantPlazas && tries < wantPlazas * 10; ++tries)
+    {
+        // Pareto(alpha = 1.3) block size, clamped to keep plazas city-sized
+        size_t b = (size_t)min(16.0, 2.0 * pow(1.0 - unit(rng), -1.0 / 1.3));
+        if (b + 2 >= side)
+            continue;
+        size_t r0 = 1 + (size_t)(unit(rng) * (side - b - 2)), c0 = 1 + (size_t)(unit(rng) * (side - b - 2));
+        bool free = true;
+        for (size_t r = r0 - 1; r <= r0 + b + 1 && free; ++r)
+            for (size_t c = c0 - 1; c <= c0 + b + 1 && free; ++c)
+                free = state[r * side + c] == 0;
+        if (!free)
+            continue;
+        for (size_t r = r0; r <= r0 + b; ++r)
+            for (size_t c = c0; c <= c0 + b; ++c)
+                state[r * side + c] = (r == r0 || r == r0 + b || c == c0 || c == c0 + b) ? 1 : 2;
+        Plaza pz = {r0, c0, b};
+        plazas.push_back(pz);
+    }
+
+    vector<StopID> idAt(cells, -1);
+    double jitter = p.spacing * 0.2;
+    for (size_t i = 0; i < cells; ++i)
+    {
+        if (state[i] == 2)
+            continue;
+        size_t r = i / side, c = i % side;
+        double x = c * p.spacing + (unit(rng) - 0.5) * jitter;
+        double y = r * p.spacing + (unit(rng) - 0.5) * jitter;
+        idAt[i] = g.add_stop("R" + to_string(r) + "C" + to_string(c), x, y);
+    }
+
+    // Street segments; a segment is only dropped if the network stays connected without it
+    struct Seg
+    {
+        StopID a, b;
+        bool arterial;
+    };
+    vector<Seg> segs;
+    for (size_t r = 0; r < side; ++r)
+    {
+        for (size_t c = 0; c < side; ++c)
+        {
+            StopID a = idAt[r * side + c];
+            if (a < 0)
+                continue;
+            if (c + 1 < side && idAt[r * side + c + 1] >= 0)
+            {
+                Seg s = {a, idAt[r * side + c + 1], p.arterialEvery > 0 && r % p.arterialEvery == 0};
+                segs.push_back(s);
+            }
+            if (r + 1 < side && idAt[(r + 1) * side + c] >= 0)
+            {
+                Seg s = {a, idAt[(r + 1) * side + c], p.arterialEvery > 0 && c % p.arterialEvery == 0};
+                segs.push_back(s);
+            }
+        }
+    }
+    shuffle(segs.begin(), segs.end(), rng);
+    DisjointSet ds(g.size() + plazas.size());
+    vector<char> keep(segs.size(), 0);
+    for (size_t i = 0; i < segs.size(); ++i)
+        keep[i] = ds.unite(segs[i].a, segs[i].b) || segs[i].arterial || unit(rng) >= p.dropRate;
+    for (size_t i = 0; i < segs.size(); ++i)
+    {
+        if (!keep[i])
+            continue;
+        double km = euclidean(g.get_loc(segs[i].a), g.get_loc(segs[i].b));
+        double kmh = segs[i].arterial ? 40.0 : 20.0;
+        double minutes = km / kmh * 60.0 * (1.0 + 0.3 * unit(rng));
+        g.add_edge(segs[i].a, segs[i].b, minutes);
+    }
+
+    // Plaza hubs link to every boundary stop
+    for (size_t k = 0; k < plazas.size(); ++k)
+    {
+        const Plaza &pz = plazas[k];
+        double cx = (pz.c0 + pz.b / 2.0) * p.spacing, cy = (pz.r0 + pz.b / 2.0) * p.spacing;
+        StopID hub = g.add_stop("Hub" + to_string(k), cx, cy);
+        for (size_t r = pz.r0; r <= pz.r0 + pz.b; ++r)
+        {
+            for (size_t c = pz.c0; c <= pz.c0 + pz.b; ++c)
+            {
+                StopID s = idAt[r * side + c];
+                if (s < 0 || state[r * side + c] != 1)
+                    continue;
+                double km = euclidean(g.get_loc(hub), g.get_loc(s));
+                g.add_edge(hub, s, km / 15.0 * 60.0 + 0.5);
+            }
+        }
+    }
+}
+
+// Bus routes: shortest paths between random stops a few km apart.
+// Lattice stops are numbered row by row, so an id offset of dr * side + dc lands near
+// (dr, dc) grid steps away; the distance check below filters the misses.
+void generate_city_buses(BusSystem &sys, const CityParams &p)
+{
+    size_t n = sys.g.size();
+    if (n < 2)
+        return;
+    size_t want = p.buses ? p.buses : max((size_t)3, n / 100);
+    CompactGraph cg;
+    cg.build(sys.g);
+    SearchWorkspace ws;
+    mt19937 rng(p.seed * 7919u + 1);
+    uniform_int_distribution<int> pick(0, (int)n - 1);
+    uniform_real_distribution<double> speed(25.0, 45.0);
+    int reach = max(1, (int)(8.0 / p.spacing));
+    uniform_int_distribution<int> step(-reach, reach);
+    long long side = (long long)ceil(sqrt((double)n));
+    for (size_t made = 0, tries = 0; made < want && tries < want * 50; ++tries)
+    {
+        StopID a = pick(rng);
+        long long off = (long long)step(rng) * side + step(rng);
+        StopID b = (StopID)max(0LL, min((long long)n - 1, (long long)a + off));
+        double km = euclidean(sys.g.get_loc(a), sys.g.get_loc(b));
+        if (a == b || (n > 400 && (km < 3.0 || km > 8.0)))
+            continue;
+        double cost;
+        vector<int> edges = bidirectional_search(cg, ws, a, b, vector<double>(), cost);
+        if (edges.empty())
+            continue;
+        vector<StopID> route(1, a);
+        for (size_t i = 0; i < edges.size(); ++i)
+            route.push_back(cg.to[edges[i]]);
+        string id = "BUS" + to_string(made + 1);
+        sys.buses[id] = Bus(id, route, speed(rng));
+        made++;
+    }
+    sys.rebuild_stop_index();
+    sys.routes_changed();
+}
+
+void generate_city(BusSystem &sys, const CityParams &p)
+{
+    generate_city_graph(sys.g, p);
+    generate_city_buses(sys, p);
+    logger.log(string("Generated city: ") + to_string(sys.g.size()) + " stops, " + to_string(sys.buses.size()) + " buses");
+}
+
+//CLI
+void show_menu()
+{
+    cout << "\n=== Bus Tracking System CLI ===\n";
+    cout << "1. Show summary\n";
+    cout << "2. List stops\n";
+    cout << "3. Add stop\n";
+    cout << "4. Add route (edge)\n";
+    cout << "5. List buses\n";
+    cout << "6. Add bus\n";
+    cout << "7. Move all buses one step (simulate)\n";
+    cout << "8. Move single bus one step\n";
+    cout << "9. ETA between stops (Dijkstra)\n";
+    cout << "10. ETA for bus -> stop\n";
+    cout << "11. Shortest path (Dijkstra) show route\n";
+    cout << "12. A* path (uses coordinates)\n";
+    cout << "13. MST (spanning forest) suggestion\n";
+    cout << "14. Suggest stops by prefix (Trie)\n";
+    cout << "15. Save changes (change log; snapshot when due)\n";
+    cout << "16. Load graph & buses from files\n";
+    cout << "17. Show movement history\n";
+    cout << "18. Show recent logger messages\n";
+    cout << "20. Ingest GPS pings from file\n";
+    cout << "21. Isochrone (stops reachable within a time budget)\n";
+    cout << "22. Alternative routes (up to k)\n";
+    cout << "23. Show metrics (Prometheus format)\n";
+    cout << "24. Departure board for a stop\n";
+    cout << "25. Export graph & buses to data/*.txt\n";
+    cout << "26. Renumber stops for memory locality (hilbert/bfs/rcm)\n";
+    cout << "27. Critical links (closures that split the network)\n";
+    cout << "28. Close a road and reroute the buses that use it\n";
+    cout << "29. Reopen a closed road\n";
+    cout << "19. Exit\n";
+    cout << "Enter choice: " << endl;
+}
+
+// Precomputed indexes in data/ are only used while they match the network; a file that no
+// longer matches is reported rather than silently ignored
+void load_data_indexes(BusSystem &sys)
+{
+    if (sys.load_hub_labels("data/labels.hub"))
+        cout << "Hub labels: data/labels.hub (" << sys.hubs.entries() << " entries)\n";
+    else if (ifstream("data/labels.hub"))
+    {
+        logger.log("Ignored data/labels.hub: it does not match the current network");
+        cout << "data/labels.hub does not match the current network; ETAs use Dijkstra (rebuild with --build-labels)\n";
+    }
+    if (sys.load_distance_table("data/table.apsp"))
+        cout << "Distance table: data/table.apsp (" << sys.table.file_bytes() / 1048576.0 << " MiB mapped)\n";
+    else if (ifstream("data/table.apsp"))
+    {
+        logger.log("Ignored data/table.apsp: it does not match the current network");
+        cout << "data/table.apsp does not match the current network; ETAs skip it (rebuild with --build-table)\n";
+    }
+}
+
+void cli_loop(BusSystem &sys)
+{
+    while (true)
+    {
+        sys.publish_network(); // the previous command's edits become one snapshot
+        sys.wal.sync();        // ... and one durable group in the change log
+        show_menu();
+        int ch;
+        if (!(cin >> ch))
+        {
+            cin.clear();
+            string dummy;
+            getline(cin, dummy);
+            cout << "Invalid input. Try again.\n";
+            continue;
+        }
+        if (ch == 1)
+        {
+            sys.print_summary();
+        }
+        else if (ch == 2)
+        {
+            cout << "Stops: \n";
+            for (StopID e = 0; e < (StopID)sys.g.size(); ++e)
+            {
+                StopID i = sys.g.internal_id(e);
+                string s = sys.g.get_name(i);
+                Point loc = sys.g.get_loc(i);
+                cout << e << " : " << s << " (" << loc.x << "," << loc.y << ")\n";
+            }
+        }
+        else if (ch == 3)
+        {
+            string name;
+            double x, y;
+            cout << "Enter stop name: ";
+            cin >> ws;
+            getline(cin, name);
+            cout << "Enter x y coords (double): ";
+            cin >> x >> y;
+            if (sys.add_stop_with_location(name, x, y))
+                cout << "Added.\n";
+            else
+                cout << "Stop names cannot contain tabs.\n";
+        }
+        else if (ch == 4)
+        {
+            string a, b;
+            double minutes;
+            cout << "Enter stopA name: ";
+            cin >> ws;
+            getline(cin, a);
+            cout << "Enter stopB name: ";
+            cin >> ws;
+            getline(cin, b);
+            cout << "Enter travel time in minutes (double): ";
+            cin >> minutes;
+            if (sys.add_route_by_names(a, b, minutes))
+                cout << "Edge added.\n";
+            else
+                cout << "Stop names cannot contain tabs.\n";
+        }
+        else if (ch == 5)
+        {
+            cout << "Buses:\n";
+            for (auto it = sys.buses.begin(); it != sys.buses.end(); ++it)
+            {
+                cout << it->second.info(sys.g) << "\n";
+            }
+        }
+        else if (ch == 6)
+        {
+            string idline;
+            cout << "Enter bus id: ";
+            cin >> ws;
+            getline(cin, idline);
+            string routeStr;
+            cout << "Enter comma-separated stops (names): ";
+            cin >> ws;
+            getline(cin, routeStr);
+            double sp;
+            cout << "Enter speed (km/h) [not used if edges are minutes, but recorded]: ";
+            cin >> sp;
+            vector<string> parts;
+            string cur;
+            stringstream ss(routeStr);
+            while (getline(ss, cur, ','))
+                parts.push_back(trim(cur));
+            if (sys.add_bus(idline, parts, sp))
+                cout << "Bus added.\n";
+            else
+                cout << "Bus ids and stop names cannot contain tabs.\n";
+        }
+        else if (ch == 7)
+        {
+            cout << "Moving all buses one step...\n";
+            sys.move_all_buses_one_step();
+            cout << "Done.\n";
+        }
+        else if (ch == 8)
+        {
+            string bid;
+            cout << "Enter bus id: ";
+            cin >> ws;
+            getline(cin, bid);
+            bool ok = sys.move_bus_one_step(bid);
+            cout << (ok ? "Bus moved." : "Bus did not move (maybe at end or id wrong).") << "\n";
+        }
+        else if (ch == 9)
+        {
+            string a, b;
+            cout << "Enter source stop: ";
+            cin >> ws;
+            getline(cin, a);
+            cout << "Enter destination stop: ";
+            cin >> ws;
+            getline(cin, b);
+            double eta = sys.estimate_eta_between(a, b);
+            if (eta < 0)
+                cout << "No path or stops not present.\n";
+            else
+                cout << "ETA (minutes): " << eta << "\n";
+            if (sys.table.built && sys.table.stale(sys.g))
+                cout << "(distance table predates the latest edit; not used until data/table.apsp is rebuilt)\n";
+            if (sys.hubs.built && sys.hubs.stale(sys.g) && sys.table.stale(sys.g))
+                cout << "(hub labels predate the latest edit; answered with Dijkstra until data/labels.hub is rebuilt)\n";
+        }
+        else if (ch == 10)
+        {
+            string bid, target;
+            cout << "Enter bus id: ";
+            cin >> ws;
+            getline(cin, bid);
+            cout << "Enter target stop name: ";
+            cin >> ws;
+            getline(cin, target);
+            double eta = sys.estimate_eta_for_bus(bid, target);
+            unordered_map<string, Bus>::const_iterator hb = sys.buses.find(bid);
+            if (hb != sys.buses.end() && BusSystem::held(hb->second))
+                cout << "Bus " << bid << " is held until a closed road on its route reopens.\n";
+            else if (eta < 0)
+                cout << "Could not compute ETA.\n";
+            else
+                cout << "ETA from current position (minutes): " << eta << "\n";
+        }
+        else if (ch == 11)
+        {
+            string a, b;
+            cout << "Enter source stop: ";
+            cin >> ws;
+            getline(cin, a);
+            cout << "Enter destination stop: ";
+            cin >> ws;
+            getline(cin, b);
+            pair<double, vector<NameView>> res = sys.shortest_path_names(a, b);
+            double cost = res.first;
+            vector<NameView> path = res.second;
+            if (cost < 0)
+                cout << "No path.\n";
+            else
+            {
+                cout << "Cost (minutes): " << cost << "\nPath: ";
+                for (size_t i = 0; i < path.size(); ++i)
+                {
+                    cout << path[i] << (i + 1 < path.size() ? " -> " : "\n");
+                }
+            }
+        }
+        else if (ch == 12)
+        {
+            string a, b;
+            cout << "Enter source stop: ";
+            cin >> ws;
+            getline(cin, a);
+            cout << "Enter destination stop: ";
+            cin >> ws;
+            getline(cin, b);
+            pair<double, vector<NameView>> res = sys.astar_names(a, b);
+            double cost = res.first;
+            vector<NameView> path = res.second;
+            if (cost < 0)
+                cout << "A* failed to find path.\n";
+            else
+            {
+                cout << "A* cost (minutes approximated): " << cost << "\nPath: ";
+                for (size_t i = 0; i < path.size(); ++i)
+                {
+                    cout << path[i] << (i + 1 < path.size() ? " -> " : "\n");
+                }
+            }
+        }
+        else if (ch == 13)
+        {
+            SpanningForest f = minimum_spanning_forest(sys.g);
+            cout << "MST total weight (minutes): " << f.total << "\nEdges:\n";
+            for (size_t i = 0; i < f.edges.size(); ++i)
+                cout << sys.g.get_name(f.edges[i].u) << " - " << sys.g.get_name(f.edges[i].v) << " (" << f.edges[i].weight << ")\n";
+            if (f.componentSize.size() > 1)
+            {
+                cout << "Network has " << f.componentSize.size() << " components:\n";
+                for (size_t c = 0; c < f.componentSize.size(); ++c)
+                    cout << "  component " << c << ": " << f.componentSize[c] << " stops, weight " << f.componentTotal[c] << "\n";
+            }
+            cout << "Use this to plan minimal-cost physical cable/road layout (demo purpose).\n";
+        }
+        else if (ch == 14)
+        {
+            string pref;
+            cout << "Enter prefix: ";
+            cin >> ws;
+            getline(cin, pref);
+            vector<string> sug = sys.suggest_stops(pref);
+            cout << "Suggestions:\n";
+            for (size_t i = 0; i < sug.size(); ++i)
+                cout << "  " << sug[i] << "\n";
+        }
+        else if (ch == 15)
+        {
+            bool ok = sys.save_changes();
+            cout << "Saved: " << (ok ? "ok" : "FAILED") << ", through change #" << sys.wal.nextLsn - 1 << " (log " << sys.wal.bytes
+                 << " bytes, snapshot at #" << sys.snapshotLsn << ")\n";
+        }
+        else if (ch == 16)
+        {
+            string sf = "data/stops.txt", ef = "data/edges.txt", bf = "data/buses.txt";
+            bool ok1 = sys.load_network_async(sf, ef).get();
+            if (ok1)
+            {
+                sys.adopt_network();
+                load_data_indexes(sys);
+            }
+            bool ok2 = sys.load_buses(bf);
+            // A wholesale reload cannot be expressed as log records; snapshot it instead
+            if ((ok1 || ok2) && sys.wal.is_open())
+                sys.compact_store();
+            cout << "Loaded graph: " << ok1 << " , buses: " << ok2 << "\n";
+        }
+        else if (ch == 17)
+        {
+            sys.print_history(30);
+        }
+        else if (ch == 18)
+        {
+            logger.print_recent(20);
+        }
+        else if (ch == 19)
+        {
+            cout << "Exiting. Goodbye!\n";
+            break;
+        }
+        else if (ch == 20)
+        {
+            string file;
+            cout << "Enter ping file path: ";
+            cin >> ws;
+            getline(cin, file);
+            FILE *fp = fopen(file.c_str(), "r");
+            if (!fp)
+                cout << "Could not open " << file << "\n";
+            else
+            {
+                PingIngestor ing(sys);
+                ing.ingest_stream(fp);
+                fclose(fp);
+                cout << "Ingested: " << ing.stats() << "\n";
+            }
+        }
+        else if (ch == 21)
+        {
+            string origin;
+            double budget;
+            cout << "Enter origin stop: ";
+            cin >> ws;
+            getline(cin, origin);
+            cout << "Enter time budget in minutes (double): ";
+            cin >> budget;
+            Isochrone iso = sys.isochrone(origin, budget, true);
+            if (iso.origin < 0)
+                cout << "Unknown stop.\n";
+            else
+            {
+                cout << "Reachable within " << budget << " minutes: " << iso.reachable.size() << " stops\n";
+                for (size_t i = 0; i < iso.reachable.size(); ++i)
+                    cout << "  " << sys.g.get_name(iso.reachable[i].first) << " (" << iso.reachable[i].second << ")\n";
+                cout << "Boundary edges:\n";
+                for (size_t i = 0; i < iso.boundary.size(); ++i)
+                    cout << "  " << sys.g.get_name(iso.boundary[i].first) << " -> " << sys.g.get_name(iso.boundary[i].second) << "\n";
+            }
+        }
+        else if (ch == 22)
+        {
+            string a, b;
+            int k;
+            cout << "Enter source stop: ";
+            cin >> ws;
+            getline(cin, a);
+            cout << "Enter destination stop: ";
+            cin >> ws;
+            getline(cin, b);
+            cout << "Enter number of routes k: ";
+            cin >> k;
+            vector<pair<double, vector<NameView>>> routes = sys.alternative_routes_names(a, b, k);
+            if (routes.empty())
+                cout << "No path.\n";
+            for (size_t r = 0; r < routes.size(); ++r)
+            {
+                cout << "Route " << r + 1 << " cost (minutes): " << routes[r].first << "\nPath: ";
+                for (size_t i = 0; i < routes[r].second.size(); ++i)
+                    cout << routes[r].second[i] << (i + 1 < routes[r].second.size() ? " -> " : "\n");
+            }
+        }
+        else if (ch == 23)
+        {
+            cout << sys.metrics_text();
+        }
+        else if (ch == 24)
+        {
+            string stop;
+            cout << "Enter stop name: ";
+            cin >> ws;
+            getline(cin, stop);
+            vector<BoardEntry> board = sys.departure_board(stop);
+            if (board.empty())
+                cout << "No buses heading for this stop.\n";
+            for (size_t i = 0; i < board.size(); ++i)
+                cout << board[i].busId << " in " << board[i].eta << " min (" << board[i].stopsAway << " stops away)\n";
+        }
+        else if (ch == 25)
+        {
+            string sf = "data/stops.txt", ef = "data/edges.txt", bf = "data/buses.txt";
+            make_dir("data");
+            bool ok1 = sys.g.save_to(sf, ef);
+            bool ok2 = sys.save_buses(bf);
+            cout << "Exported graph: " << ok1 << " , buses: " << ok2 << "\n";
+        }
+        else if (ch == 26)
+        {
+            string name;
+            StopOrder order;
+            cout << "Order (hilbert, bfs, rcm): ";
+            cin >> name;
+            if (!parse_stop_order(name, order))
+                cout << "Unknown order.\n";
+            else
+            {
+                sys.renumber_stops(order);
+                cout << "Renumbered " << sys.g.size() << " stops; stop ids shown and saved are unchanged.\n";
+            }
+        }
+        else if (ch == 27)
+            sys.print_critical_links(cout, 20);
+        else if (ch == 28)
+        {
+            string a, b;
+            cout << "Enter first stop: ";
+            cin >> ws;
+            getline(cin, a);
+            cout << "Enter second stop: ";
+            getline(cin, b);
+            StopID u = sys.g.get_id(a), v = sys.g.get_id(b);
+            if (u == (StopID)-1 || v == (StopID)-1)
+                cout << "Unknown stop.\n";
+            else
+            {
+                RerouteReport r = sys.close_roads(vector<pair<StopID, StopID>>(1, make_pair(u, v)));
+                cout << "Closed " << r.closedEdges << " edges; rerouted " << r.rerouted << " of " << r.affected << " buses (+" << r.extraMinutes
+                     << " min)\n";
+                for (size_t i = 0; i < r.stranded.size(); ++i)
+                    cout << "  no detour for " << r.stranded[i] << "; held at its stop until the road reopens\n";
+            }
+        }
+        else if (ch == 29)
+        {
+            string a, b;
+            cout << "Closed roads:\n";
+            for (auto it = sys.closedRoads.begin(); it != sys.closedRoads.end(); ++it)
+                cout << "  " << sys.g.get_name(it->first.first) << " -> " << sys.g.get_name(it->first.second) << "\n";
+            cout << "Enter first stop: ";
+            cin >> ws;
+            getline(cin, a);
+            cout << "Enter second stop: ";
+            getline(cin, b);
+            size_t freed = 0;
+            size_t n = sys.reopen_roads(vector<pair<StopID, StopID>>(1, make_pair(sys.g.get_id(a), sys.g.get_id(b))), false, &freed);
+            if (n == 0)
+                cout << "That road is not closed.\n";
+            else
+                cout << "Reopened " << n << " edges; rerouted buses keep their detours; " << freed << " held buses running again.\n";
+        }
+        else
+        {
+            cout << "Unknown choice.\n";
+        }
+    }
+}
+
+// Command-line tools (run instead of the interactive CLI)
+// Network for tools: data/*.txt when present, otherwise the demo dataset
+void load_tool_network(BusSystem &sys)
+{
+    ifstream probe("data/buses.txt");
+    if (probe && sys.g.load_from("data/stops.txt", "data/edges.txt") && sys.load_buses("data/buses.txt"))
+    {
+        for (size_t i = 0; i < sys.g.size(); ++i)
+            sys.trie.insert(sys.g.get_name((StopID)i));
+        cout << "Network: data/*.txt (" << sys.g.size() << " stops, " << sys.buses.size() << " buses)\n";
+        load_data_indexes(sys);
+        return;
+    }
+    build_sample_data(sys);
+    cout << "Network: demo dataset\n";
+}
+
+double seconds_since(chrono::steady_clock::time_point t0)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+}
+
+// Resident set size, 0 where /proc is unavailable
+size_t rss_bytes()
+{
+#ifndef _WIN32
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (!fp)
+        return 0;
+    long pages = 0, resident = 0;
+    int got = fscanf(fp, "%ld %ld", &pages, &resident);
+    fclose(fp);
+    return got == 2 ? (size_t)resident * (size_t)sysconf(_SC_PAGESIZE) : 0;
+#else
+    return 0;
+#endif
+}
+
+// Hardware event counter for this thread (Linux perf_event); reads 0 where unavailable
+struct PerfCounter
+{
+    int fd;
+    PerfCounter() : fd(-1) {}
+    ~PerfCounter()
+    {
+#ifdef __linux__
+        if (fd >= 0)
+            close(fd);
+#endif
+    }
+
+    // type/config as in perf_event_attr, e.g. PERF_TYPE_HARDWARE / PERF_COUNT_HW_CACHE_MISSES
+    bool open_event(uint32_t type, uint64_t config)
+    {
+#ifdef __linux__
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+        (void)type;
+        (void)config;
+#endif
+        return fd >= 0;
+    }
+
+    void start()
+    {
+#ifdef __linux__
+        if (fd >= 0)
+        {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    uint64_t stop()
+    {
+        uint64_t count = 0;
+#ifdef __linux__
+        if (fd >= 0)
+        {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd, &count, sizeof(count)) != (ssize_t)sizeof(count))
+                count = 0;
+        }
+#endif
+        return count;
+    }
+};
+
+// Dijkstra and A* under different stop numberings: same answers, different memory traffic
+int bench_layout(size_t n, size_t queries)
+{
+    Graph base;
+    generate_city_graph(base, CityParams(n));
+    n = base.size();
+    // The generator numbers stops row by row, which is already fairly local; a feed that
+    // lists stops in arbitrary order is modelled by a random permutation
+    mt19937 rng(41);
+    vector<StopID> shuffled(n);
+    for (size_t i = 0; i < n; ++i)
+        shuffled[i] = (StopID)i;
+    shuffle(shuffled.begin(), shuffled.end(), rng);
+    base.permute(shuffled);
+    uniform_int_distribution<int> pick(0, (int)n - 1);
+    vector<pair<StopID, StopID>> pairs(queries); // external ids
+    for (size_t q = 0; q < queries; ++q)
+        pairs[q] = make_pair(pick(rng), pick(rng));
+
+    PerfCounter l1, llc;
+    bool counters = false;
+#ifdef __linux__
+    counters = llc.open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    l1.open_event(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+#endif
+    cout << "Stop layout benchmark: " << n << " stops, " << count_edges(base) << " edges, " << queries << " Dijkstra + A* queries per layout"
+         << (counters ? "" : " (hardware counters unavailable)") << "\n";
+
+    const char *labels[] = {"scattered", "hilbert", "bfs", "rcm"};
+    double baseD = 0, baseA = 0;
+    vector<double> expect(queries), expectA(queries);
+    bool ok = true;
+    for (int layout = 0; layout < 4; ++layout)
+    {
+        Graph g = base;
+        if (layout > 0)
+        {
+            chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+            g.permute(locality_order(g, (StopOrder)(layout - 1)));
+            cout << labels[layout] << " renumbering: " << seconds_since(t0) * 1e3 << " ms\n";
+        }
+        // Average id distance along edges: small means neighbours share cache lines
+        double gap = 0;
+        for (size_t u = 0; u < n; ++u)
+            for (size_t j = 0; j < g.adj[u].size(); ++j)
+                gap += abs((long)g.adj[u][j].to - (long)u);
+        gap /= max((size_t)1, count_edges(g));
+
+        uint64_t missD = 0, missA = 0, l1D = 0, l1A = 0;
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        llc.start();
+        l1.start();
+        for (size_t q = 0; q < queries; ++q)
+        {
+            StopID s = g.internal_id(pairs[q].first), t = g.internal_id(pairs[q].second);
+            double d = dijkstra(g, s).first[t];
+            if (layout == 0)
+                expect[q] = d;
+            ok = ok && fabs(d - expect[q]) <= 1e-9 * max(1.0, d);
+        }
+        missD = llc.stop();
+        l1D = l1.stop();
+        double secD = seconds_since(t0) / queries;
+        t0 = chrono::steady_clock::now();
+        llc.start();
+        l1.start();
+        for (size_t q = 0; q < queries; ++q)
+        {
+            StopID s = g.internal_id(pairs[q].first), t = g.internal_id(pairs[q].second);
+            AStarResult r = astar(g, s, t);
+            double c = r.found ? r.cost : -1;
+            if (layout == 0)
+                expectA[q] = c;
+            ok = ok && fabs(c - expectA[q]) <= 1e-9 * max(1.0, fabs(c));
+        }
+        missA = llc.stop();
+        l1A = l1.stop();
+        double secA = seconds_since(t0) / queries;
+        if (layout == 0)
+        {
+            baseD = secD;
+            baseA = secA;
+        }
+        cout << setw(9) << labels[layout] << ": mean edge id gap " << setw(8) << gap << ", dijkstra " << secD * 1e3 << " ms (" << baseD / secD
+             << "x), A* " << secA * 1e3 << " ms (" << baseA / secA << "x)";
+        if (counters)
+            cout << ", cache misses/query: dijkstra " << missD / queries << " LLC / " << l1D / queries << " L1D, A* " << missA / queries
+                 << " LLC / " << l1A / queries << " L1D";
+        cout << "\n";
+    }
+    cout << (ok ? "answers identical in every layout\n" : "MISMATCH\n");
+    return ok ? 0 : 1;
+}
+
+// Name storage: arena + open-addressing map vs one std::string per stop in an unordered_map
+int bench_names(size_t n, size_t lookups)
+{
+    const char *streets[] = {"Main Street", "Oak Avenue", "Harbour Road", "Station Square", "Market Lane", "Elm Boulevard", "Kings Way", "River Drive"};
+    vector<string> names(n);
+    for (size_t i = 0; i < n; ++i)
+        names[i] = string(streets[i % 8]) + " & " + streets[(i / 8) % 8] + " #" + to_string(i);
+    mt19937 rng(5);
+    uniform_int_distribution<size_t> pick(0, n - 1);
+    vector<string> queries(lookups);
+    vector<StopID> expect(lookups);
+    for (size_t q = 0; q < lookups; ++q)
+    {
+        expect[q] = (StopID)pick(rng);
+        queries[q] = q % 4 == 0 ? " " + names[expect[q]] + " " : names[expect[q]]; // some need trimming
+    }
+    cout << "Name storage benchmark: " << n << " stops, " << lookups << " lookups\n";
+
+    size_t rss0 = rss_bytes();
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    Graph g;
+    g.stops.reserve(n);
+    g.adj.reserve(n);
+    for (size_t i = 0; i < n; ++i)
+        g.add_stop(names[i]);
+    double buildNew = seconds_since(t0);
+    size_t rssNew = rss_bytes() - rss0;
+
+    // The previous layout: Stop owned a std::string, and nameToId held a second copy
+    struct LegacyStop
+    {
+        StopID id;
+        string name;
+        Point loc;
+    };
+    rss0 = rss_bytes();
+    t0 = chrono::steady_clock::now();
+    vector<LegacyStop> legacyStops;
+    vector<vector<Edge>> legacyAdj;
+    legacyStops.reserve(n);
+    legacyAdj.reserve(n);
+    unordered_map<string, StopID> legacy;
+    for (size_t i = 0; i < n; ++i)
+    {
+        string tn = trim(names[i]);
+        if (legacy.count(tn))
+            continue;
+        LegacyStop s;
+        s.id = (StopID)i;
+        s.name = tn;
+        s.loc = Point{0, 0};
+        legacyStops.push_back(s);
+        legacy[tn] = (StopID)i;
+        legacyAdj.emplace_back();
+    }
+    double buildOld = seconds_since(t0);
+    size_t rssOld = rss_bytes() - rss0;
+
+    bool ok = true;
+    t0 = chrono::steady_clock::now();
+    for (size_t q = 0; q < lookups; ++q)
+        ok = ok && g.get_id(queries[q]) == expect[q];
+    double lookNew = seconds_since(t0);
+    t0 = chrono::steady_clock::now();
+    for (size_t q = 0; q < lookups; ++q)
+    {
+        unordered_map<string, StopID>::const_iterator it = legacy.find(trim(queries[q]));
+        ok = ok && it != legacy.end() && it->second == expect[q];
+    }
+    double lookOld = seconds_since(t0);
+
+    cout << "graph, arena + NameMap:        build " << buildNew << " s, " << rssNew / 1048576.0 << " MiB resident (arena "
+         << g.names->reserved_bytes() / 1048576.0 << " MiB, map " << g.nameToId.memory_bytes() / 1048576.0 << " MiB, stops "
+         << g.stops.capacity() * sizeof(Stop) / 1048576.0 << " MiB)\n";
+    cout << "graph, strings + unordered_map: build " << buildOld << " s, " << rssOld / 1048576.0 << " MiB resident\n";
+    cout << "lookups: arena " << lookups / lookNew / 1e6 << " M/s, legacy (trim + find) " << lookups / lookOld / 1e6 << " M/s\n";
+    cout << (ok ? "all lookups agree\n" : "MISMATCH\n");
+    return ok ? 0 : 1;
+}
+
+// Prim (single tree) vs parallel Boruvka forest on a connected random network
+int bench_mst(size_t n, int threads)
+{
+    Graph g;
+    generate_city_graph(g, CityParams(n));
+    cout << "MST benchmark: " << g.size() << " stops, " << SegmentIndex::edge_count(g) << " directed edges\n";
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    pair<double, vector<pair<StopID, StopID>>> prim = prim_mst(g);
+    double primSecs = seconds_since(t0);
+    cout << "prim_mst: " << primSecs << " s, total " << prim.first << "\n";
+    bool ok = true;
+    for (int t = 1; t <= threads; t *= 2)
+    {
+        t0 = chrono::steady_clock::now();
+        SpanningForest f = minimum_spanning_forest(g, t);
+        double secs = seconds_since(t0);
+        bool same = fabs(f.total - prim.first) <= 1e-6 * max(1.0, prim.first);
+        ok = ok && same;
+        cout << "forest threads=" << t << ": " << secs << " s, total " << f.total << ", components " << f.componentSize.size()
+             << ", speedup vs prim " << (secs > 0 ? primSecs / secs : 0) << (same ? "" : "  MISMATCH") << "\n";
+    }
+    return ok ? 0 : 1;
+}
+
+// Replay a Zipf-distributed origin-destination workload through BusSystem with and without the route cache
+int bench_cache(size_t n, size_t queries, double s, int threads)
+{
+    BusSystem sys;
+    generate_city_graph(sys.g, CityParams(n));
+    n = sys.g.size(); // the generator lands near n, not on it
+    size_t pairs = 5000;
+    mt19937 rng(11);
+    uniform_int_distribution<int> pick(0, (int)n - 1);
+    vector<pair<string, string>> od(pairs);
+    for (size_t i = 0; i < pairs; ++i)
+        od[i] = make_pair(sys.g.get_name(pick(rng)), sys.g.get_name(pick(rng)));
+    // Zipf over pair rank: P(k) ~ 1/k^s
+    vector<double> cdf(pairs);
+    double acc = 0;
+    for (size_t k = 0; k < pairs; ++k)
+        cdf[k] = (acc += 1.0 / pow((double)(k + 1), s));
+    vector<int> workload(queries);
+    uniform_real_distribution<double> u(0, acc);
+    for (size_t q = 0; q < queries; ++q)
+        workload[q] = (int)(lower_bound(cdf.begin(), cdf.end(), u(rng)) - cdf.begin());
+    cout << "Cache benchmark: " << n << " stops, " << queries << " queries over " << pairs << " pairs, zipf s=" << s << ", threads=" << threads << "\n";
+
+    // Uncached baseline on a prefix of the workload
+    size_t coldQueries = min(queries, (size_t)500);
+    sys.routeCache = RouteCache(0);
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    vector<double> expect(coldQueries);
+    for (size_t q = 0; q < coldQueries; ++q)
+        expect[q] = sys.shortest_path_names(od[workload[q]].first, od[workload[q]].second).first;
+    double coldQps = coldQueries / max(1e-9, seconds_since(t0));
+    cout << "uncached: " << coldQps << " queries/s\n";
+
+    sys.routeCache = RouteCache(2048);
+    t0 = chrono::steady_clock::now();
+    parallel_for(queries, threads, [&](size_t b, size_t e, int)
+    {
+        for (size_t q = b; q < e; ++q)
+            sys.shortest_path_names(od[workload[q]].first, od[workload[q]].second);
+    });
+    double warmQps = queries / max(1e-9, seconds_since(t0));
+    cout << "cached:   " << warmQps << " queries/s, speedup " << warmQps / coldQps << "\n";
+    cout << "cache:    " << sys.routeCache.stats() << "\n";
+
+    bool ok = true;
+    for (size_t q = 0; q < coldQueries; ++q)
+        ok = ok && sys.shortest_path_names(od[workload[q]].first, od[workload[q]].second).first == expect[q];
+    // An edit bumps the graph version, so every cached answer must miss afterwards
+    uint64_t missesBefore = sys.routeCache.misses;
+    sys.add_route_by_names(od[0].first, od[0].second, 1.0);
+    sys.shortest_path_names(od[workload[0]].first, od[workload[0]].second);
+    ok = ok && sys.routeCache.misses == missesBefore + 1;
+    cout << (ok ? "results match uncached answers; edit invalidated cache\n" : "MISMATCH\n");
+    return ok ? 0 : 1;
+}
+
+// Isochrone sweeps: repeated Dijkstra vs PHAST (single and batched sources)
+int bench_isochrone(size_t n, size_t origins)
+{
+    Graph g;
+    generate_city_graph(g, CityParams(n));
+    n = g.size(); // the generator lands near n, not on it
+    cout << "Isochrone benchmark: " << n << " stops, " << origins << " origins\n";
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    ContractionHierarchy ch;
+    ch.build(g);
+    cout << "hierarchy build: " << seconds_since(t0) << " s, " << ch.shortcuts << " shortcuts\n";
+    mt19937 rng(5);
+    uniform_int_distribution<int> pick(0, (int)n - 1);
+    vector<StopID> src(origins);
+    for (size_t i = 0; i < origins; ++i)
+        src[i] = pick(rng);
+
+    vector<vector<double>> ref(origins);
+    t0 = chrono::steady_clock::now();
+    for (size_t i = 0; i < origins; ++i)
+        ref[i] = dijkstra(g, src[i]).first;
+    double dijSecs = seconds_since(t0);
+    cout << "dijkstra:     " << dijSecs / origins * 1e3 << " ms/origin\n";
+
+    bool ok = true;
+    t0 = chrono::steady_clock::now();
+    for (size_t i = 0; i < origins; ++i)
+    {
+        vector<double> d = ch.one_to_all(src[i]);
+        for (size_t v = 0; v < n && ok; ++v)
+            ok = fabs(d[v] - ref[i][v]) <= 1e-6 * max(1.0, ref[i][v]);
+    }
+    double singleSecs = seconds_since(t0);
+    cout << "phast single: " << singleSecs / origins * 1e3 << " ms/origin, speedup " << dijSecs / singleSecs << "\n";
+
+    t0 = chrono::steady_clock::now();
+    for (size_t b = 0; b < origins; b += ContractionHierarchy::BATCH)
+    {
+        vector<StopID> batch(src.begin() + b, src.begin() + min(origins, b + ContractionHierarchy::BATCH));
+        vector<vector<double>> d;
+        ch.one_to_all_batch(batch, d);
+        for (size_t k = 0; k < d.size(); ++k)
+            for (size_t v = 0; v < n && ok; ++v)
+                ok = fabs(d[k][v] - ref[b + k][v]) <= 1e-6 * max(1.0, ref[b + k][v]);
+    }
+    double batchSecs = seconds_since(t0);
+    cout << "phast x" << ContractionHierarchy::BATCH << ":     " << batchSecs / origins * 1e3 << " ms/origin, speedup " << dijSecs / batchSecs << "\n";
+    cout << (ok ? "distances match dijkstra\n" : "MISMATCH\n");
+    return ok ? 0 : 1;
+}
+
+// Per-query latency of k alternative routes between random stop pairs
+int bench_alternatives(size_t n, size_t queries, int k)
+{
+    Graph g;
+    generate_city_graph(g, CityParams(n));
+    n = g.size(); // the generator lands near n, not on it
+    CompactGraph cg;
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    cg.build(g);
+    cout << "Alternatives benchmark: " << n << " stops, k=" << k << ", compact build " << seconds_since(t0) << " s\n";
+    SearchWorkspace ws;
+    mt19937 rng(3);
+    uniform_int_distribution<int> pick(0, (int)n - 1);
+    vector<double> lat;
+    size_t found = 0;
+    bool ok = true;
+    for (size_t q = 0; q < queries; ++q)
+    {
+        StopID s = pick(rng), t = pick(rng);
+        t0 = chrono::steady_clock::now();
+        vector<AlternativeRoute> routes = k_alternative_routes(cg, ws, s, t, k);
+        lat.push_back(seconds_since(t0) * 1e3);
+        found += routes.size();
+        // The first route must be a true shortest path
+        if (q < 10 && !routes.empty())
+        {
+            double ref = dijkstra(g, s).first[t];
+            ok = ok && fabs(ref - routes[0].cost) <= 1e-6 * max(1.0, ref);
+        }
+    }
+    sort(lat.begin(), lat.end());
+    double sum = 0;
+    for (size_t i = 0; i < lat.size(); ++i)
+        sum += lat[i];
+    cout << "routes/query: " << (double)found / queries << "\n";
+    cout << "latency ms: avg " << sum / lat.size() << ", p50 " << lat[lat.size() / 2] << ", p95 " << lat[lat.size() * 95 / 100] << ", max " << lat.back() << "\n";
+    cout << (ok ? "first routes match dijkstra\n" : "MISMATCH\n");
+    return ok ? 0 : 1;
+}
+
+#ifndef _WIN32
+// Partition quality and sharded routing checked against single-process Dijkstra
+int bench_sharded(size_t n, int k, size_t queries)
+{
+    Graph g;
+    generate_city_graph(g, CityParams(n));
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    ShardCoordinator coord;
+    if (!coord.start(g, k))
+    {
+        cout << "Could not start shards\n";
+        return 1;
+    }
+    double startSecs = seconds_since(t0);
+    vector<size_t> sizes(coord.parts.k, 0);
+    for (size_t v = 0; v < g.size(); ++v)
+        sizes[coord.parts.part[v]]++;
+    cout << "Sharded routing: " << g.size() << " stops, " << coord.parts.k << " shards\n";
+    cout << "cut edges: " << coord.parts.cutEdges << ", imbalance: " << coord.parts.imbalance << ", part sizes:";
+    for (size_t p = 0; p < sizes.size(); ++p)
+        cout << " " << sizes[p];
+    cout << "\noverlay: " << coord.boundary_count() << " boundary stops, " << coord.overlay_edges() << " edges; startup " << startSecs << " s\n";
+    mt19937 rng(11);
+    uniform_int_distribution<int> pick(0, (int)g.size() - 1);
+    double shardSecs = 0, localSecs = 0;
+    size_t cross = 0;
+    bool ok = true;
+    for (size_t q = 0; q < queries; ++q)
+    {
+        StopID s = pick(rng), t = pick(rng);
+        cross += coord.parts.part[s] != coord.parts.part[t];
+        t0 = chrono::steady_clock::now();
+        pair<double, vector<StopID>> r = coord.route(s, t);
+        shardSecs += seconds_since(t0);
+        t0 = chrono::steady_clock::now();
+        double ref = dijkstra(g, s).first[t];
+        localSecs += seconds_since(t0);
+        if (ref > 1e17)
+        {
+            ok = ok && r.first < 0;
+            continue;
+        }
+        bool good = fabs(ref - r.first) <= 1e-9 * max(1.0, ref) && !r.second.empty() && r.second.front() == s && r.second.back() == t;
+        // The returned stops must walk real edges adding up to the cost
+        double walked = 0;
+        for (size_t i = 0; good && i + 1 < r.second.size(); ++i)
+        {
+            double best = -1;
+            for (size_t j = 0; j < g.adj[r.second[i]].size(); ++j)
+                if (g.adj[r.second[i]][j].to == r.second[i + 1] && (best < 0 || g.adj[r.second[i]][j].weight < best))
+                    best = g.adj[r.second[i]][j].weight;
+            good = best >= 0;
+            walked += best;
+        }
+        good = good && fabs(walked - ref) <= 1e-9 * max(1.0, ref);
+        if (!good)
+            cout << "query " << s << " -> " << t << ": sharded " << r.first << ", dijkstra " << ref << "\n";
+        ok = ok && good;
+    }
+    cout << queries << " queries (" << cross << " cross-partition): sharded " << shardSecs / queries * 1e3 << " ms/query, single-process "
+         << localSecs / queries * 1e3 << " ms/query\n";
+    cout << (ok ? "all answers match dijkstra\n" : "MISMATCH\n");
+    return ok ? 0 : 1;
+}
+
+// Serve data/*.txt from k shard processes: one "source<TAB>destination" query per stdin line
+int serve_sharded(BusSystem &sys, int k)
+{
+    ShardCoordinator coord;
+    if (!coord.start(sys.g, k))
+    {
+        cout << "Could not start shards\n";
+        return 1;
+    }
+    cout << "Serving " << sys.g.size() << " stops from " << coord.parts.k << " shards (" << coord.parts.cutEdges << " cut edges, "
+         << coord.boundary_count() << " boundary stops)\n";
+    cout.flush();
+    string line;
+    while (getline(cin, line))
+    {
+        if (trim_view(line).empty())
+            continue;
+        size_t tab = line.find('\t');
+        if (tab == string::npos)
+        {
+            cout << "Expected: source<TAB>destination\n";
+            continue;
+        }
+        pair<double, vector<NameView>> res = coord.shortest_path_names(NameView(line.data(), tab), NameView(line.data() + tab + 1, line.size() - tab - 1));
+        if (res.first < 0)
+            cout << "No path.\n";
+        else
+        {
+            cout << "Cost (minutes): " << res.first << "\nPath: ";
+            for (size_t i = 0; i < res.second.size(); ++i)
+                cout << res.second[i] << (i + 1 < res.second.size() ? " -> " : "\n");
+        }
+        cout.flush();
+    }
+    return 0;
+}
+#endif
+
+// One writer batch: a few new stops wired into the network, plus a moved stop
+void snapshot_edit_batch(Graph &g, mt19937 &rng, int batch)
+{
+    uniform_int_distribution<int> pick(0, (int)g.size() - 1);
+    for (int i = 0; i < batch; ++i)
+    {
+        StopID a = pick(rng), b = pick(rng);
+        StopID s = g.add_stop("Edit" + to_string(g.version) + "_" + to_string(i), g.get_loc(a).x, g.get_loc(a).y);
+        g.add_edge(s, a, 1.0 + rng() % 5, true);
+        g.add_edge(s, b, 1.0 + rng() % 5, true);
+    }
+    StopID m = pick(rng);
+    g.set_location(m, g.get_loc(m).x + 0.01, g.get_loc(m).y);
+}
+
+// Readers hammer snapshots while a writer publishes edit batches and background reloads;
+// every snapshot a reader sees must be internally consistent and serials must not go back
+int stress_snapshots(int readers, double seconds)
+{
+    Graph base;
+    generate_city_graph(base, CityParams(3000));
+    string sf = "snapshot_stress_stops.txt", ef = "snapshot_stress_edges.txt";
+    if (!base.save_to(sf, ef))
+    {
+        cout << "Could not write " << sf << "\n";
+        return 1;
+    }
+    size_t baseStops = base.size();
+    SnapshotStore store;
+    store.publish(base);
+    atomic<bool> done(false);
+    atomic<size_t> reads(0), failures(0);
+    vector<thread> pool;
+    for (int r = 0; r < readers; ++r)
+    {
+        pool.push_back(thread([&, r]() {
+            mt19937 rng(100 + r);
+            uint64_t lastSerial = 0;
+            while (!done.load())
+            {
+                SnapshotStore::Reader rd(store);
+                const Graph &g = rd.graph();
+                bool ok = rd.serial() >= lastSerial && g.adj.size() == g.stops.size() && g.size() >= baseStops &&
+                          count_edges(g) == rd.snap->edges && g.nameToId.size() == g.size();
+                for (size_t u = 0; ok && u < g.adj.size(); u += 7)
+                    for (size_t j = 0; ok && j < g.adj[u].size(); ++j)
+                        ok = g.adj[u][j].to >= 0 && g.adj[u][j].to < (StopID)g.size();
+                StopID s = (StopID)(rng() % g.size()), t = (StopID)(rng() % g.size());
+                ok = ok && g.get_id(g.get_name(s)) == s;
+                AStarResult res = astar(g, s, t);
+                ok = ok && (!res.found || (res.path.front() == s && res.path.back() == t));
+                lastSerial = rd.serial();
+                if (!ok)
+                    failures++;
+                reads++;
+            }
+        }));
+    }
+    mt19937 rng(7);
+    size_t batches = 0, reloads = 0;
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    while (seconds_since(t0) < seconds)
+    {
+        if (++batches % 10 == 0)
+            reloads += store.load_async(sf, ef).get();
+        else
+            store.update([&](Graph &g) { snapshot_edit_batch(g, rng, 20); });
+    }
+    done.store(true);
+    for (size_t i = 0; i < pool.size(); ++i)
+        pool[i].join();
+    store.synchronize();
+    remove(sf.c_str());
+    remove(ef.c_str());
+    cout << "Snapshot stress: " << readers << " readers, " << seconds << " s\n";
+    cout << "published " << store.published << " snapshots (" << reloads << " background reloads), reclaimed " << store.reclaimed
+         << ", still retired " << store.retired.size() << "\n";
+    cout << "reader passes: " << reads.load() << ", inconsistent: " << failures.load() << "\n";
+    bool ok = failures.load() == 0 && store.retired.empty() && store.reclaimed == store.published;
+    cout << (ok ? "all snapshots consistent, all retired snapshots reclaimed\n" : "FAILED\n");
+    return ok ? 0 : 1;
+}
+
+// Reader latency with RCU snapshots vs one mutex around a graph edited in place
+int bench_snapshots(int readers, double seconds)
+{
+    Graph base;
+    generate_city_graph(base, CityParams(20000));
+    string sf = "snapshot_bench_stops.txt", ef = "snapshot_bench_edges.txt";
+    if (!base.save_to(sf, ef))
+    {
+        cout << "Could not write " << sf << "\n";
+        return 1;
+    }
+    cout << "Snapshot reader latency: " << base.size() << " stops, " << readers << " readers, " << seconds
+         << " s per mode; writer edits every 2 ms, reloads from files every 20th batch\n";
+    for (int mode = 0; mode < 2; ++mode)
+    {
+        SnapshotStore store;
+        store.publish(base);
+        Graph shared = base;
+        mutex lock;
+        atomic<bool> done(false);
+        vector<vector<double>> lat(readers);
+        vector<thread> pool;
+        for (int r = 0; r < readers; ++r)
+        {
+            pool.push_back(thread([&, r]() {
+                mt19937 rng(200 + r);
+                while (!done.load())
+                {
+                    StopID s = (StopID)(rng() % base.size()), t = (StopID)(rng() % base.size());
+                    chrono::steady_clock::time_point q0 = chrono::steady_clock::now();
+                    if (mode == 0)
+                    {
+                        SnapshotStore::Reader rd(store);
+                        astar(rd.graph(), s, t);
+                    }
+                    else
+                    {
+                        lock_guard<mutex> lk(lock);
+                        astar(shared, s, t);
+                    }
+                    lat[r].push_back(seconds_since(q0) * 1e3);
+                }
+            }));
+        }
+        mt19937 rng(9);
+        size_t batches = 0;
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        while (seconds_since(t0) < seconds)
+        {
+            bool rebuild = ++batches % 20 == 0;
+            if (mode == 0)
+            {
+                if (rebuild)
+                    store.load_async(sf, ef).get(); // built off to the side, swapped in
+                else
+                    store.update([&](Graph &g) { snapshot_edit_batch(g, rng, 5); });
+            }
+            else
+            {
+                lock_guard<mutex> lk(lock);
+                if (rebuild)
+                    shared.load_from(sf, ef); // readers wait for the whole reload
+                else
+                    snapshot_edit_batch(shared, rng, 5);
+            }
+            this_thread::sleep_for(chrono::milliseconds(2));
+        }
+        done.store(true);
+        for (size_t i = 0; i < pool.size(); ++i)
+            pool[i].join();
+        vector<double> all;
+        for (int r = 0; r < readers; ++r)
+            all.insert(all.end(), lat[r].begin(), lat[r].end());
+        sort(all.begin(), all.end());
+        if (all.empty())
+            continue;
+        cout << (mode == 0 ? "rcu snapshots: " : "mutex:         ") << all.size() << " queries, " << batches << " writer batches; latency ms p50 "
+             << all[all.size() / 2] << ", p99 " << all[all.size() * 99 / 100] << ", p99.9 " << all[all.size() * 999 / 1000] << ", max "
+             << all.back() << "\n";
+    }
+    remove(sf.c_str());
+    remove(ef.c_str());
+    return 0;
+}
+
+// Departure boards and on-route ETAs from the timetable, checked against a scan of every bus
+int bench_board(size_t n, size_t busCount, size_t queries)
+{
+    BusSystem sys;
+    CityParams p(n);
+    p.buses = busCount;
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    generate_city(sys, p);
+    cout << "Departure board benchmark: " << sys.g.size() << " stops, " << sys.buses.size() << " buses (generated in " << seconds_since(t0) << " s)\n";
+    // Spread the fleet along their routes
+    mt19937 rng(17);
+    for (unordered_map<string, Bus>::iterator it = sys.buses.begin(); it != sys.buses.end(); ++it)
+        it->second.currentIndex = (int)(rng() % it->second.route.size());
+    t0 = chrono::steady_clock::now();
+    sys.ensure_timetable();
+    cout << "timetable: " << sys.timetable.routes.size() << " routes, " << sys.timetable.postRoute.size() << " stop postings, built in "
+         << seconds_since(t0) * 1e3 << " ms\n";
+    uniform_int_distribution<int> pick(0, (int)sys.g.size() - 1);
+    vector<StopID> stops(queries);
+    for (size_t q = 0; q < queries; ++q)
+        stops[q] = pick(rng);
+    size_t listed = 0;
+    t0 = chrono::steady_clock::now();
+    for (size_t q = 0; q < queries; ++q)
+        listed += sys.timetable.board(stops[q]).size();
+    double secs = seconds_since(t0);
+    cout << queries << " board queries: " << queries / secs / 1e6 << " M queries/s, " << (double)listed / queries << " buses per board\n";
+
+    // Reference: walk every bus's remaining route and sum edge weights
+    bool ok = true;
+    for (size_t q = 0; q < 200 && q < queries; ++q)
+    {
+        map<string, double> expect;
+        for (unordered_map<string, Bus>::iterator it = sys.buses.begin(); it != sys.buses.end(); ++it)
+        {
+            const Bus &b = it->second;
+            double t = 0;
+            for (int i = b.currentIndex; b.active && i < (int)b.route.size(); ++i)
+            {
+                if (i > b.currentIndex)
+                {
+                    double w = 1e18;
+                    for (size_t j = 0; j < sys.g.adj[b.route[i - 1]].size(); ++j)
+                        if (sys.g.adj[b.route[i - 1]][j].to == b.route[i])
+                            w = min(w, sys.g.adj[b.route[i - 1]][j].weight);
+                    t += w;
+                }
+                if (b.route[i] == stops[q])
+                {
+                    expect[b.busId] = t;
+                    break;
+                }
+            }
+        }
+        vector<BoardEntry> got = sys.timetable.board(stops[q]);
+        ok = ok && got.size() == expect.size();
+        for (size_t i = 0; ok && i < got.size(); ++i)
+        {
+            map<string, double>::iterator e = expect.find(got[i].busId.str());
+            ok = e != expect.end() && fabs(e->second - got[i].eta) <= 1e-6 * max(1.0, e->second);
+        }
+    }
+    // On-route ETA: O(1) lookups vs the old Dijkstra from the bus's stop
+    vector<pair<string, string>> etaQ;
+    for (unordered_map<string, Bus>::iterator it = sys.buses.begin(); it != sys.buses.end() && etaQ.size() < 1000; ++it)
+        if (it->second.currentIndex + 1 < (int)it->second.route.size())
+            etaQ.push_back(make_pair(it->first, sys.g.get_name(it->second.route.back()).str()));
+    if (!etaQ.empty())
+    {
+        t0 = chrono::steady_clock::now();
+        double sum = 0;
+        for (size_t i = 0; i < etaQ.size(); ++i)
+            sum += sys.estimate_eta_for_bus(etaQ[i].first, etaQ[i].second);
+        double onRoute = seconds_since(t0) / etaQ.size();
+        t0 = chrono::steady_clock::now();
+        size_t sample = min((size_t)20, etaQ.size());
+        for (size_t i = 0; i < sample; ++i)
+            dijkstra(sys.g, sys.buses[etaQ[i].first].current_stop());
+        double full = seconds_since(t0) / sample;
+        cout << "bus ETA to end of route: on-route " << onRoute * 1e6 << " us, graph-wide dijkstra " << full * 1e6 << " us (avg "
+             << sum / etaQ.size() << " min)\n";
+    }
+    cout << (ok ? "boards match a scan of every bus\n" : "MISMATCH\n");
+    return ok ? 0 : 1;
+}
+
+template <class W>
+size_t edge_bytes(const BasicGraph<W> &g)
+{
+    return count_edges(g) * sizeof(BasicEdge<W>);
+}
+
+// Largest gap (minutes) between a reduced-precision Dijkstra and the double one, allowing the
+// rounding of each edge on the path
+template <class W>
+bool check_weights(const vector<double> &ref, const vector<int> &prev, const vector<W> &got, double perEdge, double &worst)
+{
+    bool ok = true;
+    for (size_t v = 0; v < ref.size(); v += 97)
+    {
+        if (ref[v] > 1e17)
+        {
+            ok = ok && WeightTraits<W>::to_minutes(got[v]) > 1e17;
+            continue;
+        }
+        size_t hops = 0;
+        for (int at = prev[v]; at != -1; at = prev[at])
+            hops++;
+        double err = fabs(WeightTraits<W>::to_minutes(got[v]) - ref[v]);
+        worst = max(worst, err);
+        ok = ok && err <= 1e-5 * ref[v] + perEdge * hops + 1e-9;
+    }
+    return ok;
+}
+
+// double vs float vs uint32 fixed-point weights: edge memory and one-to-all Dijkstra time
+int bench_weights(size_t n, size_t sources)
+{
+    Graph g;
+    generate_city_graph(g, CityParams(n));
+    FloatGraph gf;
+    gf.assign_from(g);
+    FixedGraph gx;
+    gx.assign_from(g);
+    size_t m = count_edges(g);
+    cout << "Weight types benchmark: " << g.size() << " stops, " << m << " edges, " << sources << " one-to-all searches each\n";
+    cout << "edge records: double " << edge_bytes(g) / 1048576.0 << " MiB, float " << edge_bytes(gf) / 1048576.0 << " MiB, fixed " << edge_bytes(gx) / 1048576.0 << " MiB\n";
+    cout << "distance arrays: double " << g.size() * 8 / 1048576.0 << " MiB, float/fixed " << g.size() * 4 / 1048576.0 << " MiB\n";
+    mt19937 rng(13);
+    uniform_int_distribution<int> pick(0, (int)g.size() - 1);
+    double secs[3] = {0, 0, 0}, worstF = 0, worstX = 0;
+    bool ok = true;
+    for (size_t q = 0; q < sources; ++q)
+    {
+        StopID s = pick(rng);
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        pair<vector<double>, vector<int>> rd = dijkstra(g, s);
+        secs[0] += seconds_since(t0);
+        t0 = chrono::steady_clock::now();
+        pair<vector<float>, vector<int>> rf = dijkstra(gf, s);
+        secs[1] += seconds_since(t0);
+        t0 = chrono::steady_clock::now();
+        pair<vector<uint32_t>, vector<int>> rx = dijkstra(gx, s);
+        secs[2] += seconds_since(t0);
+        ok = check_weights(rd.first, rd.second, rf.first, 0.0, worstF) && ok;
+        ok = check_weights(rd.first, rd.second, rx.first, 0.5 / WeightTraits<uint32_t>::SCALE, worstX) && ok;
+    }
+    cout << "double (binary heap):     " << secs[0] / sources * 1e3 << " ms/search\n";
+    cout << "float (binary heap):      " << secs[1] / sources * 1e3 << " ms/search, speedup " << secs[0] / secs[1] << "x, max error "
+         << worstF << " min\n";
+    cout << "fixed 0.1 s (radix heap): " << secs[2] / sources * 1e3 << " ms/search, speedup " << secs[0] / secs[2] << "x, max error "
+         << worstX << " min\n";
+    cout << (ok ? "reduced-precision distances within rounding bounds\n" : "MISMATCH\n");
+    return ok ? 0 : 1;
+}
+
+// Same distances as dijkstra(), and every prev edge tight (ties may pick another parent)
+bool same_sssp(const Graph &g, const pair<vector<double>, vector<int>> &ref, const pair<vector<double>, vector<int>> &got, StopID src)
+{
+    for (size_t v = 0; v < g.size(); ++v)
+    {
+        double a = ref.first[v], b = got.first[v];
+        if (a > 1e17 || b > 1e17)
+        {
+            if ((a > 1e17) != (b > 1e17))
+                return false;
+            continue;
+        }
+        if (fabs(a - b) > 1e-9 * max(1.0, a))
+            return false;
+        int p = got.second[v];
+        if ((StopID)v == src)
+        {
+            if (p != -1)
+                return false;
+            continue;
+        }
+        bool tight = false;
+        for (size_t j = 0; p >= 0 && j < g.adj[p].size() && !tight; ++j)
+            tight = g.adj[p][j].to == (StopID)v && fabs(got.first[p] + g.adj[p][j].weight - b) <= 1e-9 * max(1.0, b);
+        if (!tight)
+            return false;
+    }
+    return true;
+}
+
+// Delta-stepping vs Dijkstra, 1..maxThreads threads
+int bench_sssp(size_t n, int maxThreads, size_t sources)
+{
+    Graph g;
+    generate_city_graph(g, CityParams(n));
+    cout << "Delta-stepping benchmark: " << g.size() << " stops, " << count_edges(g) << " edges, " << sources << " sources, "
+         << hardware_threads() << " hardware threads\n";
+    mt19937 rng(29);
+    uniform_int_distribution<int> pick(0, (int)g.size() - 1);
+    vector<StopID> src(sources);
+    for (size_t i = 0; i < sources; ++i)
+        src[i] = pick(rng);
+    vector<pair<vector<double>, vector<int>>> ref(sources);
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    for (size_t i = 0; i < sources; ++i)
+        ref[i] = dijkstra(g, src[i]);
+    double dijkstraSecs = seconds_since(t0) / sources;
+    DeltaStepping ds;
+    t0 = chrono::steady_clock::now();
+    ds.tune(g, min(maxThreads, hardware_threads()), src[0]);
+    cout << "auto delta " << DeltaStepping::auto_delta(g) << ", tuned delta " << ds.delta << " (" << seconds_since(t0) << " s)\n";
+    cout << "dijkstra: " << dijkstraSecs * 1e3 << " ms/source\n";
+    bool ok = true;
+    double oneThread = 0;
+    for (int t = 1; t <= maxThreads; t *= 2)
+    {
+        t0 = chrono::steady_clock::now();
+        for (size_t i = 0; i < sources; ++i)
+        {
+            pair<vector<double>, vector<int>> got = ds.run(src[i], t);
+            ok = same_sssp(g, ref[i], got, src[i]) && ok;
+        }
+        double secs = seconds_since(t0) / sources;
+        if (t == 1)
+            oneThread = secs;
+        cout << "threads " << setw(2) << t << ": " << secs * 1e3 << " ms/source, speedup " << oneThread / secs << "x over 1 thread, "
+             << dijkstraSecs / secs << "x over dijkstra" << (t > hardware_threads() ? " (oversubscribed)" : "") << "\n";
+    }
+    cout << (ok ? "distances match dijkstra, all parents tight\n" : "MISMATCH\n");
+    return ok ? 0 : 1;
+}
+
+// Hub labels at several network sizes: build time, label size, memory and query latency
+int bench_labels(const vector<size_t> &sizes, size_t queries)
+{
+    cout << "Hub labeling benchmark: " << queries << " random distance queries per size\n";
+    bool ok = true;
+    for (size_t si = 0; si < sizes.size(); ++si)
+    {
+        BusSystem sys;
+        generate_city_graph(sys.g, CityParams(sizes[si]));
+        size_t n = sys.g.size();
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        sys.build_hub_labels();
+        double buildSecs = seconds_since(t0);
+        const HubLabels &hl = sys.hubs;
+        size_t maxLabel = 0;
+        for (size_t v = 0; v < n; ++v)
+            maxLabel = max(maxLabel, (size_t)(hl.outStart[v + 1] - hl.outStart[v] - 1));
+        double perLabel = (double)hl.entries() / n / (hl.symmetric ? 1 : 2);
+        cout << n << " stops, " << count_edges(sys.g) << " edges" << (hl.symmetric ? " (undirected)" : "") << ": built in " << buildSecs
+             << " s, " << perLabel << " hubs per label (max " << maxLabel << "), " << hl.memory_bytes() / 1048576.0 << " MiB ("
+             << (double)hl.memory_bytes() / n << " B/stop)\n";
+
+        mt19937 rng(31);
+        uniform_int_distribution<int> pick(0, (int)n - 1);
+        vector<pair<StopID, StopID>> pairs(queries);
+        for (size_t q = 0; q < queries; ++q)
+            pairs[q] = make_pair(pick(rng), pick(rng));
+        double sum = 0;
+        t0 = chrono::steady_clock::now();
+        for (size_t q = 0; q < queries; ++q)
+            sum += hl.distance(pairs[q].first, pairs[q].second);
+        double labelNs = seconds_since(t0) / queries * 1e9;
+        size_t named = min(queries, (size_t)200000);
+        vector<pair<string, string>> names(named);
+        for (size_t q = 0; q < named; ++q)
+            names[q] = make_pair(sys.g.get_name(pairs[q].first).str(), sys.g.get_name(pairs[q].second).str());
+        t0 = chrono::steady_clock::now();
+        for (size_t q = 0; q < named; ++q)
+            sum += sys.estimate_eta_between(names[q].first, names[q].second);
+        double namedNs = seconds_since(t0) / named * 1e9;
+
+        // Exactness against Dijkstra (labels hold floats, so allow float rounding)
+        size_t sources = 5;
+        t0 = chrono::steady_clock::now();
+        for (size_t i = 0; i < sources; ++i)
+        {
+            StopID s = pairs[i].first;
+            vector<double> ref = dijkstra(sys.g, s).first;
+            for (size_t t = 0; t < n; ++t)
+            {
+                double got = hl.distance(s, (StopID)t);
+                if (ref[t] > 1e17 || got > 1e17)
+                    ok = ok && (ref[t] > 1e17) == (got > 1e17);
+                else
+                    ok = ok && fabs(got - ref[t]) <= 1e-5 * max(1.0, ref[t]);
+            }
+        }
+        double dijkstraUs = seconds_since(t0) / sources * 1e6;
+        cout << "  query: labels " << labelNs << " ns, by name " << namedNs << " ns, dijkstra " << dijkstraUs << " us (checksum " << sum
+             << ")\n";
+
+        // Offline build, then load into a fresh process-like system
+        const char *file = "bench_labels.hub";
+        BusSystem other;
+        other.g = sys.g;
+        bool saved = hl.save(file);
+        bool loaded = saved && other.load_hub_labels(file);
+        for (size_t q = 0; loaded && q < min(queries, (size_t)10000); ++q)
+            loaded = other.hubs.distance(pairs[q].first, pairs[q].second) == hl.distance(pairs[q].first, pairs[q].second);
+        other.g.add_edge((StopID)0, (StopID)(n - 1), 1.0);
+        bool rejected = !other.hubs.load(file, other.g) && other.estimate_eta_between(other.g.get_name(0), other.g.get_name((StopID)n - 1)) <= 1.0;
+        remove(file);
+        cout << "  save/load " << (loaded ? "ok" : "FAILED") << ", edited network " << (rejected ? "falls back to dijkstra" : "NOT REJECTED") << "\n";
+        ok = ok && loaded && rejected;
+    }
+    cout << (ok ? "label distances match dijkstra\n" : "MISMATCH\n");
+    return ok ? 0 : 1;
+}
+
+// Everything the store must reproduce: stops, edges and every bus's route and position
+uint64_t network_digest(const BusSystem &sys)
+{
+    stringstream ss;
+    for (size_t i = 0; i < sys.g.size(); ++i)
+    {
+        ss << sys.g.stops[i].name << "\t" << fmt_double(sys.g.stops[i].loc.x) << "\t" << fmt_double(sys.g.stops[i].loc.y) << "\n";
+        for (size_t j = 0; j < sys.g.adj[i].size(); ++j)
+            ss << sys.g.adj[i][j].to << ":" << fmt_double(sys.g.adj[i][j].weight) << " ";
+    }
+    map<string, string> fleet;
+    for (auto it = sys.buses.begin(); it != sys.buses.end(); ++it)
+        fleet[it->first] = it->second.serialize() + (it->second.active ? "+" : "-");
+    for (map<string, string>::iterator it = fleet.begin(); it != fleet.end(); ++it)
+        ss << it->second << "\n";
+    return hash_name(ss.str());
+}
+
+// One random edit through the journaled BusSystem API
+void random_network_change(BusSystem &sys, mt19937 &rng, const vector<string> &busIds)
+{
+    uniform_int_distribution<int> pick(0, (int)sys.g.size() - 1);
+    int kind = (int)(rng() % 100);
+    if (kind < 65)
+        sys.move_bus_one_step(busIds[rng() % busIds.size()]);
+    else if (kind < 85)
+        sys.add_route_by_names(sys.g.get_name(pick(rng)).str(), sys.g.get_name(pick(rng)).str(), 1.0 + rng() % 600 / 60.0);
+    else if (kind < 95)
+        sys.add_stop_with_location("New stop " + to_string(sys.g.size()), (rng() % 10000) / 100.0, (rng() % 10000) / 100.0);
+    else
+    {
+        vector<string> route;
+        for (int i = 0; i < 5; ++i)
+            route.push_back(sys.g.get_name(pick(rng)).str());
+        sys.add_bus("X" + to_string(rng() % 1000000), route);
+    }
+}
+
+// Write-ahead log vs full rewrites: save cost, append throughput, recovery and a torn tail
+int bench_wal(size_t n, size_t changes)
+{
+    BusSystem sys;
+    generate_city(sys, CityParams(n));
+    vector<string> busIds;
+    for (auto it = sys.buses.begin(); it != sys.buses.end(); ++it)
+        busIds.push_back(it->first);
+    const string dir = "bench_store";
+    make_dir(dir);
+    remove((dir + "/network.snap").c_str());
+    remove((dir + "/network.wal").c_str());
+    cout << "Change log benchmark: " << sys.g.size() << " stops, " << count_edges(sys.g) << " edges, " << sys.buses.size() << " buses, "
+         << changes << " changes\n";
+
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    bool ok = sys.g.save_to(dir + "/stops.txt", dir + "/edges.txt") && sys.save_buses(dir + "/buses.txt");
+    double fullText = seconds_since(t0);
+    t0 = chrono::steady_clock::now();
+    ok = sys.open_store(dir) && ok;
+    double fullSnap = seconds_since(t0);
+    cout << "full save: text files " << fullText * 1e3 << " ms, binary snapshot " << fullSnap * 1e3 << " ms (" << sys.snapshotBytes / 1048576.0
+         << " MiB)\n";
+
+    mt19937 rng(37);
+    uint64_t syncs0 = sys.wal.syncs;
+    t0 = chrono::steady_clock::now();
+    for (size_t i = 0; i < changes; ++i)
+        random_network_change(sys, rng, busIds);
+    double perChange = seconds_since(t0) / changes;
+    t0 = chrono::steady_clock::now();
+    sys.compactMinBytes = (size_t)-1; // measure the log-only save
+    ok = sys.save_changes() && ok;
+    double save = seconds_since(t0);
+    cout << changes << " changes: " << perChange * 1e6 << " us/change including the edit (" << sys.wal.syncs - syncs0
+         << " fsyncs); save afterwards " << save * 1e3 << " ms (log " << sys.wal.bytes / 1048576.0 << " MiB)\n";
+
+    // The log on its own: group commit vs one fsync per record
+    string scratch = dir + "/scratch.wal";
+    string rec = "E\tR12C34\tR12C35\t2.5";
+    double perRecord[2];
+    uint64_t fsyncs[2];
+    size_t counts[2] = {max(changes, (size_t)10000), min(changes, (size_t)2000)};
+    for (int mode = 0; mode < 2; ++mode)
+    {
+        WriteAheadLog log;
+        remove(scratch.c_str());
+        ok = log.open(scratch, 1, 0) && ok;
+        log.syncBatch = mode == 0 ? log.syncBatch : 1;
+        t0 = chrono::steady_clock::now();
+        for (size_t i = 0; i < counts[mode]; ++i)
+            log.append(rec);
+        log.sync();
+        perRecord[mode] = seconds_since(t0) / counts[mode];
+        fsyncs[mode] = log.syncs;
+    }
+    remove(scratch.c_str());
+    cout << "log append: grouped " << perRecord[0] * 1e6 << " us/record (" << fsyncs[0] << " fsyncs for " << counts[0] << "), fsync each "
+         << perRecord[1] * 1e6 << " us/record\n";
+
+    uint64_t want = network_digest(sys);
+    BusSystem back;
+    size_t replayed = 0;
+    t0 = chrono::steady_clock::now();
+    bool recovered = back.open_store(dir, &replayed) && network_digest(back) == want;
+    cout << "recovery: snapshot + " << replayed << " changes in " << seconds_since(t0) * 1e3 << " ms, state " << (recovered ? "matches" : "DIFFERS")
+         << "\n";
+    back.wal.close();
+
+    // A crash mid-append leaves a torn record; recovery must drop it and nothing else
+    FILE *fp = fopen((dir + "/network.wal").c_str(), "ab");
+    bool torn = fp && fputs("999999\tS\tHalf written", fp) >= 0;
+    if (fp)
+        fclose(fp);
+    BusSystem afterCrash;
+    torn = torn && afterCrash.open_store(dir) && network_digest(afterCrash) == want;
+    afterCrash.wal.close();
+    cout << "torn tail: " << (torn ? "dropped" : "NOT HANDLED") << "\n";
+
+    t0 = chrono::steady_clock::now();
+    sys.wal.close();
+    BusSystem compacted;
+    bool folded = compacted.open_store(dir);
+    double reopenSecs = seconds_since(t0);
+    t0 = chrono::steady_clock::now();
+    folded = folded && compacted.compact_store();
+    double compactSecs = seconds_since(t0);
+    compacted.wal.close();
+    BusSystem fresh;
+    replayed = 1;
+    folded = folded && fresh.open_store(dir, &replayed) && replayed == 0 && network_digest(fresh) == want;
+    cout << "compaction: " << compactSecs * 1e3 << " ms (after a " << reopenSecs * 1e3 << " ms recovery), then recovery from the snapshot alone " << (folded ? "matches" : "DIFFERS") << "\n";
+    ok = ok && recovered && torn && folded;
+    cout << (ok ? "recovered state matches\n" : "MISMATCH\n");
+    return ok ? 0 : 1;
+}
+
+// Scenario throughput: forking the fleet vs copying the system state, 1..max threads,
+// and the same outcomes whatever the thread count
+int bench_scenarios(size_t n, size_t scenarios, int maxThreads)
+{
+    BusSystem sys;
+    generate_city(sys, CityParams(n));
+    for (size_t i = 0; i < sys.g.size(); ++i)
+        sys.trie.insert(sys.g.get_name((StopID)i));
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    ScenarioModel model;
+    model.build(sys);
+    double buildSecs = seconds_since(t0);
+    cout << "Scenario benchmark: " << sys.g.size() << " stops, " << sys.buses.size() << " buses, " << model.legMin.size() << " route legs on "
+         << model.streets << " streets, " << scenarios << " scenarios, " << hardware_threads() << " hardware threads\n";
+    cout << "shared model: " << buildSecs * 1e3 << " ms to build, " << model.memory_bytes() / 1048576.0 << " MiB\n";
+
+    // What a scenario would pay to copy the mutable state instead of forking the fleet
+    size_t copies = 20;
+    t0 = chrono::steady_clock::now();
+    for (size_t i = 0; i < copies; ++i)
+    {
+        Graph g(sys.g);
+        unordered_map<string, Bus> buses(sys.buses);
+        unordered_map<StopID, vector<string>> stopToBuses(sys.stopToBuses);
+        queue<string> history(sys.history);
+        Trie trie(sys.trie);
+        if (g.size() != sys.g.size() || buses.size() != sys.buses.size() || trie.root == sys.trie.root)
+            cout << "copy differs\n";
+    }
+    double copySecs = seconds_since(t0) / copies;
+    // A trie copy must survive its original
+    Trie *original = new Trie(sys.trie);
+    Trie copied(*original);
+    delete original;
+    bool ok = copied.suggest("").size() == sys.trie.suggest("").size();
+    vector<FleetBus> state;
+    size_t forks = 10000;
+    t0 = chrono::steady_clock::now();
+    for (size_t i = 0; i < forks; ++i)
+        state = model.fleet;
+    double forkSecs = seconds_since(t0) / forks;
+    cout << "per scenario: copying graph, buses, trie and history " << copySecs * 1e3 << " ms; forking the fleet " << forkSecs * 1e6 << " us ("
+         << model.fleet.size() * sizeof(FleetBus) << " bytes), " << copySecs / forkSecs << "x cheaper\n";
+
+    ScenarioParams p;
+    p.scenarios = scenarios;
+    vector<ScenarioOutcome> ref;
+    double oneThread = 0;
+    for (int t = 1; t <= maxThreads; t *= 2)
+    {
+        t0 = chrono::steady_clock::now();
+        vector<ScenarioOutcome> got = model.run(p, t);
+        double secs = seconds_since(t0);
+        if (t == 1)
+        {
+            oneThread = secs;
+            ref = got;
+        }
+        for (size_t i = 0; i < got.size(); ++i)
+            ok = ok && got[i].onTime == ref[i].onTime && got[i].meanDelay == ref[i].meanDelay && got[i].breakdowns == ref[i].breakdowns;
+        cout << "threads " << setw(2) << t << ": " << scenarios / secs << " scenarios/s, speedup " << oneThread / secs << "x"
+             << (t > hardware_threads() ? " (oversubscribed)" : "") << "\n";
+    }
+    print_scenario_summary(summarize_scenarios(ref), ref.size());
+
+    // Sanity: with no randomness every bus runs to schedule
+    ScenarioParams calm;
+    calm.scenarios = 4;
+    calm.congestionSigma = calm.noiseSigma = calm.breakdownsPerHour = 0;
+    vector<ScenarioOutcome> still = model.run(calm, 1);
+    for (size_t i = 0; i < still.size(); ++i)
+        ok = ok && still[i].onTime == 1.0f && still[i].breakdowns == 0;
+    cout << (ok ? "outcomes identical across thread counts, calm scenarios on time\n" : "MISMATCH\n");
+    return ok ? 0 : 1;
+}
+
+// The index's SCCs partition the stops like a fresh Tarjan pass, and every edge runs down
+// (or level with) the rank order, so reachable() never rejects a real path
+bool same_sccs(const Graph &g, const Connectivity &c)
+{
+    Connectivity fresh;
+    fresh.build(g);
+    bool ok = fresh.components == c.components && fresh.sccCount == c.sccCount;
+    map<int, int> mine, theirs;
+    for (size_t u = 0; ok && u < g.size(); ++u)
+    {
+        ok = mine.insert(make_pair(c.scc[u], fresh.scc[u])).first->second == fresh.scc[u] &&
+             theirs.insert(make_pair(fresh.scc[u], c.scc[u])).first->second == c.scc[u];
+        for (size_t j = 0; ok && j < g.adj[u].size(); ++j)
+            ok = c.rank[c.scc[u]] >= c.rank[c.scc[g.adj[u][j].to]];
+    }
+    return ok;
+}
+
+// Connectivity index: build time on a large city with an island and one-way spurs,
+// O(1) rejection vs searching, incremental upkeep, and bridges checked by brute force
+int bench_connectivity(size_t n, size_t queries)
+{
+    BusSystem sys;
+    generate_city(sys, CityParams(n));
+    size_t mainStops = sys.g.size();
+    // An island no road reaches, and dead-end spurs served one way only
+    size_t island = max((size_t)3, mainStops / 100), spurs = 64;
+    for (size_t i = 0; i < island; ++i)
+        sys.g.add_stop("Island" + to_string(i), 1e4 + (double)i, 1e4);
+    for (size_t i = 0; i < island; ++i)
+        sys.g.add_edge((StopID)(mainStops + i), (StopID)(mainStops + (i + 1) % island), 2.0);
+    mt19937 rng(43);
+    uniform_int_distribution<int> pickMain(0, (int)mainStops - 1);
+    for (size_t i = 0; i < spurs; ++i)
+    {
+        StopID s = sys.g.add_stop("Spur" + to_string(i));
+        sys.g.add_edge((StopID)pickMain(rng), s, 3.0, false);
+    }
+    cout << "Connectivity benchmark: " << sys.g.size() << " stops, " << count_edges(sys.g) << " edges (" << island << "-stop island, " << spurs
+         << " one-way spurs)\n";
+
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    sys.conn.build(sys.g);
+    double buildSecs = seconds_since(t0);
+    t0 = chrono::steady_clock::now();
+    sys.conn.ensure_cuts(sys.g);
+    double cutSecs = seconds_since(t0);
+    cout << "components + SCCs " << buildSecs * 1e3 << " ms, bridges + articulation " << cutSecs * 1e3 << " ms\n";
+    sys.print_critical_links(cout, 5);
+
+    // Unreachable pairs: into and out of the island, and back out of a spur
+    vector<pair<StopID, StopID>> od;
+    for (size_t q = 0; q < queries; ++q)
+    {
+        StopID m = pickMain(rng);
+        if (q % 3 == 0)
+            od.push_back(make_pair(m, (StopID)(mainStops + q % island)));
+        else if (q % 3 == 1)
+            od.push_back(make_pair((StopID)(mainStops + q % island), m));
+        else
+            od.push_back(make_pair((StopID)(mainStops + island + q % spurs), m));
+    }
+    bool ok = true;
+    t0 = chrono::steady_clock::now();
+    size_t rejected = 0;
+    for (size_t q = 0; q < od.size(); ++q)
+        rejected += !sys.conn.reachable(sys.g, od[q].first, od[q].second);
+    double rejectSecs = seconds_since(t0) / od.size();
+    size_t searched = min(od.size(), (size_t)20);
+    t0 = chrono::steady_clock::now();
+    for (size_t q = 0; q < searched; ++q)
+        ok = dijkstra(sys.g, od[q].first).first[od[q].second] >= 1e17 && ok;
+    double dijkstraSecs = seconds_since(t0) / searched;
+    t0 = chrono::steady_clock::now();
+    for (size_t q = 0; q < searched; ++q)
+        ok = !astar(sys.g, od[q].first, od[q].second).found && ok;
+    double astarSecs = seconds_since(t0) / searched;
+    ok = ok && rejected == od.size();
+    cout << "unreachable query: rejected " << rejected << "/" << od.size() << " in " << rejectSecs * 1e9 << " ns; dijkstra "
+         << dijkstraSecs * 1e3 << " ms, A* " << astarSecs * 1e3 << " ms to find nothing\n";
+
+    // Reachable pairs are never rejected
+    for (size_t q = 0; q < min(queries, (size_t)20); ++q)
+    {
+        StopID s = pickMain(rng), t = pickMain(rng);
+        ok = sys.conn.reachable(sys.g, s, t) == (dijkstra(sys.g, s).first[t] < 1e17) && ok;
+    }
+
+    // Incremental: new roads, the last one reaching the island, vs a rebuild
+    size_t edits = 1000;
+    t0 = chrono::steady_clock::now();
+    for (size_t i = 0; i < edits; ++i)
+    {
+        StopID a = pickMain(rng), b = i + 1 == edits ? (StopID)mainStops : pickMain(rng);
+        sys.add_route_by_names(sys.g.get_name(a), sys.g.get_name(b), 5.0);
+    }
+    double editSecs = seconds_since(t0) / edits;
+    // Checked before any query could rebuild the SCCs
+    bool incremental = !sys.conn.stale(sys.g) && sys.conn.sccCurrent;
+    ok = ok && incremental && same_sccs(sys.g, sys.conn);
+    cout << edits << " added roads: " << editSecs * 1e6 << " us each including the index update (components and SCCs "
+         << (incremental ? "kept current" : "left for a rebuild") << "), " << sys.conn.components << " components, " << sys.conn.sccCount
+         << " SCCs after linking the island\n";
+
+    // Small islands joined to the network one way or both ways, each without a rebuild
+    size_t joins = 200;
+    for (size_t i = 0; i < joins; ++i)
+    {
+        string a = "Isle" + to_string(i) + "a", b = "Isle" + to_string(i) + "b";
+        sys.add_route_by_names(a, b, 1.0);
+        StopID m = pickMain(rng);
+        if (i % 3 == 0)
+            sys.add_route_by_names(sys.g.get_name(m), a, 4.0);
+        else
+        {
+            uint64_t before = sys.g.version;
+            if (i % 3 == 1)
+                sys.g.add_edge(m, sys.g.get_id(a), 4.0, false);
+            else
+                sys.g.add_edge(sys.g.get_id(a), m, 4.0, false);
+            sys.conn.update(sys.g, before, i % 3 == 1 ? m : sys.g.get_id(a), i % 3 == 1 ? sys.g.get_id(a) : m, false);
+        }
+    }
+    bool joined = !sys.conn.stale(sys.g) && sys.conn.sccCurrent && same_sccs(sys.g, sys.conn);
+    cout << joins << " islands joined (one or two ways): " << (joined ? "SCCs kept current, match a rebuild" : "MISMATCH") << "\n";
+    ok = ok && joined;
+    // Inside one component, a spur made two-way merges SCCs the order cannot place: the next query rebuilds them
+    StopID spur = (StopID)(mainStops + island);
+    sys.add_route_by_names(sys.g.get_name(spur), sys.g.get_name(pickMain(rng)), 3.0);
+    bool deferred = !sys.conn.sccCurrent;
+    t0 = chrono::steady_clock::now();
+    sys.conn.reachable(sys.g, spur, 0);
+    double rebuildSecs = seconds_since(t0);
+    deferred = deferred && sys.conn.sccCurrent && same_sccs(sys.g, sys.conn);
+    cout << "two-way road between SCCs of one component: " << (deferred ? "SCCs rebuilt by the next query in " : "MISMATCH after ")
+         << rebuildSecs * 1e3 << " ms\n";
+    ok = ok && deferred;
+
+    // Bridges by brute force on a small network: close each link, count components
+    Graph small;
+    generate_city_graph(small, CityParams(1500));
+    for (size_t i = 0; i < 40; ++i)
+    {
+        StopID s = small.add_stop("Tail" + to_string(i));
+        small.add_edge(i % 2 ? (StopID)(rng() % (small.size() - 1)) : s - 1, s, 1.0, i % 3 != 0);
+    }
+    Connectivity sc;
+    sc.build(small);
+    sc.ensure_cuts(small);
+    set<pair<StopID, StopID>> links, found;
+    for (size_t u = 0; u < small.size(); ++u)
+        for (size_t j = 0; j < small.adj[u].size(); ++j)
+            if ((StopID)u != small.adj[u][j].to)
+                links.insert(make_pair(min((StopID)u, small.adj[u][j].to), max((StopID)u, small.adj[u][j].to)));
+    for (size_t i = 0; i < sc.bridges.size(); ++i)
+        found.insert(make_pair(min(sc.bridges[i].u, sc.bridges[i].v), max(sc.bridges[i].u, sc.bridges[i].v)));
+    size_t brute = 0;
+    for (set<pair<StopID, StopID>>::iterator it = links.begin(); it != links.end(); ++it)
+    {
+        DisjointSet ds(small.size());
+        size_t comps = small.size();
+        for (set<pair<StopID, StopID>>::iterator jt = links.begin(); jt != links.end(); ++jt)
+            if (jt != it)
+                comps -= ds.unite(jt->first, jt->second);
+        bool bridge = comps > sc.components;
+        brute += bridge;
+        ok = ok && bridge == (found.count(*it) > 0);
+    }
+    cout << "bridges on " << small.size() << " stops: " << found.size() << " found, " << brute << " by brute force\n";
+    cout << (ok ? "rejections and bridges match searches\n" : "MISMATCH\n");
+    return ok ? 0 : 1;
+}
+
+// All-pairs table at several network sizes: build time, file size, build memory, lookup
+// latency against Dijkstra, and exact rows and valid paths
+int bench_table(const vector<size_t> &sizes, size_t queries, int threads)
+{
+    cout << "Distance table benchmark: " << queries << " random lookups per size, " << threads << " threads\n";
+    const string file = "bench_table.apsp";
+    bool ok = true;
+    for (size_t si = 0; si < sizes.size(); ++si)
+    {
+        BusSystem sys;
+        generate_city_graph(sys.g, CityParams(sizes[si]));
+        size_t n = sys.g.size();
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        sys.ensure_hierarchy();
+        double chSecs = seconds_since(t0);
+        size_t rss0 = rss_bytes(), buffers = 0;
+        t0 = chrono::steady_clock::now();
+        ok = sys.build_distance_table(file, true, threads, &buffers) && ok;
+        double buildSecs = seconds_since(t0);
+        size_t rssGrowth = rss_bytes() > rss0 ? rss_bytes() - rss0 : 0;
+        const DistanceTable &dt = sys.table;
+        cout << n << " stops, " << count_edges(sys.g) << " edges: hierarchy " << chSecs << " s, table " << buildSecs << " s ("
+             << (double)n * n / max(buildSecs, 1e-9) / 1e6 << " M pairs/s), file " << dt.file_bytes() / 1048576.0 << " MiB with predecessors, build buffers "
+             << buffers / 1048576.0 << " MiB, RSS +" << rssGrowth / 1048576.0 << " MiB\n";
+
+        mt19937 rng(44);
+        uniform_int_distribution<int> pick(0, (int)n - 1);
+        vector<pair<StopID, StopID>> pairs(queries);
+        for (size_t q = 0; q < queries; ++q)
+            pairs[q] = make_pair(pick(rng), pick(rng));
+        double sum = 0;
+        t0 = chrono::steady_clock::now();
+        for (size_t q = 0; q < queries; ++q)
+            sum += dt.distance(pairs[q].first, pairs[q].second);
+        double tableNs = seconds_since(t0) / queries * 1e9;
+        size_t named = min(queries, (size_t)200000);
+        vector<pair<string, string>> names(named);
+        for (size_t q = 0; q < named; ++q)
+            names[q] = make_pair(sys.g.get_name(pairs[q].first).str(), sys.g.get_name(pairs[q].second).str());
+        t0 = chrono::steady_clock::now();
+        for (size_t q = 0; q < named; ++q)
+            sum += sys.estimate_eta_between(names[q].first, names[q].second);
+        double namedNs = seconds_since(t0) / named * 1e9;
+
+        // Rows against Dijkstra (the table holds floats, so allow float rounding)
+        size_t sources = 5;
+        t0 = chrono::steady_clock::now();
+        for (size_t i = 0; i < sources; ++i)
+        {
+            StopID s = pairs[i].first;
+            vector<double> ref = dijkstra(sys.g, s).first;
+            for (size_t t = 0; t < n; ++t)
+            {
+                double got = dt.distance(s, (StopID)t);
+                if (ref[t] > 1e17 || got > 1e17)
+                    ok = ok && (ref[t] > 1e17) == (got > 1e17);
+                else
+                    ok = ok && fabs(got - ref[t]) <= 1e-5 * max(1.0, ref[t]);
+            }
+        }
+        double dijkstraUs = seconds_since(t0) / sources * 1e6;
+        // Paths follow real edges and add up to the table's distance
+        size_t paths = min(queries, (size_t)1000), hops = 0;
+        for (size_t q = 0; q < paths; ++q)
+        {
+            StopID s = pairs[q].first, t = pairs[q].second;
+            vector<StopID> p = dt.path(s, t);
+            double cost = 0;
+            ok = ok && !p.empty() && p.front() == s && p.back() == t;
+            for (size_t i = 1; ok && i < p.size(); ++i)
+            {
+                double w = 1e18;
+                for (size_t j = 0; j < sys.g.adj[p[i - 1]].size(); ++j)
+                    if (sys.g.adj[p[i - 1]][j].to == p[i])
+                        w = min(w, sys.g.adj[p[i - 1]][j].weight);
+                ok = w < 1e18;
+                cost += w;
+            }
+            ok = ok && fabs(cost - dt.distance(s, t)) <= 1e-4 * max(1.0, cost);
+            hops += p.size();
+        }
+        cout << "  lookup: table " << tableNs << " ns, by name " << namedNs << " ns, dijkstra " << dijkstraUs << " us; " << paths
+             << " paths rebuilt (" << (double)hops / paths << " stops avg) (checksum " << sum << ")\n";
+        sys.table.close();
+        remove(file.c_str());
+    }
+    cout << (ok ? "table matches dijkstra, paths valid\n" : "MISMATCH\n");
+    return ok ? 0 : 1;
+}
+
+// Road closures on a large fleet: busiest roads closed, every affected bus rerouted; checks
+// stops stay in order, positions are kept, detours are shortest, threads agree and the
+// change log replays to the same fleet
+int bench_reroute(size_t n, size_t fleet, size_t closures, int threads)
+{
+    CityParams p(n);
+    p.buses = fleet;
+    BusSystem sys;
+    generate_city(sys, p);
+    mt19937 rng(45);
+    for (auto it = sys.buses.begin(); it != sys.buses.end(); ++it)
+        it->second.currentIndex = (int)(rng() % it->second.route.size());
+    // A shuttle to a dead-end stop: closing its road leaves no detour, so the shuttle is held
+    const string anchor = sys.g.get_name(0).str(), spur = "Bench Spur";
+    sys.add_stop_with_location(spur, 0, 0);
+    sys.add_route_by_names(anchor, spur, 3);
+    sys.add_bus("bench-shuttle", vector<string>{anchor, spur, anchor});
+    const string dir = "bench_reroute";
+    make_dir(dir);
+    remove((dir + "/network.snap").c_str());
+    remove((dir + "/network.wal").c_str());
+    bool ok = sys.open_store(dir);
+    size_t edges = count_edges(sys.g);
+    cout << "Closure benchmark: " << sys.g.size() << " stops, " << edges << " edges, " << sys.buses.size() << " buses, "
+         << closures << " roads closed, " << threads << " threads\n";
+
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    sys.ensure_compact();
+    double compactSecs = seconds_since(t0);
+    t0 = chrono::steady_clock::now();
+    sys.legIndex.build(sys.buses);
+    double indexSecs = seconds_since(t0);
+    cout << "setup: compact graph " << compactSecs * 1e3 << " ms, leg index " << indexSecs * 1e3 << " ms (" << sys.legIndex.legs.size()
+         << " bus legs)\n";
+
+    // Close the roads the most buses drive, at most one per stop so no stop is cut off
+    map<pair<StopID, StopID>, int> load;
+    for (size_t i = 0; i < sys.legIndex.legs.size(); ++i)
+    {
+        StopID u = (StopID)(sys.legIndex.legs[i].first >> 32), v = (StopID)(uint32_t)sys.legIndex.legs[i].first;
+        load[make_pair(min(u, v), max(u, v))]++;
+    }
+    vector<pair<int, pair<StopID, StopID>>> busiest;
+    for (map<pair<StopID, StopID>, int>::iterator it = load.begin(); it != load.end(); ++it)
+        busiest.push_back(make_pair(-it->second, it->first));
+    sort(busiest.begin(), busiest.end());
+    vector<pair<StopID, StopID>> closed(1, make_pair((StopID)0, sys.g.get_id(spur)));
+    set<StopID> touched;
+    touched.insert(0);
+    for (size_t i = 0; i < busiest.size() && closed.size() < closures; ++i)
+    {
+        StopID u = busiest[i].second.first, v = busiest[i].second.second;
+        if (touched.count(u) || touched.count(v))
+            continue;
+        touched.insert(u);
+        touched.insert(v);
+        closed.push_back(busiest[i].second);
+    }
+
+    unordered_map<string, Bus> before = sys.buses;
+    // Reference run on one thread, on a copy of the fleet
+    BusSystem single;
+    single.g = sys.g;
+    single.buses = sys.buses;
+    single.ensure_compact();
+    single.legIndex.build(single.buses);
+    RerouteReport one = single.close_roads(closed, false, 1);
+    t0 = chrono::steady_clock::now();
+    RerouteReport rep = sys.close_roads(closed, false, threads);
+    double totalSecs = seconds_since(t0);
+    cout << "closure: " << rep.closedEdges << " edges on " << rep.closedLegs << " route legs, " << rep.affected << " buses affected, "
+         << rep.rerouted << " rerouted, " << rep.stranded.size() << " without a detour, +" << rep.extraMinutes << " min in total\n";
+    cout << "time: " << totalSecs * 1e3 << " ms (detours + splicing " << rep.searchSeconds * 1e3 << " ms, apply " << rep.applySeconds * 1e3
+         << " ms); 1 thread " << (one.searchSeconds + one.applySeconds) * 1e3 << " ms\n";
+    ok = ok && one.rerouted == rep.rerouted && one.stranded == rep.stranded;
+    for (auto it = sys.buses.begin(); it != sys.buses.end(); ++it)
+        ok = ok && single.buses[it->first].route == it->second.route && single.buses[it->first].currentIndex == it->second.currentIndex;
+
+    // The closed roads left the network; every old stop is still served in order, from the
+    // same current stop, and each detour is as short as Dijkstra on what is left
+    const Graph &open = sys.g;
+    set<pair<StopID, StopID>> shut;
+    for (size_t i = 0; i < closed.size(); ++i)
+    {
+        shut.insert(closed[i]);
+        shut.insert(make_pair(closed[i].second, closed[i].first));
+    }
+    for (size_t u = 0; u < open.size(); ++u)
+        for (size_t j = 0; j < open.adj[u].size(); ++j)
+            ok = ok && !shut.count(make_pair((StopID)u, open.adj[u][j].to));
+    ok = ok && count_edges(sys.g) + rep.closedEdges == edges;
+    map<pair<StopID, StopID>, double> best;
+    size_t changed = 0;
+    for (auto it = sys.buses.begin(); it != sys.buses.end(); ++it)
+    {
+        const Bus &was = before[it->first], &now = it->second;
+        if (was.route == now.route)
+        {
+            ok = ok && was.currentIndex == now.currentIndex;
+            continue;
+        }
+        changed++;
+        ok = ok && now.current_stop() == was.current_stop();
+        size_t at = 0;
+        for (size_t j = 0; ok && j < was.route.size(); ++j)
+        {
+            size_t from = at;
+            while (at < now.route.size() && now.route[at] != was.route[j])
+                at++;
+            ok = at < now.route.size();
+            if (!ok || j == 0)
+                continue;
+            double cost = 0;
+            for (size_t k = from; k < at; ++k)
+            {
+                double w = 1e18;
+                for (size_t e = 0; e < open.adj[now.route[k]].size(); ++e)
+                    if (open.adj[now.route[k]][e].to == now.route[k + 1])
+                        w = min(w, open.adj[now.route[k]][e].weight);
+                ok = ok && w < 1e18;
+                cost += w;
+            }
+            pair<StopID, StopID> leg(was.route[j - 1], was.route[j]);
+            if (at - from > 1 && shut.count(leg) && (best.count(leg) || best.size() < 20))
+            {
+                if (!best.count(leg))
+                    best[leg] = dijkstra(open, leg.first).first[leg.second];
+                ok = ok && fabs(cost - best[leg]) <= 1e-9 * max(1.0, cost);
+            }
+        }
+    }
+    ok = ok && changed == rep.rerouted;
+    // Buses without a detour are held where they are and cannot be moved on
+    for (size_t i = 0; i < rep.stranded.size(); ++i)
+        ok = ok && BusSystem::held(sys.buses[rep.stranded[i]]);
+    ok = ok && rep.stranded == vector<string>(1, "bench-shuttle");
+    sys.move_bus_one_step("bench-shuttle");
+    ok = ok && sys.buses["bench-shuttle"].currentIndex == before["bench-shuttle"].currentIndex;
+
+    // The closure was logged as one record
+    uint64_t want = network_digest(sys);
+    sys.wal.close();
+    BusSystem back;
+    size_t replayed = 0;
+    bool recovered = back.open_store(dir, &replayed) && network_digest(back) == want && back.closedRoads == sys.closedRoads &&
+                     BusSystem::held(back.buses["bench-shuttle"]);
+    cout << "recovery: " << replayed << " logged change(s) " << (recovered ? "rebuild the closures and the rerouted fleet" : "DIFFER") << "\n";
+    // Closures survive a snapshot; reopening restores every edge and is logged too
+    recovered = recovered && back.compact_store();
+    back.wal.close();
+    BusSystem again;
+    recovered = recovered && again.open_store(dir) && network_digest(again) == want && again.closedRoads == sys.closedRoads;
+    size_t released = 0;
+    bool reopened = BusSystem::held(again.buses["bench-shuttle"]) && again.reopen_roads(closed, false, &released) == rep.closedEdges &&
+                    count_edges(again.g) == edges && again.closedRoads.empty() && released == rep.stranded.size();
+    want = network_digest(again);
+    again.wal.close();
+    BusSystem third;
+    reopened = reopened && third.open_store(dir) && network_digest(third) == want && third.closedRoads.empty() &&
+               third.buses["bench-shuttle"].active;
+    third.wal.close();
+    cout << "reopen: " << (reopened ? "every closed edge restored, held buses running again" : "DIFFER") << "\n";
+    ok = ok && recovered && reopened;
+    cout << (ok ? "routes keep their stops and positions, detours are shortest\n" : "MISMATCH\n");
+    return ok ? 0 : 1;
+}
+
+// Benchmark suite: one JSON object per line so results can be diffed and parsed
+struct BenchResult
+{
+    size_t stops;
+    string name;
+    double value;
+    string unit;
+};
+
+string bench_json(const BenchResult &r)
+{
+    stringstream ss;
+    ss << "{\"stops\":" << r.stops << ",\"bench\":\"" << r.name << "\",\"value\":" << r.value << ",\"unit\":\"" << r.unit << "\"}";
+    return ss.str();
+}
+
+// Minimal reader for the lines written by bench_json
+bool parse_bench_json(const string &line, BenchResult &r)
+{
+    size_t a = line.find("\"stops\":"), b = line.find("\"bench\":\""), c = line.find("\"value\":"), d = line.find("\"unit\":\"");
+    if (a == string::npos || b == string::npos || c == string::npos || d == string::npos)
+        return false;
+    r.stops = (size_t)atol(line.c_str() + a + 8);
+    size_t bs = b + 9;
+    r.name = line.substr(bs, line.find('"', bs) - bs);
+    r.value = atof(line.c_str() + c + 8);
+    size_t ds = d + 8;
+    r.unit = line.substr(ds, line.find('"', ds) - ds);
+    return true;
+}
+
+void run_suite_size(size_t n, vector<BenchResult> &out)
+{
+    const size_t Q = 10;
+    BusSystem sys;
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    generate_city(sys, CityParams(n));
+    size_t stops = sys.g.size();
+    out.push_back(BenchResult{stops, "generate", seconds_since(t0) * 1e3, "ms"});
+    mt19937 rng(17);
+    uniform_int_distribution<int> pick(0, (int)stops - 1);
+
+    t0 = chrono::steady_clock::now();
+    for (size_t q = 0; q < Q; ++q)
+        dijkstra(sys.g, pick(rng));
+    out.push_back(BenchResult{stops, "dijkstra", seconds_since(t0) * 1e3 / Q, "ms/query"});
+
+    t0 = chrono::steady_clock::now();
+    for (size_t q = 0; q < Q; ++q)
+        astar(sys.g, pick(rng), pick(rng));
+    out.push_back(BenchResult{stops, "astar", seconds_since(t0) * 1e3 / Q, "ms/query"});
+
+    t0 = chrono::steady_clock::now();
+    prim_mst(sys.g);
+    out.push_back(BenchResult{stops, "prim_mst", seconds_since(t0) * 1e3, "ms"});
+
+    t0 = chrono::steady_clock::now();
+    minimum_spanning_forest(sys.g);
+    out.push_back(BenchResult{stops, "spanning_forest", seconds_since(t0) * 1e3, "ms"});
+
+    // The pointer trie costs ~100 bytes per node; keep it to networks that fit comfortably
+    if (stops <= 1000000)
+    {
+        t0 = chrono::steady_clock::now();
+        for (size_t i = 0; i < stops; ++i)
+            sys.trie.insert(sys.g.get_name((StopID)i));
+        out.push_back(BenchResult{stops, "trie_build", seconds_since(t0) * 1e3, "ms"});
+        t0 = chrono::steady_clock::now();
+        size_t hits = 0;
+        for (size_t q = 0; q < 1000; ++q)
+            hits += sys.suggest_stops(sys.g.get_name(pick(rng)).str().substr(0, 4)).size();
+        out.push_back(BenchResult{stops, "trie_suggest", seconds_since(t0) * 1e6 / 1000, "us/query"});
+    }
+
+    t0 = chrono::steady_clock::now();
+    for (size_t q = 0; q < Q; ++q)
+        sys.move_all_buses_one_step();
+    out.push_back(BenchResult{stops, "fleet_tick", seconds_since(t0) * 1e3 / Q, "ms/tick"});
+
+    string sf = "bench_stops.tmp", ef = "bench_edges.tmp", bf = "bench_graph.tmp";
+    t0 = chrono::steady_clock::now();
+    sys.g.save_to(sf, ef);
+    out.push_back(BenchResult{stops, "save_text", seconds_since(t0) * 1e3, "ms"});
+    Graph copy;
+    t0 = chrono::steady_clock::now();
+    copy.load_from(sf, ef);
+    out.push_back(BenchResult{stops, "load_text", seconds_since(t0) * 1e3, "ms"});
+    t0 = chrono::steady_clock::now();
+    sys.g.save_binary(bf);
+    out.push_back(BenchResult{stops, "save_binary", seconds_since(t0) * 1e3, "ms"});
+    t0 = chrono::steady_clock::now();
+    copy.load_binary(bf);
+    out.push_back(BenchResult{stops, "load_binary", seconds_since(t0) * 1e3, "ms"});
+    remove(sf.c_str());
+    remove(ef.c_str());
+    remove(bf.c_str());
+}
+
+// --bench [sizes] [--out file] [--baseline file]
+int run_benchmark_suite(const vector<string> &args)
+{
+    vector<size_t> sizes;
+    string outFile, baselineFile;
+    for (size_t i = 1; i < args.size(); ++i)
+    {
+        if (args[i] == "--out" && i + 1 < args.size())
+            outFile = args[++i];
+        else if (args[i] == "--baseline" && i + 1 < args.size())
+            baselineFile = args[++i];
+        else
+        {
+            stringstream ss(args[i]);
+            string tok;
+            while (getline(ss, tok, ','))
+                if (atol(tok.c_str()) > 0)
+                    sizes.push_back((size_t)atol(tok.c_str()));
+        }
+    }
+    if (sizes.empty())
+    {
+        sizes.push_back(1000);
+        sizes.push_back(10000);
+        sizes.push_back(100000);
+    }
+    vector<BenchResult> results;
+    for (size_t i = 0; i < sizes.size(); ++i)
+    {
+        size_t before = results.size();
+        run_suite_size(sizes[i], results);
+        for (size_t j = before; j < results.size(); ++j)
+            cout << bench_json(results[j]) << endl;
+    }
+    if (!outFile.empty())
+    {
+        ofstream ofs(outFile.c_str());
+        for (size_t i = 0; i < results.size(); ++i)
+            ofs << bench_json(results[i]) << "\n";
+    }
+    if (!baselineFile.empty())
+    {
+        ifstream ifs(baselineFile.c_str());
+        if (!ifs)
+        {
+            cout << "Could not open baseline " << baselineFile << "\n";
+            return 1;
+        }
+        map<pair<size_t, string>, double> base;
+        string line;
+        BenchResult r;
+        while (getline(ifs, line))
+            if (parse_bench_json(line, r))
+                base[make_pair(r.stops, r.name)] = r.value;
+        size_t slower = 0;
+        cout << "Compared with " << baselineFile << " (ratio = current / baseline):\n";
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            map<pair<size_t, string>, double>::iterator it = base.find(make_pair(results[i].stops, results[i].name));
+            if (it == base.end() || it->second <= 0)
+                continue;
+            double ratio = results[i].value / it->second;
+            bool flag = ratio > 1.25;
+            slower += flag;
+            cout << "  " << results[i].stops << " " << results[i].name << ": " << ratio << (flag ? "  SLOWER" : "") << "\n";
+        }
+        cout << slower << " measurements more than 25% slower than baseline\n";
+    }
+    return 0;
+}
+
+// Same routing workload with probes on and off; the difference is the metrics overhead
+int bench_metrics(size_t n, size_t queries)
+{
+    BusSystem sys;
+    generate_city(sys, CityParams(n));
+    sys.routeCache = RouteCache(0);
+    mt19937 rng(23);
+    uniform_int_distribution<int> pick(0, (int)sys.g.size() - 1);
+    vector<pair<string, string>> od(queries);
+    for (size_t q = 0; q < queries; ++q)
+        od[q] = make_pair(sys.g.get_name(pick(rng)), sys.g.get_name(pick(rng)));
+    cout << "Metrics overhead benchmark: " << sys.g.size() << " stops, " << queries << " queries x (dijkstra + A*) + ticks\n";
+    double secs[2] = {1e18, 1e18};
+    // Alternate rounds so frequency scaling and cache warmth hit both modes alike;
+    // the fastest round of each mode is the least disturbed by other load
+    for (int round = 0; round < 10; ++round)
+    {
+        int mode = round % 2; // 0 = probes on, 1 = probes off
+        metricsRegistry.enabled = mode == 0;
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        for (size_t q = 0; q < queries; ++q)
+        {
+            sys.shortest_path_names(od[q].first, od[q].second);
+            sys.astar_names(od[q].first, od[q].second);
+            sys.move_all_buses_one_step();
+        }
+        secs[mode] = min(secs[mode], seconds_since(t0));
+    }
+    metricsRegistry.enabled = true;
+    double overhead = (secs[0] - secs[1]) / secs[1] * 100.0;
+#ifdef SCR_NO_METRICS
+    cout << "built with SCR_NO_METRICS: probes are compiled out\n";
+#endif
+    cout << "probes on:  " << secs[0] << " s/round\nprobes off: " << secs[1] << " s/round\noverhead:   " << overhead << " %\n";
+    return 0;
+}
+
+#ifndef _WIN32
+// Accept ping streams on a local TCP port, one client at a time
+int listen_pings(BusSystem &sys, int port)
+{
+    int srv = socket(AF_INET, SOCK_STREAM, 0);
+    if (srv < 0)
+        return 1;
+    int one = 1;
+    setsockopt(srv, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((uint16_t)port);
+    if (bind(srv, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(srv, 4) < 0)
+    {
+        cout << "Could not listen on port " << port << "\n";
+        close(srv);
+        return 1;
+    }
+    cout << "Listening for pings on 127.0.0.1:" << port << endl;
+    PingIngestor ing(sys);
+    while (true)
+    {
+        int fd = accept(srv, NULL, NULL);
+        if (fd < 0)
+            break;
+        FILE *fp = fdopen(fd, "r");
+        if (!fp)
+        {
+            close(fd);
+            continue;
+        }
+        ing.ingest_stream(fp, 512);
+        fclose(fp);
+        cout << "Client done: " << ing.stats() << endl;
+    }
+    close(srv);
+    return 0;
+}
+#endif
+
+int run_tool(const vector<string> &args)
+{
+    BusSystem sys;
+    if (args[0] == "--gen-pings" && args.size() >= 2)
+    {
+        load_tool_network(sys);
+        size_t count = args.size() >= 3 ? (size_t)atol(args[2].c_str()) : 100000;
+        size_t n = write_synthetic_pings(sys, args[1], count);
+        cout << "Wrote " << n << " pings to " << args[1] << "\n";
+        return n > 0 ? 0 : 1;
+    }
+    if (args[0] == "--replay-pings" && args.size() >= 2)
+    {
+        load_tool_network(sys);
+        size_t batch = args.size() >= 3 ? (size_t)atol(args[2].c_str()) : 4096;
+        FILE *fp = fopen(args[1].c_str(), "r");
+        if (!fp)
+        {
+            cout << "Could not open " << args[1] << "\n";
+            return 1;
+        }
+        PingIngestor ing(sys);
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        ing.ingest_stream(fp, max((size_t)1, batch));
+        double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+        fclose(fp);
+        cout << "Replay: " << ing.stats() << "\n";
+        cout << "Elapsed: " << secs << " s, throughput: " << (secs > 0 ? ing.pings / secs : 0) << " pings/s\n";
+        return 0;
+    }
+    if (args[0] == "--gen-city" && args.size() >= 2)
+    {
+        CityParams p((size_t)atol(args[1].c_str()), args.size() >= 3 ? (unsigned)atol(args[2].c_str()) : 1);
+        if (args.size() >= 4)
+            p.buses = (size_t)atol(args[3].c_str());
+        generate_city(sys, p);
+        make_dir("data");
+        bool ok = sys.g.save_to("data/stops.txt", "data/edges.txt") && sys.save_buses("data/buses.txt") && sys.g.save_binary("data/graph.bin");
+        cout << "Generated " << sys.g.size() << " stops, " << sys.buses.size() << " buses into data/ (" << (ok ? "ok" : "write failed") << ")\n";
+        return ok ? 0 : 1;
+    }
+    if (args[0] == "--bench")
+        return run_benchmark_suite(args);
+    if (args[0] == "--bench-metrics")
+    {
+        size_t n = args.size() >= 2 ? (size_t)atol(args[1].c_str()) : 20000;
+        size_t q = args.size() >= 3 ? (size_t)atol(args[2].c_str()) : 50;
+        return bench_metrics(max((size_t)2, n), max((size_t)1, q));
+    }
+    if (args[0] == "--bench-names")
+    {
+        size_t n = args.size() >= 2 ? (size_t)atol(args[1].c_str()) : 1000000;
+        size_t q = args.size() >= 3 ? (size_t)atol(args[2].c_str()) : 2000000;
+        return bench_names(max((size_t)1, n), max((size_t)1, q));
+    }
+    if (args[0] == "--stress-snapshots" || args[0] == "--bench-snapshots")
+    {
+        int readers = args.size() >= 2 ? atoi(args[1].c_str()) : 2;
+        double secs = args.size() >= 3 ? atof(args[2].c_str()) : 3.0;
+        if (args[0] == "--stress-snapshots")
+            return stress_snapshots(max(1, readers), secs);
+        return bench_snapshots(max(1, readers), secs);
+    }
+    if (args[0] == "--bench-board")
+    {
+        size_t buses = args.size() >= 2 ? (size_t)atol(args[1].c_str()) : 10000;
+        size_t q = args.size() >= 3 ? (size_t)atol(args[2].c_str()) : 1000000;
+        size_t n = args.size() >= 4 ? (size_t)atol(args[3].c_str()) : 50000;
+        return bench_board(max((size_t)2, n), max((size_t)1, buses), max((size_t)1, q));
+    }
+    if (args[0] == "--bench-weights")
+    {
+        size_t n = args.size() >= 2 ? (size_t)atol(args[1].c_str()) : 200000;
+        size_t q = args.size() >= 3 ? (size_t)atol(args[2].c_str()) : 20;
+        return bench_weights(max((size_t)2, n), max((size_t)1, q));
+    }
+    if (args[0] == "--bench-sssp")
+    {
+        size_t n = args.size() >= 2 ? (size_t)atol(args[1].c_str()) : 200000;
+        int threads = args.size() >= 3 ? atoi(args[2].c_str()) : 64;
+        size_t q = args.size() >= 4 ? (size_t)atol(args[3].c_str()) : 3;
+        return bench_sssp(max((size_t)2, n), max(1, threads), max((size_t)1, q));
+    }
+    if (args[0] == "--build-labels")
+    {
+        load_tool_network(sys);
+        string file = args.size() >= 2 ? args[1] : "data/labels.hub";
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        sys.build_hub_labels();
+        bool ok = sys.hubs.save(file);
+        cout << "Built " << sys.hubs.entries() << " label entries (" << sys.hubs.memory_bytes() / 1048576.0 << " MiB) in "
+             << seconds_since(t0) << " s -> " << file << (ok ? "" : " (write failed)") << "\n";
+        return ok ? 0 : 1;
+    }
+    if (args[0] == "--bench-labels")
+    {
+        vector<size_t> sizes;
+        stringstream ss(args.size() >= 2 ? args[1] : string("1000,10000,50000"));
+        string tok;
+        while (getline(ss, tok, ','))
+            if (atol(tok.c_str()) > 1)
+                sizes.push_back((size_t)atol(tok.c_str()));
+        size_t q = args.size() >= 3 ? (size_t)atol(args[2].c_str()) : 1000000;
+        return bench_labels(sizes, max((size_t)1, q));
+    }
+    if (args[0] == "--bench-wal")
+    {
+        size_t n = args.size() >= 2 ? (size_t)atol(args[1].c_str()) : 100000;
+        size_t q = args.size() >= 3 ? (size_t)atol(args[2].c_str()) : 100000;
+        return bench_wal(max((size_t)2, n), max((size_t)1, q));
+    }
+    if (args[0] == "--bench-layout")
+    {
+        size_t n = args.size() >= 2 ? (size_t)atol(args[1].c_str()) : 1000000;
+        size_t q = args.size() >= 3 ? (size_t)atol(args[2].c_str()) : 10;
+        return bench_layout(max((size_t)2, n), max((size_t)1, q));
+    }
+    if (args[0] == "--scenarios")
+    {
+        load_tool_network(sys);
+        ScenarioParams p;
+        p.scenarios = max((size_t)1, args.size() >= 2 ? (size_t)atol(args[1].c_str()) : p.scenarios);
+        int threads = args.size() >= 3 ? max(1, atoi(args[2].c_str())) : hardware_threads();
+        if (args.size() >= 4)
+            p.breakdownsPerHour = atof(args[3].c_str());
+        ScenarioModel model;
+        model.build(sys);
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        vector<ScenarioOutcome> runs = model.run(p, threads);
+        cout << runs.size() << " scenarios in " << seconds_since(t0) << " s on " << threads << " threads\n";
+        print_scenario_summary(summarize_scenarios(runs), runs.size());
+        return 0;
+    }
+    if (args[0] == "--bench-scenarios")
+    {
+        size_t q = args.size() >= 2 ? (size_t)atol(args[1].c_str()) : 2000;
+        int threads = args.size() >= 3 ? atoi(args[2].c_str()) : hardware_threads();
+        size_t n = args.size() >= 4 ? (size_t)atol(args[3].c_str()) : 50000;
+        return bench_scenarios(max((size_t)2, n), max((size_t)1, q), max(1, threads));
+    }
+    if (args[0] == "--critical-links")
+    {
+        load_tool_network(sys);
+        sys.print_critical_links(cout, args.size() >= 2 ? (size_t)atol(args[1].c_str()) : 20);
+        return 0;
+    }
+    if (args[0] == "--bench-connectivity")
+    {
+        size_t n = args.size() >= 2 ? (size_t)atol(args[1].c_str()) : 1000000;
+        size_t q = args.size() >= 3 ? (size_t)atol(args[2].c_str()) : 100000;
+        return bench_connectivity(max((size_t)2, n), max((size_t)1, q));
+    }
+    if (args[0] == "--build-table")
+    {
+        load_tool_network(sys);
+        string file = args.size() >= 2 ? args[1] : "data/table.apsp";
+        bool pred = args.size() >= 3 && args[2] == "--paths";
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        size_t buffers = 0;
+        bool ok = sys.build_distance_table(file, pred, 0, &buffers);
+        cout << "Built " << sys.g.size() << " x " << sys.g.size() << " table" << (pred ? " with predecessors" : "") << " ("
+             << sys.table.file_bytes() / 1048576.0 << " MiB, " << buffers / 1048576.0 << " MiB working memory) in " << seconds_since(t0)
+             << " s -> " << file << (ok ? "" : " (failed)") << "\n";
+        return ok ? 0 : 1;
+    }
+    if (args[0] == "--bench-table")
+    {
+        vector<size_t> sizes;
+        stringstream ss(args.size() >= 2 ? args[1] : string("1000,5000,10000"));
+        string tok;
+        while (getline(ss, tok, ','))
+            if (atol(tok.c_str()) > 1)
+                sizes.push_back((size_t)atol(tok.c_str()));
+        size_t q = args.size() >= 3 ? (size_t)atol(args[2].c_str()) : 1000000;
+        int threads = args.size() >= 4 ? atoi(args[3].c_str()) : hardware_threads();
+        return bench_table(sizes, max((size_t)1, q), max(1, threads));
+    }
+    if (args[0] == "--bench-reroute")
+    {
+        size_t buses = args.size() >= 2 ? (size_t)atol(args[1].c_str()) : 5000;
+        size_t closures = args.size() >= 3 ? (size_t)atol(args[2].c_str()) : 500;
+        size_t n = args.size() >= 4 ? (size_t)atol(args[3].c_str()) : 200000;
+        int threads = args.size() >= 5 ? atoi(args[4].c_str()) : hardware_threads();
+        return bench_reroute(max((size_t)2, n), max((size_t)1, buses), max((size_t)1, closures), max(1, threads));
+    }
+    if (args[0] == "--bench-mst")
+    {
+        size_t n = args.size() >= 2 ? (size_t)atol(args[1].c_str()) : 200000;
+        int threads = args.size() >= 3 ? atoi(args[2].c_str()) : hardware_threads();
+        return bench_mst(max((size_t)2, n), max(1, threads));
+    }
+    if (args[0] == "--bench-cache")
+    {
+        size_t n = args.size() >= 2 ? (size_t)atol(args[1].c_str()) : 10000;
+        size_t q = args.size() >= 3 ? (size_t)atol(args[2].c_str()) : 100000;
+        double s = args.size() >= 4 ? atof(args[3].c_str()) : 1.0;
+        int threads = args.size() >= 5 ? atoi(args[4].c_str()) : hardware_threads();
+        return bench_cache(max((size_t)2, n), max((size_t)1, q), s, max(1, threads));
+    }
+    if (args[0] == "--bench-isochrone")
+    {
+        size_t n = args.size() >= 2 ? (size_t)atol(args[1].c_str()) : 50000;
+        size_t origins = args.size() >= 3 ? (size_t)atol(args[2].c_str()) : 64;
+        return bench_isochrone(max((size_t)2, n), max((size_t)1, origins));
+    }
+    if (args[0] == "--bench-alternatives")
+    {
+        size_t n = args.size() >= 2 ? (size_t)atol(args[1].c_str()) : 200000;
+        size_t q = args.size() >= 3 ? (size_t)atol(args[2].c_str()) : 50;
+        int k = args.size() >= 4 ? atoi(args[3].c_str()) : 3;
+        return bench_alternatives(max((size_t)2, n), max((size_t)1, q), max(1, k));
+    }
+#ifndef _WIN32
+    if (args[0] == "--sharded" && args.size() >= 2)
+    {
+        size_t n = args.size() >= 3 ? (size_t)atol(args[2].c_str()) : 20000;
+        size_t q = args.size() >= 4 ? (size_t)atol(args[3].c_str()) : 200;
+        return bench_sharded(max((size_t)2, n), max(1, atoi(args[1].c_str())), max((size_t)1, q));
+    }
+    if (args[0] == "--serve-sharded" && args.size() >= 2)
+    {
+        load_tool_network(sys);
+        return serve_sharded(sys, max(1, atoi(args[1].c_str())));
+    }
+    if (args[0] == "--listen-pings" && args.size() >= 2)
+    {
+        load_tool_network(sys);
+        return listen_pings(sys, atoi(args[1].c_str()));
+    }
+#endif
+    cout << "Usage:\n";
+    cout << "  main --gen-city <stops> [seed] [buses]  write a synthetic city to data/*.txt and data/graph.bin\n";
+    cout << "  main --bench [1000,10000,...] [--out file] [--baseline file]  benchmark suite (JSON lines)\n";
+    cout << "  main --gen-pings <file> [count]     record synthetic pings for the fleet\n";
+    cout << "  main --replay-pings <file> [batch]  replay a ping file and report throughput\n";
+    cout << "  main --listen-pings <port>          ingest pings streamed to 127.0.0.1:<port>\n";
+    cout << "  main --build-labels [file]          hub labels for data/*.txt (default data/labels.hub, loaded by the tools)\n";
+    cout << "  main --bench-labels [1000,10000,...] [queries]  hub-label size, build time and query latency\n";
+    cout << "  main --build-table [file] [--paths]  all-pairs table for data/*.txt (default data/table.apsp, mapped by the tools)\n";
+    cout << "  main --bench-table [1000,5000,...] [queries] [threads]  all-pairs build time, memory and lookup latency\n";
+    cout << "  main --bench-wal [stops] [changes]  change log saves, fsync batching and recovery\n";
+    cout << "  main --bench-layout [stops] [queries]  Dijkstra/A* speed and cache misses per stop numbering\n";
+    cout << "  main --scenarios [count] [threads] [breakdowns_per_hour]  Monte Carlo on-time distribution for data/*.txt\n";
+    cout << "  main --bench-scenarios [scenarios] [max_threads] [stops]  scenarios/s and fork cost\n";
+    cout << "  main --critical-links [top]         components and links whose closure splits data/*.txt\n";
+    cout << "  main --bench-connectivity [stops] [queries]  unreachable-query rejection, incremental upkeep, bridges\n";
+    cout << "  main --bench-reroute [buses] [closures] [stops] [threads]  reroute the fleet around the busiest roads\n";
+    cout << "  main --bench-mst [stops] [threads]  Prim vs parallel spanning forest\n";
+    cout << "  main --bench-sssp [stops] [max_threads] [sources]  delta-stepping vs dijkstra, 1..max threads\n";
+    cout << "  main --bench-metrics [stops] [queries]  cost of the metrics probes\n";
+    cout << "  main --bench-names [stops] [lookups]  name arena memory and lookup throughput\n";
+    cout << "  main --bench-weights [stops] [searches]  double vs float vs fixed-point weights\n";
+    cout << "  main --bench-board [buses] [queries] [stops]  departure boards and on-route ETAs\n";
+    cout << "  main --stress-snapshots [readers] [seconds]  concurrent readers during edits and reloads\n";
+    cout << "  main --bench-snapshots [readers] [seconds]   reader latency: RCU snapshots vs a mutex\n";
+    cout << "  main --bench-cache [stops] [queries] [zipf_s] [threads]  route cache on a Zipf workload\n";
+    cout << "  main --bench-isochrone [stops] [origins]  PHAST sweeps vs repeated Dijkstra\n";
+    cout << "  main --bench-alternatives [stops] [queries] [k]  k alternative routes latency\n";
+    cout << "  main --sharded <k> [stops] [queries]  partition into k shard processes and verify routing\n";
+    cout << "  main --serve-sharded <k>            answer source<TAB>destination lines for data/*.txt from k shards\n";
+    return 1;
+}
+
+// Main
+int main(int argc, char **argv)
+{
+    ios::sync_with_stdio(false);
+    cin.tie(nullptr);
+
+    if (argc > 1)
+        return run_tool(vector<string>(argv + 1, argv + argc));
 
     BusSystem system;
     build_sample_data(system);
+    bool existing = (bool)ifstream("data/network.snap");
+    size_t replayed = 0;
+    bool stored = system.open_store("data", &replayed);
 
     cout << "Bus Tracking System (C++) - Demo backend\n";
-    cout << "Sample data loaded. Use CLI to interact.\n";
+    if (stored && existing)
+        cout << "Recovered data/network.snap + " << replayed << " logged changes. Use CLI to interact.\n";
+    if (system.unreadable > 0)
+        cout << system.unreadable << " logged changes could not be read and were skipped (details in the log).\n";
+    else
+        cout << "Sample data loaded. Use CLI to interact.\n";
+    if (!stored)
+        cout << "Could not open the data/ store; changes will not be saved.\n";
+    load_data_indexes(system);
     cout << "Note: edges' weights are treated as minutes for ETA calculations.\n";
 
     cli_loop(system);
@@ -11,7 +11,7 @@ import os
 import subprocess
 import threading
 import time
-from flask import Flask, jsonify, request, send_from_directory
+from flask import Flask, Response, jsonify, request, send_from_directory
 
 app = Flask(__name__, static_folder='static', template_folder='templates')
 
@@ -28,6 +28,8 @@ read_thread = None
 INITIAL_PROMPT_TIMEOUT = 12.0
 # HOW LONG to wait for a command's output (after sending)
 COMMAND_TIMEOUT = 8.0
+# First line of the menu the CLI prints after every command
+MENU_HEADER = "=== Bus Tracking System CLI ==="
 
 def compile_binary():
     """Compile main.cpp to BIN if possible. Returns True on success or if BIN already exists."""
@@ -37,8 +39,8 @@ def compile_binary():
     if not os.path.exists(cpp):
         print("No main.cpp found to compile at:", cpp)
         return False
-    # Use g++ -std=c++11
-    cmd = ["g++", "-std=c++11", "main.cpp", "-o", os.path.basename(BIN)]
+    # Use g++ -std=c++11 (-pthread for the parallel engines)
+    cmd = ["g++", "-std=c++11", "-O2", "-pthread", "main.cpp", "-o", os.path.basename(BIN)]
     print("Compiling", cpp, "->", BIN)
     try:
         rc = subprocess.call(cmd, cwd=BASEDIR)
@@ -284,6 +286,17 @@ def logs():
     except Exception as e:
         return jsonify({"error": str(e), "output": ""}), 500
 
+@app.route("/metrics")
+def metrics():
+    # Prometheus scrapes plain text, not the JSON wrapper used elsewhere
+    try:
+        out = send_commands(["23"])
+        # Keep only the exposition: the CLI reprints its menu right after it
+        out = out.split(MENU_HEADER)[0].strip("\n") + "\n"
+        return Response(out, mimetype="text/plain")
+    except Exception as e:
+        return Response("# error: " + str(e) + "\n", status=500, mimetype="text/plain")
+
 if __name__ == "__main__":
     start_proc()
     print("Server running; binary stdout collector started.")